@@ -6,15 +6,36 @@
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "zygote.h"
+#include "trace.h"
+#include "scan.h"
+#include "frecency.h"
+#include "chmod.h"
+#include "memo.h"
 
 #include <cstring>     // For strcpy
 #include <fcntl.h>     // For open and its flags  // for `open` and its MACROs
 #include <sys/types.h> // For data types          // for `open` and its MACROs
 #include <sys/stat.h>  // For mode constants      // for `open` and its MACROs
+#include <signal.h>
+#include <errno.h>
+#include <thread>
+#include <algorithm>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <iterator>
+#include <limits.h>
+#include <fnmatch.h>
 
-#define COMMAND_MAX_PATH_LENGTH (80)
 #define COMMAND_MAX_LENGTH (80)
 
+extern char **environ;
+
 using namespace std;
 
 const std::string WHITESPACE = " \n\r\t\f\v";
@@ -32,19 +53,26 @@ const std::string WHITESPACE = " \n\r\t\f\v";
 
 string _ltrim(const std::string &s)
 {
-  size_t start = s.find_first_not_of(WHITESPACE);
-  return (start == std::string::npos) ? "" : s.substr(start);
+  size_t begin = 0;
+  size_t end = 0;
+  LineScan::trim(s.data(), s.size(), &begin, &end);
+  return (begin == end) ? "" : s.substr(begin);
 }
 
 string _rtrim(const std::string &s)
 {
-  size_t end = s.find_last_not_of(WHITESPACE);
-  return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+  size_t begin = 0;
+  size_t end = 0;
+  LineScan::trim(s.data(), s.size(), &begin, &end);
+  return s.substr(0, end);
 }
 
 string _trim(const std::string &s)
 {
-  return _rtrim(_ltrim(s));
+  size_t begin = 0;
+  size_t end = 0;
+  LineScan::trim(s.data(), s.size(), &begin, &end);
+  return s.substr(begin, end - begin);
 }
 
 int _parseCommandLine(const char *cmd_line, char **args)
@@ -66,29 +94,489 @@ int _parseCommandLine(const char *cmd_line, char **args)
 
 bool _isBackgroundCommand(const char *cmd_line)
 {
-  const string str(cmd_line);
-  return str[str.find_last_not_of(WHITESPACE)] == '&';
+  return LineScan::of(cmd_line).last() == '&';
 }
 
 void _removeBackgroundSign(char *cmd_line)
 {
-  const string str(cmd_line);
   // find last character other than spaces
-  unsigned int idx = str.find_last_not_of(WHITESPACE);
+  size_t begin = 0;
+  size_t end = 0;
+  LineScan::trim(cmd_line, strlen(cmd_line), &begin, &end);
   // if all characters are spaces then return
-  if (idx == string::npos)
+  if (begin == end)
   {
     return;
   }
   // if the command line does not end with & then return
-  if (cmd_line[idx] != '&')
+  if (cmd_line[end - 1] != '&')
   {
     return;
   }
   // replace the & (background sign) with space and then remove all tailing spaces.
-  cmd_line[idx] = ' ';
+  cmd_line[end - 1] = ' ';
   // truncate the command line string up to the last non-space character
-  cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
+  LineScan::trim(cmd_line, end - 1, &begin, &end);
+  cmd_line[end] = 0;
+}
+
+// converts a status returned by waitpid to a shell exit status (128 + signal if killed)
+int _status_from_wait(int wstatus)
+{
+  if (WIFEXITED(wstatus))
+  {
+    return WEXITSTATUS(wstatus);
+  }
+  if (WIFSIGNALED(wstatus))
+  {
+    return 128 + WTERMSIG(wstatus);
+  }
+  if (WIFSTOPPED(wstatus))
+  {
+    return 128 + WSTOPSIG(wstatus);
+  }
+  return 0;
+}
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1UL << 2) // linux 6.9
+#endif
+
+// a variable name is a letter or _ followed by letters, digits and _
+bool _is_valid_name(const std::string &name)
+{
+  if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+  {
+    return false;
+  }
+  for (char c : name)
+  {
+    if (!(isalnum((unsigned char)c) || c == '_'))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool _is_assignment(const std::string &word)
+{
+  size_t equal = word.find('=');
+  return equal != std::string::npos && _is_valid_name(word.substr(0, equal));
+}
+
+// moves the leading `NAME=value` words of the line to assignments and returns the rest of the line
+std::string _split_assignments(const std::string &cmd_line, std::vector<std::string> &assignments)
+{
+  size_t position = cmd_line.find_first_not_of(WHITESPACE);
+  while (position != std::string::npos)
+  {
+    size_t end = cmd_line.find_first_of(WHITESPACE, position);
+    std::string word = cmd_line.substr(position, end - position);
+    if (!_is_assignment(word))
+    {
+      return cmd_line.substr(position);
+    }
+    assignments.push_back(word);
+    position = cmd_line.find_first_not_of(WHITESPACE, end);
+  }
+  return "";
+}
+
+// the line (already expanded) would run external programs only
+bool _is_external_line(const std::string &cmd_line)
+{
+  Command *cmd = SmallShell::getInstance().CreateCommand(cmd_line.c_str(), true);
+  bool external = cmd != nullptr && cmd->isExternal();
+  delete cmd;
+  return external;
+}
+
+// the index of the `)` that closes the `$(` at open, npos if there is none
+size_t _find_substitution_end(const std::string &s, size_t open)
+{
+  int depth = 0;
+  for (size_t i = open + 1; i < s.size(); i++)
+  {
+    if (s[i] == '(')
+    {
+      depth++;
+    }
+    else if (s[i] == ')' && --depth == 0)
+    {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+// a value pasted into a line that bash parses again: split at whitespace and globbed like an unquoted $VAR of bash,
+// and nothing else. a new line would end the command there, it splits words like the other whitespace
+std::string _bash_escape(const std::string &value)
+{
+  static const char *const LITERAL = "*?[]-_./,:+@%";
+  std::string escaped;
+  for (char c : value)
+  {
+    if (c == '\n')
+    {
+      escaped += ' ';
+      continue;
+    }
+    if (!isalnum((unsigned char)c) && !isspace((unsigned char)c) && strchr(LITERAL, c) == nullptr)
+    {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+// the characters that split a line (| > & ;) of a value pasted into it, stood in for by control characters the
+// parser does not look at. so a value is never a pipe or a redirection, it gets them back where the words leave the
+// parser (the argv, the arguments of a builtin, the path of a redirection)
+static const char MARKED[] = "|>&;";
+static const char MARKS[] = "\x1c\x1d\x1e\x1f";
+
+std::string _mark_literal(const std::string &value)
+{
+  std::string marked(value);
+  for (char &c : marked)
+  {
+    const char *special = strchr(MARKED, c);
+    if (c != '\0' && special != nullptr)
+    {
+      c = MARKS[special - MARKED];
+    }
+  }
+  return marked;
+}
+
+std::string _unmark_literal(const std::string &text)
+{
+  std::string unmarked(text);
+  for (char &c : unmarked)
+  {
+    const char *mark = strchr(MARKS, c);
+    if (c != '\0' && mark != nullptr)
+    {
+      c = MARKED[mark - MARKS];
+    }
+  }
+  return unmarked;
+}
+
+// a pidfd refers to the process itself and not to its pid, it becomes readable when the process exits
+int _pidfd_open(pid_t pid)
+{
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int _pidfd_send_signal(int pidfd, int sig, unsigned int flags)
+{
+  return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, flags);
+}
+
+// milliseconds on CLOCK_MONOTONIC (not affected by changes of the wall clock)
+long long _monotonic_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// the priority of a background job in the admission queue: JOBPRIO of `JOBPRIO=n cmd &` or of the shell
+int _job_priority(const Command *cmd)
+{
+  std::string value;
+  for (const std::string &override : cmd->getEnvOverrides())
+  {
+    if (override.compare(0, 8, "JOBPRIO=") == 0)
+    {
+      value = override.substr(8);
+    }
+  }
+  if (value.empty())
+  {
+    SmallShell::getInstance().getEnvironment().get("JOBPRIO", value);
+  }
+  return atoi(value.c_str());
+}
+
+// a number of seconds or a number with s, m, h or d after it, false if it is not a positive duration
+bool _parse_duration(const std::string &text, long long *ms)
+{
+  static const std::string UNITS = "smhd";
+  static const long long UNIT_MS[] = {1000, 60 * 1000, 60 * 60 * 1000, 24 * 60 * 60 * 1000};
+  size_t unit = (!text.empty() && UNITS.find(text.back()) != std::string::npos) ? UNITS.find(text.back()) : 0;
+  std::string number = (!text.empty() && UNITS.find(text.back()) != std::string::npos) ? text.substr(0, text.size() - 1)
+                                                                                        : text;
+  try
+  {
+    size_t end = 0;
+    double value = std::stod(number, &end);
+    if (end != number.size() || !(value > 0) || value > 1e9)
+    {
+      return false;
+    }
+    *ms = (long long)(value * UNIT_MS[unit]);
+    return *ms > 0;
+  }
+  catch (const std::exception &e)
+  {
+    return false;
+  }
+}
+
+// the ms until the next time the clock shows HH:MM[:SS], false if the text is not such a time
+bool _parse_clock_time(const std::string &text, long long *ms)
+{
+  int hours = -1, minutes = -1, seconds = 0;
+  char rest = '\0';
+  int fields = sscanf(text.c_str(), "%d:%d:%d%c", &hours, &minutes, &seconds, &rest);
+  if ((fields != 2 && fields != 3) || hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0 ||
+      seconds > 59 || text.find_first_not_of("0123456789:") != std::string::npos)
+  {
+    return false;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  struct tm when;
+  localtime_r(&now.tv_sec, &when);
+  when.tm_hour = hours;
+  when.tm_min = minutes;
+  when.tm_sec = seconds;
+  when.tm_isdst = -1;
+  time_t target = mktime(&when);
+  if (target <= now.tv_sec) // already passed today
+  {
+    when.tm_mday++;
+    when.tm_isdst = -1;
+    target = mktime(&when);
+  }
+  *ms = (long long)(target - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+  return target != (time_t)-1;
+}
+
+// path with `.`, `..` and repeated slashes removed without looking at the file system (how `cd -L` sees it)
+std::string _normalize_path(const std::string &path)
+{
+  std::vector<std::string> components;
+  size_t begin = 0;
+  while (begin < path.size())
+  {
+    size_t end = path.find('/', begin);
+    end = (end == std::string::npos) ? path.size() : end;
+    std::string component = path.substr(begin, end - begin);
+    if (component == "..")
+    {
+      if (!components.empty())
+      {
+        components.pop_back();
+      }
+    }
+    else if (!component.empty() && component != ".")
+    {
+      components.push_back(component);
+    }
+    begin = end + 1;
+  }
+  std::string normalized;
+  for (const std::string &component : components)
+  {
+    normalized += "/" + component;
+  }
+  return normalized.empty() ? "/" : normalized;
+}
+
+// chdir for a path of any length: one longer than PATH_MAX is changed to in parts, and back on failure
+int _chdir_long(const std::string &path)
+{
+  if (path.size() < PATH_MAX)
+  {
+    return chdir(path.c_str());
+  }
+  int saved = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (saved == -1)
+  {
+    return -1;
+  }
+  int res = (path[0] == '/') ? chdir("/") : 0;
+  size_t begin = 0;
+  while (res == 0 && begin < path.size())
+  {
+    // the longest part that ends at a slash (a component is never longer than NAME_MAX)
+    size_t end = path.size();
+    if (end - begin >= PATH_MAX)
+    {
+      end = path.rfind('/', begin + PATH_MAX - 1);
+      end = (end == std::string::npos || end <= begin) ? begin + PATH_MAX - 1 : end;
+    }
+    std::string part = path.substr(begin, end - begin);
+    res = part.empty() ? 0 : chdir(part.c_str());
+    begin = end + 1;
+  }
+  if (res == -1)
+  {
+    int error = errno;
+    if (fchdir(saved) == -1)
+    {
+      perror("smash error: fchdir failed");
+    }
+    errno = error;
+  }
+  close(saved);
+  return res;
+}
+
+// where smash starts: $PWD when it is the directory smash is in (it keeps the symbolic links), else getcwd
+std::string _start_cwd()
+{
+  const char *pwd = getenv("PWD");
+  struct stat logical, physical;
+  if (pwd != nullptr && pwd[0] == '/' && stat(pwd, &logical) == 0 && stat(".", &physical) == 0 &&
+      logical.st_dev == physical.st_dev && logical.st_ino == physical.st_ino && _normalize_path(pwd) == pwd)
+  {
+    return pwd;
+  }
+  char *cwd = getcwd(nullptr, 0); // allocated, without a limit on the length
+  std::string result = (cwd != nullptr) ? cwd : "";
+  free(cwd);
+  return result;
+}
+
+// the directory of memo ($SMASH_MEMO_DIR or ~/.smash_memo) and its bound ($SMASH_MEMO_MAX), false without a directory
+bool _memo_settings(const Environment &environment, std::string &directory, unsigned long long &max_bytes)
+{
+  if (!environment.get("SMASH_MEMO_DIR", directory) && environment.get("HOME", directory))
+  {
+    directory += "/.smash_memo";
+  }
+  max_bytes = MemoCache::DEFAULT_MAX_BYTES;
+  std::string text;
+  if (environment.get("SMASH_MEMO_MAX", text) && !text.empty() && isdigit((unsigned char)text[0]))
+  {
+    char *end = nullptr;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    std::string suffix(end);
+    int shift = suffix.empty() ? 0 : (suffix == "K" ? 10 : (suffix == "M" ? 20 : (suffix == "G" ? 30 : -1)));
+    if (shift != -1 && value > 0)
+    {
+      max_bytes = value << shift;
+    }
+  }
+  return !directory.empty();
+}
+
+// points the frecency database of z at $SMASH_Z_DATA or ~/.smash_z, false when there is neither
+bool _open_z_data(const Environment &environment)
+{
+  std::string data;
+  if (!environment.get("SMASH_Z_DATA", data) && environment.get("HOME", data))
+  {
+    data += "/.smash_z";
+  }
+  if (data.empty())
+  {
+    return false;
+  }
+  Frecency::getInstance().setPath(data);
+  return true;
+}
+
+// gives the terminal to a process group, smash is not in the foreground while a job is and SIGTTOU would stop it
+bool _set_terminal_pgrp(int fd, pid_t pgid)
+{
+  sigset_t ttou;
+  sigset_t old_mask;
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &ttou, &old_mask);
+  int res = tcsetpgrp(fd, pgid);
+  sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+  return res == 0;
+}
+
+// write() without SIGPIPE: a reader that exited gives EPIPE, the signal it raised is taken back
+ssize_t _write_no_sigpipe(int fd, const char *data, size_t size)
+{
+  sigset_t pipe_signal;
+  sigset_t old_mask;
+  sigset_t pending;
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_signal, &old_mask);
+  sigpending(&pending);
+  bool was_pending = sigismember(&pending, SIGPIPE);
+  ssize_t res = write(fd, data, size);
+  int error = errno;
+  if (res == -1 && error == EPIPE && !was_pending)
+  {
+    struct timespec zero = {0, 0};
+    sigtimedwait(&pipe_signal, nullptr, &zero);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  errno = error;
+  return res;
+}
+
+// a signal by its number or its name, with or without SIG and in any case (`9`, `KILL`, `sigkill`)
+bool _parse_signal(const std::string &text, int *sig)
+{
+  static const struct
+  {
+    const char *name;
+    int number;
+  } SIGNALS[] = {{"HUP", SIGHUP},     {"INT", SIGINT},       {"QUIT", SIGQUIT}, {"ILL", SIGILL},   {"TRAP", SIGTRAP},
+                 {"ABRT", SIGABRT},   {"BUS", SIGBUS},       {"FPE", SIGFPE},   {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+                 {"SEGV", SIGSEGV},   {"USR2", SIGUSR2},     {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+                 {"CHLD", SIGCHLD},   {"CONT", SIGCONT},     {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+                 {"TTOU", SIGTTOU},   {"URG", SIGURG},       {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}, {"PROF", SIGPROF},
+                 {"VTALRM", SIGVTALRM}, {"WINCH", SIGWINCH}, {"IO", SIGIO},     {"PWR", SIGPWR},   {"SYS", SIGSYS}};
+  if (!text.empty() && text.size() < 10 && text.find_first_not_of("0123456789") == std::string::npos)
+  {
+    *sig = atoi(text.c_str());
+    return true;
+  }
+  std::string name;
+  for (char c : text)
+  {
+    name += toupper((unsigned char)c);
+  }
+  if (name.compare(0, 3, "SIG") == 0)
+  {
+    name.erase(0, 3);
+  }
+  for (const auto &signal : SIGNALS)
+  {
+    if (name == signal.name)
+    {
+      *sig = signal.number;
+      return true;
+    }
+  }
+  return false;
+}
+
+// a job id, `3` or `%3`
+bool _parse_job_id(const std::string &text, int *id)
+{
+  size_t begin = (!text.empty() && text[0] == '%') ? 1 : 0;
+  if (begin == text.size() || text.size() - begin > 9 ||
+      text.find_first_not_of("0123456789", begin) != std::string::npos)
+  {
+    return false;
+  }
+  *id = atoi(text.c_str() + begin);
+  return true;
+}
+
+// a range of job ids with both ends in it, `%5-%40` or `5-40`
+bool _parse_job_range(const std::string &text, int *first, int *last)
+{
+  size_t dash = text.find('-', 1);
+  return dash != std::string::npos && _parse_job_id(text.substr(0, dash), first) &&
+         _parse_job_id(text.substr(dash + 1), last) && *first <= *last;
 }
 
 // TODO: Add your implementation for classes in Commands.h
@@ -99,7 +587,8 @@ void _removeBackgroundSign(char *cmd_line)
 
 Command::Command(const char *cmd_line)
     : m_ground_type((_isBackgroundCommand(cmd_line)) ? (GroundType::Background) : (GroundType::Foreground)),
-      m_cmd_line(cmd_line) // (m_ground_type == GroundType::Background) ? _trim(m_remove_background_sign(cmd_line)) : _trim(cmd_line)
+      m_cmd_line(cmd_line), // (m_ground_type == GroundType::Background) ? _trim(m_remove_background_sign(cmd_line)) : _trim(cmd_line)
+      m_exit_status(0)
 
 {
 }
@@ -134,7 +623,7 @@ std::string Command::m_remove_background_sign(const char *cmd_line) const
 
 ExternalCommand::Complexity ExternalCommand::_get_complexity_type(const char *cmd_line)
 {
-  if (std::string(cmd_line).find_first_of("*?") != std::string::npos)
+  if (LineScan::of(cmd_line).has(LineScan::GLOB))
   {
     return Complexity::Complex;
   }
@@ -144,11 +633,14 @@ ExternalCommand::Complexity ExternalCommand::_get_complexity_type(const char *cm
   }
 }
 
+rlim_t ExternalCommand::s_files_limit = RLIM_INFINITY;
+
 ExternalCommand::ExternalCommand(const char *cmd_line)
     : Command(cmd_line),
       m_complexity(_get_complexity_type(cmd_line))
 {
   // cant really do any checks for if a command is external or not
+  m_argv = _build_argv();
 }
 
 ExternalCommand::~ExternalCommand()
@@ -158,8 +650,27 @@ ExternalCommand::~ExternalCommand()
 
 void ExternalCommand::execute()
 {
-
-  pid_t pid = fork();
+  // only the smash itself hands out process groups, a pipeline stage keeps its group for its sons
+  bool new_group = SmallShell::getInstance().ownsProcessGroups();
+  std::cout.flush(); // the son must not inherit our pending output
+
+  // the zygote spawns for the smash itself, a son of smash (a pipeline stage) forks its own sons
+  const int standard_fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  pid_t pid = -1;
+  if (new_group && Zygote::getInstance().isRunning())
+  {
+    Tracer::Span span("spawn", "process", getCMDLine());
+    pid = spawn(standard_fds, 0);
+  }
+  if (pid == -1)
+  {
+    long long start_ns = Tracer::enabled() ? Tracer::now() : 0;
+    pid = fork();
+    if (pid > 0 && start_ns != 0) // the son records its side as the exec
+    {
+      Tracer::record("fork", "process", start_ns, Tracer::now(), getCMDLine().c_str());
+    }
+  }
 
   if (pid == -1)
   {
@@ -169,66 +680,113 @@ void ExternalCommand::execute()
 
   if (pid == 0) // * son
   {
-    if (setpgrp() == -1) // failure
+    if (new_group && setpgrp() == -1) // failure
     {
       perror("smash error: setpgrp failed");
-      return;
+      _exit(1);
     }
-
-    if (m_complexity == Complexity::Complex)
+    exec();
+  }
+  else // * parent
+  {
+    m_pid = pid;
+    if (new_group)
     {
-      // trim the cmd_line and remove back ground sign (also then trim)
-      const char *command_line = _trim(Command::m_remove_background_sign(getCMDLine().c_str())).c_str();
-
-      if (execlp("/bin/bash", "/bin/bash", "-c", command_line, nullptr) != 0) // failure
-      {
-        perror("smash error: execlp failed");
-        return;
-      }
+      // done by both sides like the stages of a pipe, the group must exist before the terminal is given to it
+      setpgid(m_pid, m_pid);
+    }
+    if (isBackground())
+    {
+      SmallShell::getInstance().getJobsList().addJob(this, m_pid);
     }
     else
     {
+      std::vector<int> statuses;
+      SmallShell::getInstance().waitForeground(getCMDLine(), m_pid, std::vector<pid_t>(1, m_pid), statuses);
+      setExitStatus(statuses.front());
+    }
+  }
+}
 
-      char *args[COMMAND_MAX_ARGS + 1] = {0};
-      char trimmed_cmd_line[COMMAND_MAX_LENGTH + 1];
-
-      strcpy(trimmed_cmd_line, getCMDLine().c_str());
+void ExternalCommand::exec()
+{
+  long long start_ns = Tracer::enabled() ? Tracer::now() : 0;
+  // execvp and execlp search the PATH of environ and pass it on, so it has to be the shell's block
+  std::vector<char *> envp;
+  Environment &environment = SmallShell::getInstance().getEnvironment();
+  if (getEnvOverrides().empty())
+  {
+    environ = environment.envp();
+  }
+  else
+  {
+    envp = environment.envp(getEnvOverrides());
+    environ = envp.data();
+  }
 
-      _removeBackgroundSign(trimmed_cmd_line);
+  std::vector<std::string> argv = getArgv();
+  std::vector<char *> args;
+  for (std::string &arg : argv)
+  {
+    args.push_back(&arg[0]);
+  }
+  args.push_back(nullptr);
+  struct rlimit files_limit;
+  if (s_files_limit != RLIM_INFINITY && getrlimit(RLIMIT_NOFILE, &files_limit) == 0)
+  {
+    files_limit.rlim_cur = s_files_limit;
+    setrlimit(RLIMIT_NOFILE, &files_limit);
+  }
 
-      _parseCommandLine(_trim(std::string(trimmed_cmd_line)).c_str(), args);
+  // the son is gone with the exec, what it recorded is written before
+  if (start_ns != 0)
+  {
+    Tracer::record("exec", "process", start_ns, Tracer::now(), args[0]);
+    Tracer::flushThread();
+  }
+  if (execvp(args[0], args.data()) == -1)
+  {
+    perror(m_complexity == Complexity::Complex ? "smash error: execlp failed" : "smash error: execvp failed");
+  }
+  _exit(127); // command not found, _exit so the stdin offset we share with smash is left alone
+}
 
-      if (execvp(args[0], args) == -1)
-      {
-        perror("smash error: execvp failed");
-      }
-      for (int i = 0; i <= COMMAND_MAX_ARGS; i++)
-      {
-        if (args[i] != nullptr)
-        {
-          free(args[i]);
-        }
-      }
-      exit(0);
-    }
+std::vector<std::string> ExternalCommand::_build_argv() const
+{
+  // trim the cmd_line and remove back ground sign (also then trim)
+  std::string command_line = _trim(Command::m_remove_background_sign(getCMDLine().c_str()));
+  std::vector<std::string> argv;
+  if (m_complexity == Complexity::Complex)
+  {
+    argv.push_back("/bin/bash");
+    argv.push_back("-c");
+    argv.push_back(_unmark_literal(command_line));
+    return argv;
   }
-  else // * parent
+
+  char *args[COMMAND_MAX_ARGS + 1] = {0};
+  _parseCommandLine(command_line.c_str(), args);
+  for (int i = 0; i <= COMMAND_MAX_ARGS; i++)
   {
-    m_pid = pid;
-    if (isBackground())
-    {
-      SmallShell::getInstance().getJobsList().addJob(this, m_pid);
-    }
-    else
+    if (args[i] != nullptr)
     {
-      SmallShell::getInstance().setCurrForegroundPID(m_pid);
-      if (waitpid(m_pid, nullptr, WUNTRACED) == -1)
-      {
-        perror("smash error: waitpid failed");
-      }
-      SmallShell::getInstance().setCurrForegroundPID(-1);
+      argv.push_back(_unmark_literal(args[i]));
+      free(args[i]);
     }
   }
+  return argv;
+}
+
+pid_t ExternalCommand::spawn(const int fds[3], pid_t pgid)
+{
+  std::vector<char *> envp;
+  char **block = SmallShell::getInstance().getEnvironment().envp();
+  if (!getEnvOverrides().empty())
+  {
+    envp = SmallShell::getInstance().getEnvironment().envp(getEnvOverrides());
+    block = envp.data();
+  }
+  return Zygote::getInstance().spawn(getArgv(), block, fds, pgid, s_files_limit);
 }
 
 /*
@@ -241,18 +799,8 @@ bool _is_redirection_command(const char *cmd_line)
 {
   if (cmd_line)
   {
-    std::string s(cmd_line);
     // if no > were found, return false
-    int index_first = s.find_first_of(">");
-    // std::cout << "index is " << index_first << "\n";
-    if (index_first == -1)
-    {
-      return false;
-    }
-    else
-    {
-      return true;
-    }
+    return LineScan::of(cmd_line).has(LineScan::REDIRECT);
   }
   return false;
 }
@@ -260,9 +808,8 @@ bool _is_redirection_command(const char *cmd_line)
 RedirectionCommand::RedirectionType RedirectionCommand::get_redirection_type(const char *cmd_line)
 {
   // assumes there is atleast ">" or ">>"
-  std::string s(cmd_line);
-  unsigned int first_symbol_index = s.find_first_of(">");
-  if (s[first_symbol_index + 1] == '>')
+  size_t first_symbol_index = LineScan::of(cmd_line).first(LineScan::REDIRECT);
+  if (cmd_line[first_symbol_index + 1] == '>')
   {
     return RedirectionType::Append;
   }
@@ -284,18 +831,25 @@ RedirectionCommand::RedirectionCommand(const char *cmd_line)
   m_redirection_type = get_redirection_type(cmd_line);
 
   std::string cmd_str(cmd_line);
-  m_command = _trim(cmd_str.substr(0, cmd_str.find_first_of(">")).c_str());
+  const LineScan &scan = LineScan::of(cmd_line);
+  m_command = _trim(cmd_str.substr(0, scan.first(LineScan::REDIRECT)).c_str());
 
-  m_file_path = _trim(cmd_str.substr(cmd_str.find_last_of(">") + 1));
+  m_file_path = _unmark_literal(_trim(cmd_str.substr(scan.last(LineScan::REDIRECT) + 1)));
 }
 
 RedirectionCommand::~RedirectionCommand()
 {
 }
 
+bool RedirectionCommand::isExternal() const
+{
+  return _is_external_line(m_command);
+}
+
 void RedirectionCommand::execute()
 {
   SmallShell &smash = SmallShell::getInstance();
+  Tracer::Span span("redirect", "redirect", m_file_path);
   int new_fd;
   int dupped_fd = dup(1);
   if (dupped_fd == -1)
@@ -314,6 +868,7 @@ void RedirectionCommand::execute()
     if (new_fd == -1)
     {
       perror("smash error: open failed"); ////////////
+      setExitStatus(1);
       if (dup2(dupped_fd, 1) == -1)
       {
         perror("smash error: dup2 failed");
@@ -333,6 +888,7 @@ void RedirectionCommand::execute()
     if (new_fd == -1)
     {
       perror("smash error: open failed");
+      setExitStatus(1);
       if (dup2(dupped_fd, 1) == -1)
       {
         perror("smash error: dup2 failed");
@@ -347,7 +903,11 @@ void RedirectionCommand::execute()
     }
   }
 
-  smash.executeCommand(m_command.c_str());
+  span.end();
+  smash.executeCommand(m_command.c_str(), true);
+  setExitStatus(smash.getLastStatus());
+  std::cout.flush(); // everything the command printed belongs to the file
+  Tracer::Span restore("restore redirect", "redirect", m_file_path);
 
   if (close(new_fd) == -1)
   {
@@ -370,22 +930,18 @@ void RedirectionCommand::execute()
 
 bool _is_pipe_command(const char *cmd_line)
 {
-  if (std::string(cmd_line).find_first_of("|") != std::string::npos)
-  {
-    return true;
-  }
-  return false;
+  return LineScan::of(cmd_line).has(LineScan::PIPE);
 }
 
 PipeCommand::PipeType PipeCommand::_get_pipe_type(const char *cmd_line)
 {
   std::string s(cmd_line);
-  int index_of_line = s.find_first_of("|");
-  int index_of_amp = s.find_first_of("&");
+  size_t index_of_line = LineScan::of(cmd_line).first(LineScan::PIPE);
 
-  if (index_of_line != -1)
+  if (index_of_line != std::string::npos)
   {
-    if (index_of_amp == -1)
+    // only a `&` right after the `|` makes it `|&`, a `&` elsewhere is the background sign
+    if (s[index_of_line + 1] != '&')
     {
       return PipeType::Standard;
     }
@@ -403,32 +959,34 @@ PipeCommand::PipeType PipeCommand::_get_pipe_type(const char *cmd_line)
 std::string PipeCommand::_get_cmd_1(const char *cmd_line)
 {
   std::string s(cmd_line);
-  return s.substr(0, s.find_first_of("|"));
+  return s.substr(0, LineScan::of(cmd_line).first(LineScan::PIPE));
 }
 
 std::string PipeCommand::_get_cmd_2(const char *cmd_line)
 {
 
   std::string s(cmd_line);
-  int index_of_line = s.find_first_of("|");
-  int index_of_amp = s.find_first_of("&");
+  size_t index_of_line = LineScan::of(cmd_line).first(LineScan::PIPE);
 
-  if (index_of_amp != -1)
+  if (_get_pipe_type(cmd_line) == PipeType::Error)
   {
-    return s.substr(index_of_amp + 1, s.size() - index_of_amp);
+    return s.substr(index_of_line + 2);
   }
-  std::string cmd2 = s.substr(index_of_line + 1, s.size() - index_of_line);
-  return cmd2;
+  return s.substr(index_of_line + 1);
 }
 
 PipeCommand::PipeCommand(const char *cmd_line)
-    : Command(cmd_line)
+    : Command(cmd_line),
+      m_report_fd(-1)
 {
   if (_is_pipe_command(cmd_line))
   {
-    m_pipe_type = _get_pipe_type(cmd_line);
-    m_cmd_1 = _trim(_get_cmd_1(cmd_line));
-    m_cmd_2 = _trim(_get_cmd_2(cmd_line));
+    // the background sign belongs to the whole pipeline and not to its last stage
+    std::string pipeline = _trim(m_remove_background_sign(cmd_line));
+    LineScan::Scope scope(pipeline.c_str());
+    m_pipe_type = _get_pipe_type(pipeline.c_str());
+    m_cmd_1 = _trim(_get_cmd_1(pipeline.c_str()));
+    m_cmd_2 = _trim(_get_cmd_2(pipeline.c_str()));
     if (m_cmd_1 == "" || m_cmd_2 == "")
     {
       throw std::logic_error("PipeCommand::PipeCommand");
@@ -444,7 +1002,70 @@ PipeCommand::~PipeCommand()
 {
 }
 
-void PipeCommand::execute()
+bool PipeCommand::isExternal() const
+{
+  return _is_external_line(m_cmd_1) && _is_external_line(m_cmd_2);
+}
+
+bool _is_fork_free_builtin(const std::string &cmd_line)
+{
+  // only builtins that do not touch the shell state may run inside smash itself,
+  // every other stage keeps the old fork semantics (`cd x | cat` must not change our cwd)
+  if (_is_redirection_command(cmd_line.c_str()) || _is_pipe_command(cmd_line.c_str()))
+  {
+    return false;
+  }
+  std::istringstream iss(cmd_line);
+  std::string name;
+  if (!(iss >> name))
+  {
+    return false;
+  }
+  _removeBackgroundSign(&name[0]);
+  name = name.c_str();
+  return name == "showpid" || name == "pwd" || name == "jobs" || name == "dirs";
+}
+
+/* *
+ * writes the captured output of a builtin stage to the pipe and closes it.
+ * runs on a helper thread so a large output can not deadlock smash against the reader,
+ * all signals are blocked here so a reader that exits early gives us EPIPE and not SIGPIPE
+ */
+void _drain_to_pipe(int fd, std::string data)
+{
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+  Tracer::Span span("pipe write", "pipe");
+
+  size_t written = 0;
+  while (written < data.size())
+  {
+    ssize_t res = write(fd, data.data() + written, data.size() - written);
+    if (res == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break; // EPIPE: nobody is reading anymore
+    }
+    written += res;
+  }
+  close(fd);
+  span.end();
+}
+
+BuiltInCommand *PipeCommand::_create_fork_free_stage(const std::string &cmd_line)
+{
+  if (!_is_fork_free_builtin(cmd_line))
+  {
+    return nullptr;
+  }
+  return dynamic_cast<BuiltInCommand *>(SmallShell::getInstance().CreateCommand(cmd_line.c_str(), true));
+}
+
+pid_t PipeCommand::_fork_stage(const std::string &cmd_line, int files[2], bool is_writer, pid_t pgid, int *report)
 {
   enum PIPE
   {
@@ -452,157 +1073,328 @@ void PipeCommand::execute()
     WRITE = 1
   };
 
-  int files[2];
-  if (pipe(files) == -1)
+  SmallShell &smash = SmallShell::getInstance();
+  bool new_group = smash.ownsProcessGroups();
+
+  // the zygote spawns an external stage with the pipe as its stdin or stdout, so the command is created here.
+  // not for the writer of |&, the errors of creating its command belong in the pipe
+  Command *cmd = nullptr;
+  bool created = false;
+  if (new_group && Zygote::getInstance().isRunning() && (!is_writer || m_pipe_type == PipeType::Standard))
   {
-    perror("smash error: pipe failed");
-    return;
+    cmd = smash.CreateCommand(cmd_line.c_str(), true);
+    created = true;
+    ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+    if (external)
+    {
+      int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+      if (is_writer)
+      {
+        fds[STDOUT_FILENO] = files[WRITE];
+      }
+      else
+      {
+        fds[STDIN_FILENO] = files[READ];
+      }
+      Tracer::Span span("spawn", "process", cmd_line);
+      pid_t pid = external->spawn(fds, pgid);
+      span.end();
+      if (pid != -1)
+      {
+        delete cmd;
+        return pid;
+      }
+    }
   }
 
-  SmallShell &smash = SmallShell::getInstance();
-
-  // Fork and execute the first command
-  pid_t pid1 = fork();
-  if (pid1 == -1)
+  std::cout.flush();
+  Tracer::Span span("fork", "process", cmd_line);
+  pid_t pid = fork();
+  if (pid != 0) // parent or failure
   {
-    perror("smash error: fork failed");
-    if (close(files[READ]) == -1)
+    span.end();
+    delete cmd;
+    if (pid == -1)
     {
-      perror("smash error: close failed");
-      return;
+      perror("smash error: fork failed");
     }
-    if (close(files[WRITE]) == -1)
+    else if (new_group)
     {
-      perror("smash error: close failed");
-      return;
+      // done by both sides so the group exists no matter who runs first, the son may have already exec'd
+      setpgid(pid, pgid ? pgid : pid);
     }
-    return;
+    return pid;
   }
 
-  if (pid1 == 0)
-  { // Child process for the first command
-    if (setpgrp() == -1)
+  // * son
+  if (new_group && setpgid(0, pgid) == -1)
+  {
+    perror("smash error: setpgid failed");
+    _exit(1);
+  }
+  if (is_writer)
+  {
+    int target = (m_pipe_type == PipeType::Standard) ? STDOUT_FILENO : STDERR_FILENO;
+    if (dup2(files[WRITE], target) == -1) // Redirect stdout (or stderr) to pipe's write end
     {
-      perror("smash error: setpgrp failed");
-      return;
+      perror("smash error: dup2 failed");
+      _exit(1);
     }
-    if (m_pipe_type == PipeType::Standard)
+  }
+  else
+  {
+    if (dup2(files[READ], STDIN_FILENO) == -1) // Redirect stdin to pipe's read end
     {
-      if (dup2(files[WRITE], STDOUT_FILENO) == -1) // Redirect stdout to pipe's write end
-      {
-        perror("smash error: dup2 failed");
-        return;
-      }
-    }
-    else
-    {                                              // PipeType::Error
-      if (dup2(files[WRITE], STDERR_FILENO) == -1) // Redirect stderr to pipe's write end
-      {
-        perror("smash error: dup2 failed");
-        return;
-      }
+      perror("smash error: dup2 failed");
+      _exit(1);
     }
-    if (close(files[READ]) == -1)
+  }
+  // close whatever is still open of the pipe after dup2, otherwise the reader never sees EOF
+  for (int i = READ; i <= WRITE; i++)
+  {
+    if (files[i] != -1 && close(files[i]) == -1)
     {
       perror("smash error: close failed");
-      return;
+      _exit(1);
     }
-    if (close(files[WRITE]) == -1) // Close after dup2
+  }
+
+  // the tail of a longer pipeline runs nested here and writes its stage statuses back for PIPESTATUS
+  if (report)
+  {
+    close(report[READ]);
+    cmd = created ? cmd : smash.CreateCommand(cmd_line.c_str(), true);
+    created = true;
+    PipeCommand *tail = dynamic_cast<PipeCommand *>(cmd);
+    if (tail)
     {
-      perror("smash error: close failed");
-      return;
+      tail->m_report_fd = report[WRITE];
     }
-    smash.executeCommand(m_cmd_1.c_str());
-    exit(0);
   }
-  else
+  // an external stage replaces this son directly so the whole stage is one process of the group
+  if (created)
+  {
+    smash.runInSon(cmd);
+  }
+  smash.runInSon(cmd_line, true);
+}
+
+void PipeCommand::execute()
+{
+  enum PIPE
+  {
+    READ = 0,
+    WRITE = 1
+  };
+
+  int files[2];
+  if (pipe(files) == -1)
+  {
+    perror("smash error: pipe failed");
+    return;
+  }
+
+  // builtins without side effects run inside smash, only the external stages are forked.
+  // a background pipeline can not run anything inside smash, all of its stages are forked
+  BuiltInCommand *stage_1 = isBackground() ? nullptr : _create_fork_free_stage(m_cmd_1);
+  BuiltInCommand *stage_2 = isBackground() ? nullptr : _create_fork_free_stage(m_cmd_2);
+  pid_t pid1 = -1;
+  pid_t pid2 = -1;
+  pid_t pgid = 0; // the first forked stage leads the process group of the pipeline
+  int status_1 = 1; // a stage that could not be started failed
+  int status_2 = 1;
+
+  if (!stage_1)
   {
+    pid1 = _fork_stage(m_cmd_1, files, true, pgid);
+    if (pid1 == -1)
+    {
+      close(files[READ]);
+      close(files[WRITE]);
+      delete stage_2;
+      return;
+    }
+    pgid = pid1;
     if (close(files[WRITE]) == -1) // Close write end in parent after forking the first child
     {
       perror("smash error: close failed");
-      return;
     }
+    files[WRITE] = -1;
   }
 
-  // Fork and execute the second command
-  pid_t pid2 = fork();
-  if (pid2 == -1)
+  // the statuses of a nested tail arrive on their own pipe, a background pipeline does not keep them
+  int report[2] = {-1, -1};
+  if (!stage_2 && !isBackground() && _is_pipe_command(m_cmd_2.c_str()) &&
+      pipe2(report, O_CLOEXEC | O_NONBLOCK) == -1)
   {
-    perror("smash error: fork failed");
-    if (close(files[READ]) == -1) // Ensure read end is also closed on this error path
+    perror("smash error: pipe failed");
+  }
+  if (!stage_2)
+  {
+    pid2 = _fork_stage(m_cmd_2, files, false, pgid, report[READ] != -1 ? report : nullptr);
+    if (pgid == 0 && pid2 != -1)
     {
-      perror("smash error: close failed");
-      return;
+      pgid = pid2;
     }
+  }
+  if (report[WRITE] != -1)
+  {
+    close(report[WRITE]);
+  }
+  // the parent never reads from the pipe, a builtin second stage ignores its input
+  if (close(files[READ]) == -1)
+  {
+    perror("smash error: close failed");
+  }
+  files[READ] = -1;
+
+  if (isBackground())
+  {
+    std::vector<pid_t> members;
+    members.push_back(pid1);
+    if (pid2 != -1)
+    {
+      members.push_back(pid2);
+    }
+    SmallShell::getInstance().getJobsList().addJob(this, pgid, members);
+    size_t stages = 2;
+    for (std::string tail = m_cmd_2; _is_pipe_command(tail.c_str()); tail = _get_cmd_2(tail.c_str()))
+    {
+      stages++;
+    }
+    m_stage_statuses.assign(stages, 0);
     return;
   }
 
-  if (pid2 == 0)
-  { // Child process for the second command
-    if (setpgrp() == -1)
+  std::thread writer;
+  if (stage_1)
+  {
+    std::ostringstream captured;
+    std::ostream &stream = (m_pipe_type == PipeType::Standard) ? std::cout : std::cerr;
+    std::streambuf *original = stream.rdbuf(captured.rdbuf());
+    try
     {
-      perror("smash error: setpgrp failed");
-      return;
+      stage_1->execute();
     }
-    if(dup2(files[READ], STDIN_FILENO) == -1) // Redirect stdin to pipe's read end
+    catch (const std::exception &e)
     {
-      perror("smash error: dup2 failed");
-      return;
+      stage_1->setExitStatus(1);
     }
-    if(close(files[READ]) == -1)              // Close after dup2
+    stream.rdbuf(original);
+    status_1 = stage_1->getExitStatus();
+    delete stage_1;
+
+    if (pid2 != -1)
     {
-      perror("smash error: close failed");
-      return;
+      writer = std::thread(_drain_to_pipe, files[WRITE], captured.str());
     }
-    smash.executeCommand(m_cmd_2.c_str());
-    exit(0);
+    else
+    {
+      close(files[WRITE]);
+    }
+    files[WRITE] = -1;
   }
-  else
+
+  if (stage_2)
   {
-    if(close(files[READ])) // Close read end in parent after forking the second child
+    try
     {
-      perror("smash error: close failed");
-      return;
+      stage_2->execute();
+    }
+    catch (const std::exception &e)
+    {
+      stage_2->setExitStatus(1);
     }
+    status_2 = stage_2->getExitStatus();
+    delete stage_2;
   }
 
-  // Wait for both child processes to complete
-  if (waitpid(pid1, nullptr, WUNTRACED) == -1)
+  // Wait for the forked stages to complete, the whole group is in the foreground until then
+  std::vector<pid_t> members;
+  if (pid1 != -1)
+  {
+    members.push_back(pid1);
+  }
+  if (pid2 != -1)
+  {
+    members.push_back(pid2);
+  }
+  bool stopped = false;
+  if (!members.empty())
+  {
+    std::vector<int> statuses;
+    stopped = !SmallShell::getInstance().waitForeground(getCMDLine(), pgid, members, statuses);
+    status_1 = (pid1 != -1) ? statuses.front() : status_1;
+    status_2 = (pid2 != -1) ? statuses.back() : status_2;
+  }
+  if (writer.joinable() && stopped)
   {
-    perror("smash error: waitpid failed");
+    writer.detach(); // it has its own copy of the output and ends once the stopped reader goes on (or dies)
+  }
+  else if (writer.joinable())
+  {
+    Tracer::Span span("join writer", "wait");
+    writer.join();
   }
 
-  if (waitpid(pid2, nullptr, WUNTRACED) == -1)
+  m_stage_statuses.clear();
+  m_stage_statuses.push_back(status_1);
+  // a nested tail that finished wrote one status per stage, otherwise its exit status stands for all of them
+  int tail_statuses[64];
+  ssize_t length = (report[READ] != -1 && !stopped) ? read(report[READ], tail_statuses, sizeof(tail_statuses)) : -1;
+  if (length >= (ssize_t)sizeof(int))
+  {
+    m_stage_statuses.insert(m_stage_statuses.end(), tail_statuses, tail_statuses + length / sizeof(int));
+  }
+  else
+  {
+    m_stage_statuses.push_back(status_2);
+  }
+  if (report[READ] != -1)
+  {
+    close(report[READ]);
+  }
+  if (m_report_fd != -1 &&
+      write(m_report_fd, m_stage_statuses.data(), m_stage_statuses.size() * sizeof(int)) == -1)
+  {
+    perror("smash error: write failed");
+  }
+  // with pipefail the pipeline fails as a whole if any stage failed (the rightmost failure wins)
+  int status = status_2;
+  for (size_t i = m_stage_statuses.size(); SmallShell::getInstance().isPipefail() && status == 0 && i > 0; i--)
   {
-    perror("smash error: waitpid failed");
+    status = m_stage_statuses[i - 1];
   }
+  setExitStatus(status);
 }
 
 // * Special Commands 3 (ChmodCommand) , actually inherits from BuiltInCommand
 
 ChmodCommand::ChmodCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_recursive(false),
+      m_mode(),
+      m_paths()
 {
   if (getName() != "chmod")
   {
     throw std::logic_error("wrong name");
   }
 
-  if (getArgs().size() != 2)
+  std::vector<std::string> args = getArgs();
+  if (!args.empty() && args.front() == "-R")
   {
-    std::cerr << "smash error: chmod: invalid arguments\n";
-    throw std::logic_error("ChmodCommand::ChmodCommand");
+    m_recursive = true;
+    args.erase(args.begin());
   }
-
-  std::string modes = getArgs().front();
-  std::string file_path = getArgs().back();
-
-  // if the string is NOT from 3 octal digits
-  if ((modes.size() != 3) || (modes.find_first_not_of("01234567") != std::string::npos))
+  ModeSpec spec;
+  if (args.size() < 2 || !spec.parse(args.front()))
   {
     std::cerr << "smash error: chmod: invalid arguments\n";
     throw std::logic_error("ChmodCommand::ChmodCommand");
   }
+  m_mode = args.front();
+  m_paths.assign(args.begin() + 1, args.end());
 }
 
 ChmodCommand::~ChmodCommand()
@@ -612,13 +1404,161 @@ ChmodCommand::~ChmodCommand()
 
 void ChmodCommand::execute()
 {
-  mode_t mode = static_cast<mode_t>(std::stoi(getArgs().front(), nullptr, 8)); // shouldn't throw
+  ModeSpec spec;
+  spec.parse(m_mode); // checked by the ctor
 
-  if (chmod(getArgs().back().c_str(), mode) == -1) // getArgs().back() is the file path
+  if (!m_recursive)
   {
-    perror("smash error: chmod failed");
+    for (const std::string &path : m_paths)
+    {
+      struct stat status;
+      status.st_mode = 0; // an octal mode needs no stat, unless a directory keeps its set-id bits
+      if ((!spec.isAbsolute(true) && stat(path.c_str(), &status) == -1) ||
+          chmod(path.c_str(), spec.apply(status.st_mode, S_ISDIR(status.st_mode))) == -1)
+      {
+        perror("smash error: chmod failed");
+        setExitStatus(1);
+      }
+    }
     return;
   }
+
+  SmallShell &smash = SmallShell::getInstance();
+  smash.setInterrupted(false);
+  ChmodTree tree(spec, [&smash]() { return smash.wasInterrupted(); });
+  {
+    Tracer::Span span("chmod -R", "builtin");
+    tree.run(m_paths);
+  }
+  for (const std::string &error : tree.errors())
+  {
+    std::cerr << "smash error: chmod failed: " << error << "\n";
+  }
+  if (tree.failed() > tree.errors().size())
+  {
+    std::cerr << "smash error: chmod: " << tree.failed() - tree.errors().size() << " more failures\n";
+  }
+  if (tree.failed() > 0 || smash.wasInterrupted())
+  {
+    setExitStatus(1);
+  }
+}
+
+// * Special Commands 4 (ListCommand)
+
+ListCommand::ListCommand(const char *cmd_line)
+    : Command(cmd_line),
+      m_commands()
+{
+  // a line without ; & and | has no connector, most lines are not lists
+  const LineScan &scan = LineScan::of(cmd_line);
+  if (!scan.has(LineScan::SEMICOLON) && !scan.has(LineScan::AMPERSAND) && !scan.has(LineScan::PIPE))
+  {
+    throw std::logic_error("wrong name");
+  }
+  size_t text_end = scan.end();
+  std::string s(cmd_line);
+  std::string current;
+  bool has_connector = false;
+
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    char next = (i + 1 < s.size()) ? s[i + 1] : '\0';
+    std::string token;
+    Connector connector = Connector::Sequential;
+
+    if (s[i] == ';')
+    {
+      token = ";";
+    }
+    else if (s[i] == '&' && next == '&')
+    {
+      token = "&&";
+      connector = Connector::And;
+    }
+    else if (s[i] == '|' && next == '|')
+    {
+      token = "||";
+      connector = Connector::Or;
+    }
+    else if (s[i] == '|' && next == '&') // `|&` is a pipe and not a list
+    {
+      current += "|&";
+      i++;
+      continue;
+    }
+    else if (s[i] == '$' && next == '(') // `$(a; b)` is one word of the command
+    {
+      size_t end = _find_substitution_end(s, i);
+      end = (end == std::string::npos) ? s.size() - 1 : end;
+      current += s.substr(i, end - i + 1);
+      i = end;
+      continue;
+    }
+    else if (s[i] == '&' && i + 1 < text_end)
+    {
+      // `a & b` runs a in the background, the sign stays with its command
+      token = "&";
+      current += '&';
+    }
+    else
+    {
+      current += s[i];
+      continue;
+    }
+    i += token.size() - 1;
+
+    if (_trim(current) == "" || _trim(current) == "&")
+    {
+      std::cerr << "smash error: syntax error near unexpected token `" << token << "'\n";
+      throw std::logic_error("ListCommand::ListCommand");
+    }
+    has_connector = true;
+    m_commands.push_back(std::make_pair(_trim(current), connector));
+    current.clear();
+  }
+
+  if (!has_connector)
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (_trim(current) != "")
+  {
+    m_commands.push_back(std::make_pair(_trim(current), Connector::Sequential));
+  }
+  else if (m_commands.back().second != Connector::Sequential) // `a &&` is missing its second command
+  {
+    std::cerr << "smash error: syntax error: unexpected end of line\n";
+    throw std::logic_error("ListCommand::ListCommand");
+  }
+}
+
+ListCommand::~ListCommand()
+{
+}
+
+void ListCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  Connector previous = Connector::Sequential;
+
+  for (const std::pair<std::string, Connector> &command : m_commands)
+  {
+    // a skipped command keeps the status, so `false && a || b` runs b
+    bool run = (previous == Connector::Sequential) ||
+               (previous == Connector::And && smash.getLastStatus() == 0) ||
+               (previous == Connector::Or && smash.getLastStatus() != 0);
+    if (run)
+    {
+      smash.executeCommand(command.first.c_str());
+    }
+    if (smash.hasQuit()) // nothing runs after quit
+    {
+      break;
+    }
+    previous = command.second;
+  }
+  setExitStatus(smash.getLastStatus());
 }
 
 /*
@@ -627,9 +1567,14 @@ void ChmodCommand::execute()
 
 BuiltInCommand::BuiltInCommand(const char *cmd_line)
     : Command(cmd_line),
-      m_name(m_parse_name(cmd_line)),
-      m_args(m_parse_args(cmd_line))
+      m_name(_unmark_literal(m_parse_name(cmd_line))),
+      m_args(),
+      m_line_args(m_parse_args(cmd_line))
 {
+  for (const std::string &arg : m_line_args)
+  {
+    m_args.push_back(_unmark_literal(arg));
+  }
   setGround(GroundType::Foreground);
 }
 
@@ -734,24 +1679,28 @@ GetCurrDirCommand::~GetCurrDirCommand()
 
 void GetCurrDirCommand::execute()
 {
-  char path[COMMAND_MAX_PATH_LENGTH + 1];
-  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
-  if (getcwd(path, COMMAND_MAX_PATH_LENGTH + 1) != nullptr) // success
+  const std::string &cwd = SmallShell::getInstance().getCwd();
+  if (!cwd.empty())
+  {
+    std::cout << cwd << '\n';
+    return;
+  }
+  // smash does not know where it is (getcwd failed at its start), the kernel may
+  char *path = getcwd(nullptr, 0);
+  if (path != nullptr) // success
   {
     std::cout << std::string(path) << '\n';
+    free(path);
   }
   else
   {
-    // ? should we print an error
     perror("smash error: getcwd failed");
+    setExitStatus(1);
   }
 }
 
 // * BuiltInCommand 4 (ChangeDirCommand)
 
-/* static variables */
-std::string ChangeDirCommand::CD_PATH_HISTORY; // default c'tor will be called
-
 ChangeDirCommand::ChangeDirCommand(const char *cmd_line)
     : BuiltInCommand(cmd_line)
 {
@@ -774,87 +1723,36 @@ ChangeDirCommand::~ChangeDirCommand()
 
 void ChangeDirCommand::execute()
 {
-  // 0 arguments for cd will NOT be tested
-
-  // get the current working directory
-  char cwd[COMMAND_MAX_PATH_LENGTH + 1];
-  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
-  if (getcwd(cwd, COMMAND_MAX_PATH_LENGTH + 1) == nullptr) // failure
+  SmallShell &smash = SmallShell::getInstance();
+  std::string path;
+  if (getArgs().empty())
   {
-    perror("smash error: getcwd failed");
-    return;
+    if (!smash.getEnvironment().get("HOME", path) || path.empty())
+    {
+      std::cerr << "smash error: cd: HOME not set\n";
+      setExitStatus(1);
+      return;
+    }
   }
-  std::string curr_dir(cwd);
-
   // the ctor guarantees there will be 1 argument only
-  if ("-" == getArgs().front())
+  else if ("-" == getArgs().front())
   {
-    if (CD_PATH_HISTORY.size() == 0)
+    if (smash.getOldPwd().size() == 0)
     {
       std::cerr << "smash error: cd: OLDPWD not set\n";
       throw std::logic_error("ChangeDirCommand::ChangeDirCommand");
     }
-    else
-    {
-      // CD_PATH_HISTORY has paths in it
-      if (chdir(CD_PATH_HISTORY.c_str()) == -1) // failure
-      {
-        perror("smash error: chdir failed");
-        return;
-      }
-      else
-      {
-        CD_PATH_HISTORY = curr_dir;
-      }
-    }
-  }
-  else if (".." == getArgs().back())
-  {
-    // get the parent directory
-    std::string parent_dir = get_parent_directory(cwd);
-    // change dir to the parent
-    if (0 == chdir(parent_dir.c_str())) // success
-    {
-      CD_PATH_HISTORY = curr_dir;
-    }
-    else
-    {
-      perror("smash error: chdir failed");
-      return;
-    }
+    path = smash.getOldPwd();
   }
-  else // "normal path"
+  else
   {
-    // change dir to the path given
-    if (0 == chdir(getArgs().front().c_str())) // success
-    {
-      CD_PATH_HISTORY = curr_dir;
-    }
-    else
-    {
-      perror("smash error: chdir failed");
-      return;
-    }
+    path = getArgs().front();
   }
-}
 
-/* methods */
-std::string ChangeDirCommand::get_parent_directory(const std::string &path) const
-{
-  size_t lastSlashPos = path.find_last_of("/");
-
-  // If there's no slash, or only one at the beginning (root), return as is or some indication
-  if (lastSlashPos == std::string::npos || (lastSlashPos == 0 && path.length() == 1))
-  {
-    return path; // No parent directory, or it's the root
-  }
-  else if (lastSlashPos == 0)
+  if (!smash.changeDir(path))
   {
-    return "/"; // The parent directory is the root
-  }
-  else
-  {
-    return path.substr(0, lastSlashPos); // Return the substring up to the last slash
+    perror("smash error: chdir failed");
+    setExitStatus(1);
   }
 }
 
@@ -876,7 +1774,7 @@ JobsCommand::~JobsCommand()
 
 void JobsCommand::execute()
 {
-  // TODO: figure out what are they yapping about on " if the job was added again then the timer should reset. "
+  // a job gets its start time when it is added to the list, so a job that is added again starts over (see jobtop)
   // getJobsList() always return an updated JobsList
   SmallShell::getInstance().getJobsList().printJobsList();
 }
@@ -937,32 +1835,129 @@ void ForegroundCommand::execute()
 {
   JobsList &jobslist = SmallShell::getInstance().getJobsList();
   JobsList::JobEntry *job = jobslist.getJobById(m_id);
+  if (job && job->isQueued()) // the user wants it now, the admission control does not hold it back
+  {
+    jobslist.startQueuedJob(m_id);
+    job = jobslist.getJobById(m_id);
+  }
   if (!job)
   {
     jobslist.removeJobById(m_id);
     return;
   }
+  if (job->isAdopted()) // waitpid does not work on it and the terminal is not handed to it
+  {
+    std::cerr << "smash error: fg: job-id " << m_id << " was adopted, it can not run in the foreground\n";
+    setExitStatus(1);
+    return;
+  }
   pid_t pid = job->getJobPid();
-  SmallShell::getInstance().setCurrForegroundPID(pid);
-  std::cout << job->getCMDLine() << " " << pid << "\n";
-  // job->getCommand()->setGround(GroundType::Foreground);
+  std::string cmd_line = job->getCMDLine();
+  bool stopped = job->isStopped();
+  std::vector<pid_t> pids;
+  for (const JobsList::JobEntry::Member &member : job->getMembers())
+  {
+    pids.push_back(member.pid);
+  }
+  std::cout << cmd_line << " " << pid << "\n";
   jobslist.removeJobById(m_id);
-  if (waitpid(pid, nullptr, WUNTRACED) == -1) // options == 0 will wait for the process to finish
+  if (jobslist.getLogFd(m_id) != -1)
+  {
+    // its output goes to the log and not to the terminal, it can go on before the log is followed
+    if (stopped && killpg(pid, SIGCONT) == -1 && errno != ESRCH)
+    {
+      perror("smash error: kill failed");
+    }
+    stopped = false;
+    _follow_log(pids);
+  }
+  // a pipeline is in the foreground until all of its members are done, its status is the last one's
+  std::vector<int> statuses;
+  SmallShell::getInstance().waitForeground(cmd_line, pid, pids, statuses, m_id, stopped);
+  if (!statuses.empty())
+  {
+    setExitStatus(statuses.back());
+  }
+}
+
+void ForegroundCommand::_follow_log(const std::vector<pid_t> &members)
+{
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  unsigned long long offset = 0;
+  // the pipe and a pidfd for every member, the pidfds of the job were closed when it left the list
+  std::vector<struct pollfd> fds;
+  fds.push_back({jobslist.getLogFd(m_id), POLLIN, 0});
+  size_t running = 0;
+  for (pid_t member : members)
+  {
+    int pidfd = _pidfd_open(member);
+    if (pidfd != -1) // without one the waitpid after this waits for the member
+    {
+      fds.push_back({pidfd, POLLIN, 0});
+      running++;
+    }
+  }
+  while (true)
+  {
+    jobslist.drainLog(m_id);
+    const OutputRing *log = jobslist.getLog(m_id);
+    if (log == nullptr)
+    {
+      break;
+    }
+    std::cout << log->since(offset);
+    std::cout.flush();
+    offset = log->written();
+    fds[0].fd = jobslist.getLogFd(m_id); // -1 (ignored by poll) once every writer closed it
+    if (running == 0)
+    {
+      break; // what the sons of the job still write stays in the log
+    }
+    if (poll(fds.data(), fds.size(), -1) == -1)
+    {
+      continue; // ctrl-C, the handler killed the job and its pidfds say so next
+    }
+    for (size_t i = 1; i < fds.size(); i++)
+    {
+      if (fds[i].fd != -1 && fds[i].revents)
+      {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        running--;
+      }
+    }
+  }
+  for (size_t i = 1; i < fds.size(); i++)
   {
-    perror("smash error: waitpid failed");
+    if (fds[i].fd != -1)
+    {
+      close(fds[i].fd);
+    }
   }
-  SmallShell::getInstance().setCurrForegroundPID(-1);
 }
 
 // * BuiltInCommand 7 (QuitCommand)
 
 QuitCommand::QuitCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_grace_ms(0)
 {
   if (getName() != "quit")
   {
     throw std::logic_error("wrong name");
   }
+  const std::vector<std::string> &args = getArgs();
+  if (args.size() > 1 && args[0] == "kill" && args[1] == "--grace")
+  {
+    char *end = nullptr;
+    double seconds = (args.size() == 3) ? strtod(args[2].c_str(), &end) : -1;
+    if (args.size() != 3 || *end != '\0' || !(seconds >= 0 && seconds <= 86400))
+    {
+      std::cerr << "smash error: quit: invalid arguments\n";
+      throw std::logic_error("QuitCommand::QuitCommand");
+    }
+    m_grace_ms = (long long)(seconds * 1000);
+  }
 }
 
 QuitCommand::~QuitCommand()
@@ -977,60 +1972,68 @@ void QuitCommand::execute()
     if (getArgs().front() == "kill")
     {
       JobsList &jobs = SmallShell::getInstance().getJobsList();
-      std::cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:\n";
-      if (jobs.size() > 0)
+      // the queued jobs never started, they are dropped without a signal
+      size_t running = jobs.size() - jobs.queuedCount();
+      if (m_grace_ms > 0)
+      {
+        // they all get SIGTERM and the grace period together, the deadline is the same for every job
+        std::cout << "smash: sending SIGTERM signal to " << running << " jobs:\n";
+        jobs.signalAllJobs(SIGTERM);
+        running = jobs.waitAllJobs(_monotonic_ms() + m_grace_ms);
+        if (running > 0)
+        {
+          std::cout << "smash: sending SIGKILL signal to " << running << " jobs:\n";
+        }
+      }
+      else
       {
-        jobs.killAllJobs();
+        std::cout << "smash: sending SIGKILL signal to " << running << " jobs:\n";
       }
+      jobs.killAllJobs();
     }
     // else, if other arguments other than "kill" were provided they will be ignored
   }
-  // exit the smash
-  delete this;
-  exit(0);
+  // smash exits from its loop (a session of the daemon ends, the daemon keeps serving the other clients), so the
+  // commands and the state are torn down in order
+  SmallShell::getInstance().quit();
 }
 
 // * BuiltInCommand 8 (KillCommand)
 
 KillCommand::KillCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_signal_number(0),
+      m_job_id(0),
+      m_targets()
 {
   if (getName() != "kill")
   {
     throw std::logic_error("wrong name");
   }
-
-  try
+  const std::vector<std::string> &args = getArgs();
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  bool valid = args.size() >= 2;
+  for (size_t i = 1; valid && i < args.size(); i++)
   {
-    m_job_id = std::stoi(getArgs().at(1));
-    // check if the job id actually exists
-    if (SmallShell::getInstance().getJobsList().getJobById(m_job_id) == nullptr)
-    {
-      std::cerr << "smash error: kill: job-id " << m_job_id << " does not exist\n";
-      throw std::logic_error("KillCommand::KillCommand");
-    }
-
-    if (getArgs().size() != 2)
+    int first = 0;
+    int last = 0;
+    if (_parse_job_id(args[i], &first))
     {
-      std::cerr << "smash error: kill: invalid arguments\n";
-      throw std::logic_error("KillCommand::KillCommand");
+      // a job id names a job that exists, a range or a pattern may name none
+      if (jobslist.getJobById(first) == nullptr)
+      {
+        std::cerr << "smash error: kill: job-id " << first << " does not exist\n";
+        throw std::logic_error("KillCommand::KillCommand");
+      }
+      m_job_id = (args.size() == 2) ? first : 0;
     }
-
-    // should remove the - before the signal number before std::stoi
-    m_signal_number = std::stoi(getArgs().front()); // kill -9 3 this will give -9 (int)
-    if (m_signal_number > 0)
+    else if (!_parse_job_range(args[i], &first, &last) && (args[i][0] != '%' || args[i].size() == 1))
     {
-      std::cerr << "smash error: kill: invalid arguments\n";
-      throw std::logic_error("KillCommand::KillCommand");
+      valid = false; // neither an id, a range nor a pattern
     }
-    m_signal_number = -m_signal_number; // this will make the -9 to 9
-  }
-  catch (const std::invalid_argument &e)
-  {
-    std::cerr << "smash error: kill: invalid arguments\n";
-    throw std::logic_error("KillCommand::KillCommand");
+    m_targets.push_back(args[i]);
   }
-  catch (const std::out_of_range &e)
+  if (!valid || args[0][0] != '-' || !_parse_signal(args[0].substr(1), &m_signal_number))
   {
     std::cerr << "smash error: kill: invalid arguments\n";
     throw std::logic_error("KillCommand::KillCommand");
@@ -1042,201 +2045,4342 @@ KillCommand::~KillCommand()
   // default
 }
 
-void KillCommand::execute()
+bool KillCommand::resolve(const std::string &target, std::set<int> &ids)
 {
-  JobsList &job_list = SmallShell::getInstance().getJobsList();
-  JobsList::JobEntry *job = job_list.getJobById(m_job_id);
-  if (job != nullptr) // job exists
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  int first = 0;
+  int last = 0;
+  bool range = _parse_job_range(target, &first, &last);
+  if (_parse_job_id(target, &first))
+  {
+    last = first;
+    range = true;
+  }
+  bool matched = false;
+  for (int id : jobslist.getJobIds())
   {
-    if (kill(job->getJobPid(), m_signal_number) != 0) // failure
+    if (range ? (first <= id && id <= last)
+              : fnmatch(target.c_str() + 1, jobslist.getJobById(id)->getCMDLine().c_str(), 0) == 0)
     {
-      perror("smash error: kill failed");
-      return;
+      ids.insert(id);
+      matched = true;
     }
-    std::cout << "signal number " << m_signal_number << " was sent to pid " << job->getJobPid() << "\n";
   }
+  return matched;
 }
 
-/* *
- * The JobsList class
- */
-
-/* The JobEntry class methods */
-JobsList::JobEntry::JobEntry(const std::string &cmd, pid_t job_pid, int job_id)
-    : m_command(cmd),
-      m_job_pid(job_pid),
-      m_job_id(job_id)
-{
-}
-
-JobsList::JobEntry::~JobEntry()
-{
-}
-
-const std::string &JobsList::JobEntry::getCMDLine()
-{
-  return m_command;
-}
-
-pid_t JobsList::JobEntry::getJobPid()
+void KillCommand::execute()
 {
-  return m_job_pid;
-}
+  JobsList &job_list = SmallShell::getInstance().getJobsList();
+  if (m_job_id != 0)
+  {
+    JobsList::JobEntry *job = job_list.getJobById(m_job_id);
+    if (job != nullptr && job->isQueued()) // it did not start, it is taken out of the queue
+    {
+      job_list.cancelQueuedJob(m_job_id, m_signal_number);
+      std::cout << "signal number " << m_signal_number << " cancelled queued job-id " << m_job_id << "\n";
+    }
+    else if (job != nullptr) // job exists
+    {
+      if (job->sendSignal(m_signal_number) != 0) // failure
+      {
+        perror("smash error: kill failed");
+        setExitStatus(1);
+        return;
+      }
+      std::cout << "signal number " << m_signal_number << " was sent to pid " << job->getJobPid() << "\n";
+    }
+    return;
+  }
 
-int JobsList::JobEntry::getJobID()
-{
-  return m_job_id;
+  // every target is resolved before any job gets the signal, a job that a signal ends is still named once
+  std::set<int> ids;
+  for (const std::string &target : m_targets)
+  {
+    if (!resolve(target, ids))
+    {
+      std::cerr << "smash error: kill: " << target << " matches no job\n";
+      setExitStatus(1);
+    }
+  }
+  size_t sent = 0;
+  size_t cancelled = 0;
+  size_t failed = 0;
+  int error = 0;
+  for (int id : ids)
+  {
+    JobsList::JobEntry *job = job_list.getJobById(id);
+    if (job == nullptr)
+    {
+      continue;
+    }
+    if (job->isQueued())
+    {
+      job_list.cancelQueuedJob(id, m_signal_number);
+      cancelled++;
+    }
+    else if (job->sendSignal(m_signal_number) == 0)
+    {
+      sent++;
+    }
+    else
+    {
+      error = errno;
+      failed++;
+    }
+  }
+  if (failed > 0)
+  {
+    std::cerr << "smash error: kill failed: " << strerror(error) << " (" << failed << " jobs)\n";
+    setExitStatus(1);
+  }
+  if (sent + cancelled > 0)
+  {
+    std::cout << "signal number " << m_signal_number << " was sent to " << sent << " jobs";
+    if (cancelled > 0)
+    {
+      std::cout << " and cancelled " << cancelled << " queued jobs";
+    }
+    std::cout << "\n";
+  }
 }
 
-/* The JobList class methods */
-int JobsList::size() const
-{
-  return m_jobs.size();
-}
+// * BuiltInCommand 9 (SetCommand)
 
-JobsList::JobsList()
+SetCommand::SetCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
 {
-  // default
+  if (getName() != "set")
+  {
+    throw std::logic_error("wrong name");
+  }
+  bool valid = (getArgs().size() == 1 && getArgs().front() == "-o") ||
+               (getArgs().size() == 2 && (getArgs().front() == "-o" || getArgs().front() == "+o") &&
+                (getArgs().back() == "pipefail" || getArgs().back() == "capture"));
+  if (!valid)
+  {
+    std::cerr << "smash error: set: invalid arguments\n";
+    throw std::logic_error("SetCommand::SetCommand");
+  }
 }
 
-JobsList::~JobsList()
+SetCommand::~SetCommand()
 {
   // default
 }
 
-// assumes a valid command
-void JobsList::addJob(Command *cmd, pid_t pid)
+void SetCommand::execute()
 {
-  if (cmd)
+  SmallShell &smash = SmallShell::getInstance();
+  if (getArgs().size() == 1)
   {
-    m_jobs.push_back(JobEntry(cmd->getCMDLine(), pid, (m_jobs.size() ? getLastJob()->getJobID() + 1 : 1)));
+    std::cout << "pipefail\t" << (smash.isPipefail() ? "on" : "off") << "\n";
+    std::cout << "capture\t\t" << (smash.getJobsList().isCapturing() ? "on" : "off") << "\n";
+    return;
   }
-}
-
-void JobsList::printJobsList()
-{
-  for (JobsList::JobEntry &job : m_jobs)
+  if (getArgs().back() == "capture")
   {
-    std::cout << "[" << job.getJobID() << "] " << job.getCMDLine() << "\n";
+    smash.getJobsList().setCapture(getArgs().front() == "-o");
+    return;
   }
+  smash.setPipefail(getArgs().front() == "-o");
 }
 
-void JobsList::killAllJobs()
+// * BuiltInCommand 10 (WaitCommand)
+
+WaitCommand::WaitCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_any(false),
+      m_timeout_ms(-1),
+      m_job_ids()
 {
-  for (JobsList::JobEntry &job : m_jobs)
+  if (getName() != "wait")
   {
-    std::cout << job.getJobPid() << ": " << job.getCMDLine() << "\n";
-
-    if (kill(job.getJobPid(), SIGKILL) != 0) // failure
-    {
-      perror("smash error: kill failed");
-    }
+    throw std::logic_error("wrong name");
   }
-  m_jobs.clear();
-}
-
-void JobsList::removeFinishedJobs()
-{
-  std::vector<int> ids;
+  JobsList &jobs = SmallShell::getInstance().getJobsList();
 
-  for (JobsList::JobEntry &job : m_jobs)
+  try
   {
-    // TODO what happens when its zombie?
-    int res = waitpid(job.getJobPid(), nullptr, WNOHANG);
-    if (res == -1 || res == job.getJobPid())
+    for (size_t i = 0; i < getArgs().size(); i++)
     {
-      ids.push_back(job.getJobID());
+      const std::string &arg = getArgs()[i];
+      if (arg == "-n")
+      {
+        m_any = true;
+      }
+      else if (arg == "-t")
+      {
+        size_t end = 0;
+        double seconds = std::stod(getArgs().at(++i), &end);
+        if (end != getArgs()[i].size() || seconds < 0)
+        {
+          throw std::invalid_argument("WaitCommand::WaitCommand");
+        }
+        m_timeout_ms = (long long)(seconds * 1000);
+      }
+      else
+      {
+        size_t end = 0;
+        std::string id = (arg[0] == '%') ? arg.substr(1) : arg;
+        m_job_ids.push_back(std::stoi(id, &end));
+        if (end != id.size())
+        {
+          throw std::invalid_argument("WaitCommand::WaitCommand");
+        }
+      }
     }
   }
-
-  for (int id : ids)
+  catch (const std::exception &e)
   {
-    removeJobById(id);
+    std::cerr << "smash error: wait: invalid arguments\n";
+    throw std::logic_error("WaitCommand::WaitCommand");
   }
-}
 
-JobsList::JobEntry *JobsList::getJobById(int jobId)
-{
-  for (JobsList::JobEntry &job : m_jobs)
+  int status = 0;
+  for (int id : m_job_ids)
   {
-    if (job.getJobID() == jobId)
+    if (jobs.getJobById(id) == nullptr && !jobs.getFinishedStatus(id, &status))
     {
-      return &job;
+      std::cerr << "smash error: wait: job-id " << id << " does not exist\n";
+      throw std::logic_error("WaitCommand::WaitCommand");
     }
   }
-  return nullptr;
 }
 
-void JobsList::removeJobById(int jobId)
+WaitCommand::~WaitCommand()
+{
+  // default
+}
+
+void WaitCommand::execute()
 {
-  for (std::vector<JobEntry>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+  JobsList &jobs = SmallShell::getInstance().getJobsList();
+  std::vector<int> targets = m_job_ids.empty() ? jobs.getJobIds() : m_job_ids;
+  std::vector<std::pair<int, int>> finished; // job id and its status
+  std::vector<int> waiting;                  // the targets that did not finish yet
+  int status = 0;
+
+  // the jobs list reaps every job that exits (and starts the queued ones), a target is done once it is gone
+  auto collect = [&]() {
+    for (std::vector<int>::iterator it = waiting.begin(); it != waiting.end();)
+    {
+      if (jobs.getJobById(*it) == nullptr)
+      {
+        jobs.getFinishedStatus(*it, &status);
+        finished.push_back(std::make_pair(*it, status));
+        it = waiting.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  };
+  waiting = targets;
+  collect(); // the ones that finished before we got here
+
+  long long deadline = (m_timeout_ms >= 0) ? _monotonic_ms() + m_timeout_ms : -1;
+  bool timed_out = false;
+  while (!waiting.empty() && !(m_any && !finished.empty()))
   {
-    if ((*it).getJobID() == jobId)
+    if (deadline != -1 && _monotonic_ms() >= deadline)
     {
-      m_jobs.erase(it);
-      return;
+      timed_out = true;
+      break;
     }
+    if (!jobs.waitForExits(deadline))
+    {
+      setExitStatus(130); // interrupted by ctrl-C
+      break;
+    }
+    collect();
   }
-}
 
-JobsList::JobEntry *JobsList::getLastJob()
-{
-  return m_jobs.size() ? &m_jobs.back() : nullptr;
+  // -n reports the first job that finished, otherwise every job in the order they finished
+  size_t reported = (m_any && !finished.empty()) ? 1 : finished.size();
+  for (size_t i = 0; i < reported; i++)
+  {
+    std::cout << "[" << finished[i].first << "] exit " << finished[i].second << "\n";
+    setExitStatus(finished[i].second);
+  }
+  if (timed_out && !(m_any && !finished.empty()))
+  {
+    setExitStatus(124);
+  }
 }
 
-/* *
- * The Small Shell class
- */
-
-// * SmallShell Public
+// * BuiltInCommand 14 (JobtopCommand)
 
-// initialize the static variable in SmallShell
-const std::string SmallShell::DEFAULT_PROMPT = "smash";
+JobtopCommand::JobtopCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_sort_key(SortKey::Cpu),
+      m_delay_ms(1000),
+      m_frames(isatty(STDOUT_FILENO) ? -1 : 1),
+      m_files()
+{
+  if (getName() != "jobtop")
+  {
+    throw std::logic_error("wrong name");
+  }
+
+  try
+  {
+    for (size_t i = 0; i < getArgs().size(); i++)
+    {
+      const std::string &arg = getArgs()[i];
+      size_t end = 0;
+      if (arg == "-s")
+      {
+        const std::string &key = getArgs().at(++i);
+        if (key == "cpu")
+        {
+          m_sort_key = SortKey::Cpu;
+        }
+        else if (key == "mem")
+        {
+          m_sort_key = SortKey::Memory;
+        }
+        else if (key == "time")
+        {
+          m_sort_key = SortKey::Time;
+        }
+        else if (key == "id")
+        {
+          m_sort_key = SortKey::Id;
+        }
+        else
+        {
+          throw std::invalid_argument("JobtopCommand::JobtopCommand");
+        }
+      }
+      else if (arg == "-d")
+      {
+        double seconds = std::stod(getArgs().at(++i), &end);
+        if (end != getArgs()[i].size() || seconds <= 0)
+        {
+          throw std::invalid_argument("JobtopCommand::JobtopCommand");
+        }
+        m_delay_ms = (long long)(seconds * 1000);
+      }
+      else if (arg == "-n")
+      {
+        m_frames = std::stoll(getArgs().at(++i), &end);
+        if (end != getArgs()[i].size() || m_frames <= 0)
+        {
+          throw std::invalid_argument("JobtopCommand::JobtopCommand");
+        }
+      }
+      else
+      {
+        throw std::invalid_argument("JobtopCommand::JobtopCommand");
+      }
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "smash error: jobtop: invalid arguments\n";
+    throw std::logic_error("JobtopCommand::JobtopCommand");
+  }
+}
+
+JobtopCommand::~JobtopCommand()
+{
+  for (std::pair<const pid_t, ProcFiles> &entry : m_files)
+  {
+    close(entry.second.stat_fd);
+    close(entry.second.statm_fd);
+  }
+}
+
+bool JobtopCommand::_sample(ProcFiles &files, char *state, long long *cpu_ticks, long long *rss_pages)
+{
+  char buffer[512];
+  ssize_t size = pread(files.stat_fd, buffer, sizeof(buffer) - 1, 0);
+  if (size <= 0)
+  {
+    return false;
+  }
+  buffer[size] = '\0';
+  // the command name can hold spaces and parentheses, the fields start after the last ')'
+  char *fields = strrchr(buffer, ')');
+  if (fields == nullptr)
+  {
+    return false;
+  }
+  unsigned long long utime = 0;
+  unsigned long long stime = 0;
+  if (sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", state, &utime, &stime) != 3)
+  {
+    return false;
+  }
+  *cpu_ticks = utime + stime;
+
+  size = pread(files.statm_fd, buffer, sizeof(buffer) - 1, 0);
+  if (size <= 0)
+  {
+    return false;
+  }
+  buffer[size] = '\0';
+  return sscanf(buffer, "%*u %lld", rss_pages) == 1;
+}
+
+void JobtopCommand::_draw_frame(bool in_place)
+{
+  JobsList &jobs = SmallShell::getInstance().getJobsList();
+  jobs.removeFinishedJobs();
+  static const long TICKS_PER_SECOND = sysconf(_SC_CLK_TCK);
+  static const long PAGE_KB = sysconf(_SC_PAGESIZE) / 1024;
+  long long now = _monotonic_ms();
+
+  for (std::pair<const pid_t, ProcFiles> &entry : m_files)
+  {
+    entry.second.seen = false;
+  }
+  std::vector<Row> rows;
+  rows.reserve(jobs.size());
+  for (int id : jobs.getJobIds())
+  {
+    JobsList::JobEntry *job = jobs.getJobById(id);
+    Row row = {id, job->getPgid(), job->isQueued() ? 'Q' : '?', now - job->getStartTime(), 0, 0, job->getCMDLine()};
+    for (const JobsList::JobEntry::Member &member : job->getMembers())
+    {
+      std::map<pid_t, ProcFiles>::iterator it = m_files.find(member.pid);
+      if (it == m_files.end())
+      {
+        std::string proc = "/proc/" + std::to_string(member.pid);
+        ProcFiles files = {open((proc + "/stat").c_str(), O_RDONLY | O_CLOEXEC),
+                           open((proc + "/statm").c_str(), O_RDONLY | O_CLOEXEC), 0, -1, true};
+        it = m_files.insert(std::make_pair(member.pid, files)).first;
+      }
+      ProcFiles &files = it->second;
+      files.seen = true;
+      char state = '?';
+      long long cpu_ticks = 0;
+      long long rss_pages = 0;
+      if (!_sample(files, &state, &cpu_ticks, &rss_pages))
+      {
+        continue;
+      }
+      // the first sample averages over the life of the job, the next ones over the last frame
+      long long since_ms = (files.sampled_ms == -1) ? row.elapsed_ms : now - files.sampled_ms;
+      long long ticks = cpu_ticks - files.cpu_ticks;
+      if (since_ms > 0)
+      {
+        row.cpu_percent += 100.0 * 1000 * ticks / TICKS_PER_SECOND / since_ms;
+      }
+      files.cpu_ticks = cpu_ticks;
+      files.sampled_ms = now;
+      row.rss_kb += rss_pages * PAGE_KB;
+      if (row.state == '?' || member.pid == job->getPgid())
+      {
+        row.state = state;
+      }
+    }
+    rows.push_back(row);
+  }
+  // the files of the members that were reaped since the last frame
+  for (std::map<pid_t, ProcFiles>::iterator it = m_files.begin(); it != m_files.end();)
+  {
+    if (!it->second.seen)
+    {
+      close(it->second.stat_fd);
+      close(it->second.statm_fd);
+      it = m_files.erase(it);
+      continue;
+    }
+    ++it;
+  }
+
+  size_t shown = rows.size();
+  struct winsize window;
+  if (in_place && ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_row > 2)
+  {
+    shown = std::min(shown, (size_t)window.ws_row - 2);
+  }
+  SortKey key = m_sort_key;
+  std::partial_sort(rows.begin(), rows.begin() + shown, rows.end(), [key](const Row &a, const Row &b) {
+    switch (key)
+    {
+    case SortKey::Cpu:
+      return a.cpu_percent > b.cpu_percent || (a.cpu_percent == b.cpu_percent && a.job_id < b.job_id);
+    case SortKey::Memory:
+      return a.rss_kb > b.rss_kb || (a.rss_kb == b.rss_kb && a.job_id < b.job_id);
+    case SortKey::Time:
+      return a.elapsed_ms > b.elapsed_ms || (a.elapsed_ms == b.elapsed_ms && a.job_id < b.job_id);
+    default:
+      return a.job_id < b.job_id;
+    }
+  });
+
+  std::ostringstream frame;
+  if (in_place)
+  {
+    frame << "\033[H\033[J"; // home and clear, the frame is redrawn over the last one
+  }
+  frame << "jobtop: " << rows.size() << " jobs\n";
+  frame << std::left << std::setw(8) << "JOB" << std::right << std::setw(8) << "PGID" << "  S " << std::setw(10)
+        << "ELAPSED" << std::setw(8) << "%CPU" << std::setw(10) << "RSS KB" << "  COMMAND\n";
+  for (size_t i = 0; i < shown; i++)
+  {
+    const Row &row = rows[i];
+    long long seconds = row.elapsed_ms / 1000;
+    std::ostringstream elapsed;
+    elapsed << seconds / 3600 << ":" << std::setfill('0') << std::setw(2) << seconds / 60 % 60 << ":" << std::setw(2)
+            << seconds % 60;
+    frame << std::left << std::setw(8) << ("[" + std::to_string(row.job_id) + "]") << std::right << std::setw(8)
+          << row.pgid << "  " << row.state << " " << std::setw(10) << elapsed.str() << std::setw(8) << std::fixed
+          << std::setprecision(1) << row.cpu_percent << std::setw(10) << row.rss_kb << "  " << row.command << "\n";
+  }
+  std::cout << frame.str();
+  std::cout.flush();
+}
+
+void JobtopCommand::execute()
+{
+  bool in_place = isatty(STDOUT_FILENO);
+  for (long long frame = 0; m_frames == -1 || frame < m_frames; frame++)
+  {
+    if (frame > 0)
+    {
+      if (!in_place)
+      {
+        std::cout << "\n";
+      }
+      struct timespec delay = {(time_t)(m_delay_ms / 1000), (long)(m_delay_ms % 1000) * 1000000};
+      if (nanosleep(&delay, nullptr) == -1) // ctrl-C
+      {
+        return;
+      }
+    }
+    _draw_frame(in_place);
+  }
+}
+
+// * BuiltInCommand 15 (WatchCommand)
+
+WatchCommand::WatchCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_interval_ms(2000),
+      m_diff(false),
+      m_count(-1),
+      m_command_line(),
+      m_command(nullptr)
+{
+  if (getName() != "watch")
+  {
+    throw std::logic_error("wrong name");
+  }
+
+  size_t i = 0;
+  try
+  {
+    for (; i < getArgs().size() && getArgs()[i][0] == '-'; i++)
+    {
+      const std::string &arg = getArgs()[i];
+      size_t end = 0;
+      if (arg == "-n")
+      {
+        double seconds = std::stod(getArgs().at(++i), &end);
+        if (end != getArgs()[i].size() || seconds <= 0)
+        {
+          throw std::invalid_argument("WatchCommand::WatchCommand");
+        }
+        m_interval_ms = (long long)(seconds * 1000);
+      }
+      else if (arg == "-c")
+      {
+        m_count = std::stoll(getArgs().at(++i), &end);
+        if (end != getArgs()[i].size() || m_count <= 0)
+        {
+          throw std::invalid_argument("WatchCommand::WatchCommand");
+        }
+      }
+      else if (arg == "-d")
+      {
+        m_diff = true;
+      }
+      else
+      {
+        throw std::invalid_argument("WatchCommand::WatchCommand");
+      }
+    }
+  }
+  catch (const std::exception &e)
+  {
+    i = getArgs().size(); // reported below with the missing command
+  }
+  if (i >= getArgs().size() || m_interval_ms <= 0)
+  {
+    std::cerr << "smash error: watch: invalid arguments\n";
+    throw std::logic_error("WatchCommand::WatchCommand");
+  }
+
+  for (; i < getArgs().size(); i++)
+  {
+    m_command_line += (m_command_line.empty() ? "" : " ") + getLineArgs()[i];
+  }
+  // the line of watch was already expanded, the command is not expanded again on every run
+  m_command = SmallShell::getInstance().CreateCommand(m_command_line.c_str(), true);
+  if (m_command == nullptr)
+  {
+    throw std::logic_error("WatchCommand::WatchCommand");
+  }
+}
+
+WatchCommand::~WatchCommand()
+{
+  delete m_command;
+}
+
+std::string WatchCommand::_run_captured(int memfd)
+{
+  std::cout.flush();
+  int saved_out = dup(STDOUT_FILENO);
+  if (saved_out == -1 || dup2(memfd, STDOUT_FILENO) == -1)
+  {
+    perror("smash error: dup2 failed");
+    if (saved_out != -1)
+    {
+      close(saved_out);
+    }
+    return "";
+  }
+  try
+  {
+    m_command->execute();
+  }
+  catch (const std::exception &e)
+  {
+    m_command->setExitStatus(1);
+  }
+  std::cout.flush();
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_out);
+
+  // the same memfd is rewound for the next run
+  std::string output;
+  char buffer[4096];
+  ssize_t count = 0;
+  lseek(memfd, 0, SEEK_SET);
+  while ((count = read(memfd, buffer, sizeof(buffer))) > 0)
+  {
+    output.append(buffer, count);
+  }
+  if (ftruncate(memfd, 0) == -1)
+  {
+    perror("smash error: ftruncate failed");
+  }
+  lseek(memfd, 0, SEEK_SET);
+  return output;
+}
+
+void WatchCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd == -1)
+  {
+    perror("smash error: timerfd_create failed");
+    setExitStatus(1);
+    return;
+  }
+  // the first run is right away, the next ones are on the ticks of the interval and not a sleep after each run
+  struct itimerspec schedule;
+  schedule.it_interval.tv_sec = m_interval_ms / 1000;
+  schedule.it_interval.tv_nsec = (m_interval_ms % 1000) * 1000000;
+  schedule.it_value.tv_sec = 0;
+  schedule.it_value.tv_nsec = 1;
+  if (timerfd_settime(timer_fd, 0, &schedule, nullptr) == -1)
+  {
+    perror("smash error: timerfd_settime failed");
+    close(timer_fd);
+    setExitStatus(1);
+    return;
+  }
+  int memfd = -1;
+  if (m_diff && (memfd = memfd_create("smash-watch", MFD_CLOEXEC)) == -1)
+  {
+    perror("smash error: memfd_create failed");
+    close(timer_fd);
+    setExitStatus(1);
+    return;
+  }
+
+  bool in_place = !m_diff && isatty(STDOUT_FILENO);
+  std::vector<std::string> previous;
+  bool first = true;
+  smash.setInterrupted(false);
+  for (long long run = 0; m_count == -1 || run < m_count; run++)
+  {
+    // poll and not a read of the timerfd: a read is restarted after the ctrl-C handler, poll returns
+    struct pollfd tick = {timer_fd, POLLIN, 0};
+    if (poll(&tick, 1, -1) == -1 || smash.wasInterrupted())
+    {
+      break;
+    }
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) == -1)
+    {
+      break;
+    }
+    smash.getJobsList().removeFinishedJobs();
+
+    if (!m_diff)
+    {
+      if (in_place)
+      {
+        std::cout << "\033[H\033[J" << "Every " << m_interval_ms / 1000.0 << "s: " << m_command_line << "\n\n";
+      }
+      try
+      {
+        m_command->execute();
+      }
+      catch (const std::exception &e)
+      {
+        m_command->setExitStatus(1);
+      }
+      std::cout.flush();
+    }
+    else
+    {
+      std::vector<std::string> lines;
+      std::istringstream output(_run_captured(memfd));
+      for (std::string line; std::getline(output, line);)
+      {
+        lines.push_back(line);
+      }
+      if (first)
+      {
+        for (const std::string &line : lines)
+        {
+          std::cout << line << "\n";
+        }
+      }
+      else
+      {
+        // a line is a change if it is not in the other run as many times, sorted copies keep it O(n log n)
+        std::vector<std::string> now_sorted = lines;
+        std::vector<std::string> before_sorted = previous;
+        std::sort(now_sorted.begin(), now_sorted.end());
+        std::sort(before_sorted.begin(), before_sorted.end());
+        std::vector<std::string> gone;
+        std::vector<std::string> added;
+        std::set_difference(before_sorted.begin(), before_sorted.end(), now_sorted.begin(), now_sorted.end(),
+                            std::back_inserter(gone));
+        std::set_difference(now_sorted.begin(), now_sorted.end(), before_sorted.begin(), before_sorted.end(),
+                            std::back_inserter(added));
+        for (const std::string &line : gone)
+        {
+          std::cout << "- " << line << "\n";
+        }
+        for (const std::string &line : added)
+        {
+          std::cout << "+ " << line << "\n";
+        }
+      }
+      std::cout.flush();
+      previous.swap(lines);
+      first = false;
+    }
+    setExitStatus(m_command->getExitStatus());
+    if (smash.wasInterrupted()) // ctrl-C killed the command, the watch is over too
+    {
+      break;
+    }
+  }
+  if (smash.wasInterrupted())
+  {
+    setExitStatus(130);
+  }
+  if (memfd != -1)
+  {
+    close(memfd);
+  }
+  close(timer_fd);
+}
+
+// * BuiltInCommand 16 (ScheduleCommand)
+
+ScheduleCommand::ScheduleCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "at" && getName() != "every")
+  {
+    throw std::logic_error("wrong name");
+  }
+}
+
+ScheduleCommand::~ScheduleCommand()
+{
+  // default
+}
+
+void ScheduleCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  bool every = getName() == "every";
+  bool overlap = every && !getArgs().empty() && getArgs()[0] == "-o";
+  size_t first = overlap ? 1 : 0;
+  long long delay_ms = 0;
+  bool valid = getArgs().size() > first + 1;
+  if (valid && every)
+  {
+    valid = _parse_duration(getArgs()[first], &delay_ms);
+  }
+  else if (valid)
+  {
+    const std::string &time = getArgs()[first];
+    valid = (time[0] == '+') ? _parse_duration(time.substr(1), &delay_ms) : _parse_clock_time(time, &delay_ms);
+  }
+  if (!valid)
+  {
+    std::cerr << "smash error: " << getName() << ": invalid arguments\n";
+    setExitStatus(1);
+    return;
+  }
+
+  std::string command;
+  for (size_t i = first + 1; i < getArgs().size(); i++)
+  {
+    command += (command.empty() ? "" : " ") + getLineArgs()[i];
+  }
+  if (_isBackgroundCommand(command.c_str())) // every run is in the background anyway
+  {
+    command = _trim(command.substr(0, command.size() - 1));
+  }
+  // a command that can not be created is reported now and not on every run
+  Command *probe = smash.CreateCommand(command.c_str(), true);
+  if (probe == nullptr)
+  {
+    setExitStatus(1);
+    return;
+  }
+  delete probe;
+  smash.getScheduler().add(command, _monotonic_ms() + delay_ms, every ? delay_ms : 0, overlap);
+}
+
+// * BuiltInCommand 17 (AtqCommand)
+
+AtqCommand::AtqCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "atq")
+  {
+    throw std::logic_error("wrong name");
+  }
+}
+
+AtqCommand::~AtqCommand()
+{
+  // default
+}
+
+void AtqCommand::execute()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  long long now_ms = _monotonic_ms();
+  for (const Scheduler::Entry &entry : SmallShell::getInstance().getScheduler().getEntries())
+  {
+    // the next run on the wall clock
+    time_t next = now.tv_sec + (entry.next_ms - now_ms + now.tv_nsec / 1000000) / 1000;
+    struct tm when;
+    char clock[16];
+    localtime_r(&next, &when);
+    strftime(clock, sizeof(clock), "%H:%M:%S", &when);
+    std::cout << "[" << entry.id << "] " << clock;
+    if (entry.interval_ms)
+    {
+      std::cout << " every " << entry.interval_ms / 1000.0 << "s" << (entry.overlap ? " -o" : "");
+    }
+    std::cout << ": " << entry.command << "\n";
+  }
+}
+
+// * BuiltInCommand 18 (AtrmCommand)
+
+AtrmCommand::AtrmCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "atrm")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (getArgs().empty())
+  {
+    std::cerr << "smash error: atrm: invalid arguments\n";
+    throw std::logic_error("AtrmCommand::AtrmCommand");
+  }
+}
+
+AtrmCommand::~AtrmCommand()
+{
+  // default
+}
+
+void AtrmCommand::execute()
+{
+  Scheduler &scheduler = SmallShell::getInstance().getScheduler();
+  for (const std::string &arg : getArgs())
+  {
+    int id = 0;
+    try
+    {
+      size_t end = 0;
+      id = std::stoi(arg, &end);
+      if (end != arg.size())
+      {
+        id = 0;
+      }
+    }
+    catch (const std::exception &e)
+    {
+      id = 0;
+    }
+    if (id <= 0)
+    {
+      std::cerr << "smash error: atrm: invalid arguments\n";
+      setExitStatus(1);
+    }
+    else if (!scheduler.remove(id))
+    {
+      std::cerr << "smash error: atrm: schedule " << id << " does not exist\n";
+      setExitStatus(1);
+    }
+  }
+}
+
+// * BuiltInCommand 19 (AdmitCommand)
+
+AdmitCommand::AdmitCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_max_running(-1),
+      m_max_cpu_pressure(-1),
+      m_max_memory_pressure(-1)
+{
+  if (getName() != "admit")
+  {
+    throw std::logic_error("wrong name");
+  }
+  try
+  {
+    for (size_t i = 0; i < getArgs().size(); i++)
+    {
+      const std::string &option = getArgs()[i];
+      const std::string &value = getArgs().at(++i);
+      size_t end = 0;
+      if (option == "-j")
+      {
+        m_max_running = std::stoll(value, &end);
+      }
+      else if (option == "-c")
+      {
+        m_max_cpu_pressure = std::stod(value, &end);
+      }
+      else if (option == "-m")
+      {
+        m_max_memory_pressure = std::stod(value, &end);
+      }
+      if (end == 0 || end != value.size() || m_max_running < -1 || m_max_cpu_pressure < -1 ||
+          m_max_memory_pressure < -1 || value[0] == '-')
+      {
+        throw std::invalid_argument("AdmitCommand::AdmitCommand");
+      }
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "smash error: admit: invalid arguments\n";
+    throw std::logic_error("AdmitCommand::AdmitCommand");
+  }
+  if ((m_max_cpu_pressure > 0 && JobsList::readPressure("cpu") < 0) ||
+      (m_max_memory_pressure > 0 && JobsList::readPressure("memory") < 0))
+  {
+    std::cerr << "smash error: admit: /proc/pressure is not supported\n";
+    throw std::logic_error("AdmitCommand::AdmitCommand");
+  }
+}
+
+AdmitCommand::~AdmitCommand()
+{
+  // default
+}
+
+void AdmitCommand::execute()
+{
+  JobsList &jobs = SmallShell::getInstance().getJobsList();
+  if (getArgs().empty())
+  {
+    const JobsList::Admission &admission = jobs.getAdmission();
+    std::cout << "max jobs: " << (admission.max_running ? std::to_string(admission.max_running) : "off") << "\n";
+    std::ostringstream cpu;
+    std::ostringstream memory;
+    cpu << admission.max_cpu_pressure << "%";
+    memory << admission.max_memory_pressure << "%";
+    std::cout << "cpu pressure: " << (admission.max_cpu_pressure > 0 ? cpu.str() : "off") << "\n";
+    std::cout << "memory pressure: " << (admission.max_memory_pressure > 0 ? memory.str() : "off") << "\n";
+    std::cout << "running: " << jobs.size() - jobs.queuedCount() << "\nqueued: " << jobs.queuedCount() << "\n";
+    return;
+  }
+  JobsList::Admission admission = jobs.getAdmission();
+  if (m_max_running != -1)
+  {
+    admission.max_running = m_max_running;
+  }
+  if (m_max_cpu_pressure != -1)
+  {
+    admission.max_cpu_pressure = m_max_cpu_pressure;
+  }
+  if (m_max_memory_pressure != -1)
+  {
+    admission.max_memory_pressure = m_max_memory_pressure;
+  }
+  jobs.setAdmission(admission);
+}
+
+// * BuiltInCommand 20 (JoblogCommand)
+
+JoblogCommand::JoblogCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_follow(false),
+      m_job_id(0)
+{
+  if (getName() != "joblog")
+  {
+    throw std::logic_error("wrong name");
+  }
+  m_follow = !getArgs().empty() && getArgs()[0] == "-f";
+  size_t end = 0;
+  try
+  {
+    if (getArgs().size() != (m_follow ? 2u : 1u))
+    {
+      throw std::invalid_argument("JoblogCommand::JoblogCommand");
+    }
+    m_job_id = std::stoi(getArgs().back(), &end);
+  }
+  catch (const std::exception &e)
+  {
+    end = 0;
+  }
+  if (end == 0 || end != getArgs().back().size())
+  {
+    std::cerr << "smash error: joblog: invalid arguments\n";
+    throw std::logic_error("JoblogCommand::JoblogCommand");
+  }
+  if (SmallShell::getInstance().getJobsList().getLog(m_job_id) == nullptr)
+  {
+    std::cerr << "smash error: joblog: job-id " << m_job_id << " has no log\n";
+    throw std::logic_error("JoblogCommand::JoblogCommand");
+  }
+}
+
+JoblogCommand::~JoblogCommand()
+{
+  // default
+}
+
+void JoblogCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  JobsList &jobs = smash.getJobsList();
+  const OutputRing *log = jobs.getLog(m_job_id);
+  std::cout << log->since(0);
+  std::cout.flush();
+  unsigned long long offset = log->written();
+
+  // the pipe is read by removeFinishedJobs like at the prompt, the exit events set says when
+  smash.setInterrupted(false);
+  while (m_follow && jobs.getLogFd(m_job_id) != -1)
+  {
+    struct pollfd events = {jobs.getExitEventsFd(), POLLIN, 0};
+    if (poll(&events, 1, -1) == -1 || smash.wasInterrupted())
+    {
+      setExitStatus(130); // ctrl-C
+      break;
+    }
+    jobs.removeFinishedJobs();
+    log = jobs.getLog(m_job_id);
+    if (log == nullptr)
+    {
+      break;
+    }
+    std::cout << log->since(offset);
+    std::cout.flush();
+    offset = log->written();
+  }
+}
+
+// * BuiltInCommand 21 (TraceCommand)
+
+TraceCommand::TraceCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_on(false),
+      m_path()
+{
+  if (getName() != "trace")
+  {
+    throw std::logic_error("wrong name");
+  }
+  const std::vector<std::string> &args = getArgs();
+  if (args.size() == 2 && args[0] == "on")
+  {
+    m_on = true;
+    m_path = args[1];
+  }
+  else if (!args.empty() && !(args.size() == 1 && args[0] == "off"))
+  {
+    std::cerr << "smash error: trace: invalid arguments\n";
+    throw std::logic_error("TraceCommand::TraceCommand");
+  }
+}
+
+TraceCommand::~TraceCommand()
+{
+  // default
+}
+
+void TraceCommand::execute()
+{
+  Tracer &tracer = Tracer::getInstance();
+  if (getArgs().empty())
+  {
+    if (Tracer::enabled())
+    {
+      std::cout << "trace on " << tracer.getPath() << "\n";
+    }
+    else
+    {
+      std::cout << "trace off\n";
+    }
+    return;
+  }
+  if (!m_on)
+  {
+    tracer.stop();
+    return;
+  }
+  if (!tracer.start(m_path))
+  {
+    perror("smash error: open failed");
+    setExitStatus(1);
+  }
+}
+
+// * BuiltInCommand 22 (PushdCommand)
+
+// the working directory and then the directory stack from its top
+void _print_dirs(bool verbose)
+{
+  SmallShell &smash = SmallShell::getInstance();
+  const std::vector<std::string> &stack = smash.getDirStack();
+  std::vector<std::string> dirs(1, smash.getCwd());
+  dirs.insert(dirs.end(), stack.rbegin(), stack.rend());
+  for (size_t i = 0; i < dirs.size(); i++)
+  {
+    if (verbose)
+    {
+      std::cout << std::setw(2) << i << "  " << dirs[i] << "\n";
+    }
+    else
+    {
+      std::cout << (i == 0 ? "" : " ") << dirs[i];
+    }
+  }
+  if (!verbose)
+  {
+    std::cout << "\n";
+  }
+}
+
+PushdCommand::PushdCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "pushd")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (getArgs().size() > 1)
+  {
+    std::cerr << "smash error: pushd: too many arguments\n";
+    throw std::logic_error("PushdCommand::PushdCommand");
+  }
+}
+
+PushdCommand::~PushdCommand()
+{
+  // default
+}
+
+void PushdCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  std::vector<std::string> &stack = smash.getDirStack();
+  std::string last = smash.getCwd();
+  if (getArgs().empty())
+  {
+    // swaps the two directories on the top
+    if (stack.empty())
+    {
+      std::cerr << "smash error: pushd: no other directory\n";
+      setExitStatus(1);
+      return;
+    }
+    if (!smash.changeDir(stack.back()))
+    {
+      perror("smash error: chdir failed");
+      setExitStatus(1);
+      return;
+    }
+    stack.back() = last;
+  }
+  else
+  {
+    if (!smash.changeDir(getArgs().front()))
+    {
+      perror("smash error: chdir failed");
+      setExitStatus(1);
+      return;
+    }
+    stack.push_back(last);
+  }
+  _print_dirs(false);
+}
+
+// * BuiltInCommand 23 (PopdCommand)
+
+PopdCommand::PopdCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "popd")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (!getArgs().empty())
+  {
+    std::cerr << "smash error: popd: too many arguments\n";
+    throw std::logic_error("PopdCommand::PopdCommand");
+  }
+}
+
+PopdCommand::~PopdCommand()
+{
+  // default
+}
+
+void PopdCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  std::vector<std::string> &stack = smash.getDirStack();
+  if (stack.empty())
+  {
+    std::cerr << "smash error: popd: directory stack empty\n";
+    setExitStatus(1);
+    return;
+  }
+  if (!smash.changeDir(stack.back()))
+  {
+    perror("smash error: chdir failed");
+    setExitStatus(1);
+    return;
+  }
+  stack.pop_back();
+  _print_dirs(false);
+}
+
+// * BuiltInCommand 24 (DirsCommand)
+
+DirsCommand::DirsCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_clear(false),
+      m_verbose(false)
+{
+  if (getName() != "dirs")
+  {
+    throw std::logic_error("wrong name");
+  }
+  for (const std::string &arg : getArgs())
+  {
+    if (arg == "-c")
+    {
+      m_clear = true;
+    }
+    else if (arg == "-v")
+    {
+      m_verbose = true;
+    }
+    else
+    {
+      std::cerr << "smash error: dirs: invalid arguments\n";
+      throw std::logic_error("DirsCommand::DirsCommand");
+    }
+  }
+}
+
+DirsCommand::~DirsCommand()
+{
+  // default
+}
+
+void DirsCommand::execute()
+{
+  if (m_clear)
+  {
+    SmallShell::getInstance().getDirStack().clear();
+    return;
+  }
+  _print_dirs(m_verbose);
+}
+
+// * BuiltInCommand 25 (ZCommand)
+
+ZCommand::ZCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_mode('\0'),
+      m_fragments(getArgs())
+{
+  if (getName() != "z")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (m_fragments.empty())
+  {
+    m_mode = 'l'; // z alone lists everything
+  }
+  else if (m_fragments.front().size() > 1 && m_fragments.front()[0] == '-')
+  {
+    std::string option = m_fragments.front();
+    m_fragments.erase(m_fragments.begin());
+    m_mode = (option.size() == 2) ? option[1] : '?';
+    if ((m_mode != 'l' && m_mode != 'e' && m_mode != 'a') || (m_mode == 'e' && m_fragments.empty()) ||
+        (m_mode == 'a' && m_fragments.size() != 1))
+    {
+      std::cerr << "smash error: z: invalid arguments\n";
+      throw std::logic_error("ZCommand::ZCommand");
+    }
+  }
+}
+
+ZCommand::~ZCommand()
+{
+  // default
+}
+
+void ZCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  if (!_open_z_data(smash.getEnvironment()))
+  {
+    std::cerr << "smash error: z: HOME not set\n";
+    setExitStatus(1);
+    return;
+  }
+  Frecency &frecency = Frecency::getInstance();
+  long long now = time(nullptr);
+  if (m_mode == 'a')
+  {
+    const std::string &dir = m_fragments.front();
+    if (!frecency.visit(_normalize_path(dir[0] == '/' ? dir : smash.getCwd() + "/" + dir), now))
+    {
+      perror("smash error: open failed");
+      setExitStatus(1);
+    }
+    return;
+  }
+  if (m_mode == 'l')
+  {
+    char score[32];
+    for (const Frecency::Match &match : frecency.query(m_fragments, now))
+    {
+      snprintf(score, sizeof(score), "%-10.1f ", match.score);
+      std::cout << score << match.path << "\n";
+    }
+    return;
+  }
+
+  Frecency::Match match;
+  if (!frecency.best(m_fragments, now, &match))
+  {
+    std::cerr << "smash error: z: no match for";
+    for (const std::string &fragment : m_fragments)
+    {
+      std::cerr << " " << fragment;
+    }
+    std::cerr << "\n";
+    setExitStatus(1);
+    return;
+  }
+  if (m_mode == 'e')
+  {
+    std::cout << match.path << "\n";
+  }
+  else if (!smash.changeDir(match.path))
+  {
+    perror("smash error: chdir failed");
+    setExitStatus(1);
+  }
+}
+
+// * BuiltInCommand 26 (BackgroundCommand)
+
+BackgroundCommand::BackgroundCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_id(0)
+{
+  if (getName() != "bg")
+  {
+    throw std::logic_error("wrong name");
+  }
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  if (getArgs().size() > 1)
+  {
+    std::cerr << "smash error: bg: invalid arguments\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+  if (getArgs().empty())
+  {
+    JobsList::JobEntry *job = jobslist.getLastStoppedJob();
+    if (job == nullptr)
+    {
+      std::cerr << "smash error: bg: there are no stopped jobs\n";
+      throw std::logic_error("BackgroundCommand::BackgroundCommand");
+    }
+    m_id = job->getJobID();
+    return;
+  }
+
+  try
+  {
+    m_id = std::stoi(getArgs().front());
+  }
+  catch (...)
+  {
+    std::cerr << "smash error: bg: invalid arguments\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+  JobsList::JobEntry *job = jobslist.getJobById(m_id);
+  if (job == nullptr)
+  {
+    std::cerr << "smash error: bg: job-id " << m_id << " does not exist\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+  if (!job->isStopped())
+  {
+    std::cerr << "smash error: bg: job-id " << m_id << " is already running in the background\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+}
+
+BackgroundCommand::~BackgroundCommand()
+{
+  // default
+}
+
+void BackgroundCommand::execute()
+{
+  JobsList::JobEntry *job = SmallShell::getInstance().getJobsList().getJobById(m_id);
+  if (job == nullptr)
+  {
+    return;
+  }
+  std::cout << job->getCMDLine() << " " << job->getJobPid() << "\n";
+  if (job->sendSignal(SIGCONT) != 0)
+  {
+    perror("smash error: kill failed");
+    setExitStatus(1);
+  }
+}
+
+// * BuiltInCommand 27 (CoprocCommand)
+
+CoprocCommand::CoprocCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_mode('l'),
+      m_restart(false),
+      m_name(),
+      m_command()
+{
+  if (getName() != "coproc")
+  {
+    throw std::logic_error("wrong name");
+  }
+  const std::vector<std::string> &args = getArgs();
+  if (args.empty())
+  {
+    return;
+  }
+  bool valid = true;
+  if (args[0] == "-k")
+  {
+    m_mode = 'k';
+    valid = args.size() == 2;
+    m_name = valid ? args[1] : "";
+  }
+  else
+  {
+    m_mode = 's';
+    m_restart = args[0] == "-r";
+    size_t first = m_restart ? 1 : 0;
+    valid = args.size() > first + 1 && _is_valid_name(args[first]);
+    for (size_t i = first + 1; valid && i < args.size(); i++)
+    {
+      m_command += (m_command.empty() ? "" : " ") + getLineArgs()[i];
+    }
+    m_name = valid ? args[first] : "";
+  }
+  if (!valid)
+  {
+    std::cerr << "smash error: coproc: invalid arguments\n";
+    throw std::logic_error("CoprocCommand::CoprocCommand");
+  }
+}
+
+CoprocCommand::~CoprocCommand()
+{
+  // default
+}
+
+void CoprocCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  CoprocList &coprocs = smash.getCoprocs();
+  if (m_mode == 'l')
+  {
+    for (const CoprocList::Coproc *coproc : coprocs.getCoprocs())
+    {
+      std::cout << coproc->name << ": " << coproc->command << (coproc->restart ? " (restarts)" : "");
+      if (coproc->pid == -1)
+      {
+        std::cout << " (exited)";
+      }
+      else if (coproc->restarts > 0)
+      {
+        std::cout << " (started " << coproc->restarts + 1 << " times)";
+      }
+      std::cout << "\n";
+    }
+    return;
+  }
+
+  CoprocList::Coproc *coproc = coprocs.get(m_name);
+  if (m_mode == 'k')
+  {
+    if (coproc == nullptr)
+    {
+      std::cerr << "smash error: coproc: " << m_name << " does not exist\n";
+      setExitStatus(1);
+      return;
+    }
+    // EOF on its stdin ends most tools, SIGTERM the others. its job leaves the list when it exits
+    JobsList::JobEntry *job = smash.getJobsList().getJobById(coproc->job_id);
+    pid_t pid = coproc->pid;
+    coprocs.remove(m_name);
+    if (job != nullptr && pid != -1 && job->getJobPid() == pid && job->sendSignal(SIGTERM) != 0)
+    {
+      perror("smash error: kill failed");
+      setExitStatus(1);
+    }
+    return;
+  }
+
+  if (coproc != nullptr)
+  {
+    std::cerr << "smash error: coproc: " << m_name << " already exists\n";
+    setExitStatus(1);
+    return;
+  }
+  coprocs.add(m_name, m_command, m_restart);
+  if (!smash.startCoproc(*coprocs.get(m_name)))
+  {
+    coprocs.remove(m_name);
+    setExitStatus(1);
+  }
+}
+
+// the coprocess a builtin talks to, nullptr after printing why there is none
+CoprocList::Coproc *_running_coproc(const std::string &command, const std::string &name)
+{
+  SmallShell &smash = SmallShell::getInstance();
+  smash.reviveCoprocs(); // one that exited and restarts is there again
+  CoprocList::Coproc *coproc = smash.getCoprocs().get(name);
+  if (coproc == nullptr)
+  {
+    std::cerr << "smash error: " << command << ": " << name << " does not exist\n";
+  }
+  else if (coproc->pid == -1)
+  {
+    std::cerr << "smash error: " << command << ": " << name << " exited\n";
+    coproc = nullptr;
+  }
+  return coproc;
+}
+
+// prints why talking to a coprocess failed, errno as set by CoprocList
+void _coproc_error(const std::string &command, const CoprocList::Coproc &coproc)
+{
+  if (errno == EPIPE)
+  {
+    std::cerr << "smash error: " << command << ": " << coproc.name << " exited\n";
+  }
+  else if (errno == EINTR)
+  {
+    std::cerr << "smash error: " << command << ": interrupted\n";
+  }
+  else if (errno == ENOENT)
+  {
+    std::cerr << "smash error: " << command << ": " << coproc.name << " has " << coproc.in_flight
+              << " requests in flight\n";
+  }
+  else
+  {
+    perror(("smash error: " + command + " failed").c_str());
+  }
+}
+
+// the name and the request of cosend and coreq, the words of the request are joined by spaces
+bool _parse_request(const std::vector<std::string> &args, std::string &name, std::string &request)
+{
+  if (args.size() < 2)
+  {
+    return false;
+  }
+  name = args[0];
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    request += (i == 1 ? "" : " ") + args[i];
+  }
+  return true;
+}
+
+// ctrl-C stops a builtin that waits for a coprocess
+bool _coproc_interrupted()
+{
+  return SmallShell::getInstance().wasInterrupted();
+}
+
+// * BuiltInCommand 28 (CosendCommand)
+
+CosendCommand::CosendCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_name(),
+      m_request()
+{
+  if (getName() != "cosend")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (!_parse_request(getArgs(), m_name, m_request))
+  {
+    std::cerr << "smash error: cosend: invalid arguments\n";
+    throw std::logic_error("CosendCommand::CosendCommand");
+  }
+}
+
+CosendCommand::~CosendCommand()
+{
+  // default
+}
+
+void CosendCommand::execute()
+{
+  CoprocList::Coproc *coproc = _running_coproc("cosend", m_name);
+  SmallShell::getInstance().setInterrupted(false);
+  if (coproc == nullptr || !SmallShell::getInstance().getCoprocs().send(*coproc, m_request, _coproc_interrupted))
+  {
+    if (coproc != nullptr)
+    {
+      _coproc_error("cosend", *coproc);
+    }
+    setExitStatus(1);
+  }
+}
+
+// * BuiltInCommand 29 (CorecvCommand)
+
+CorecvCommand::CorecvCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_name(),
+      m_count(1)
+{
+  if (getName() != "corecv")
+  {
+    throw std::logic_error("wrong name");
+  }
+  bool valid = getArgs().size() == 1 || getArgs().size() == 2;
+  if (valid && getArgs().size() == 2)
+  {
+    char *end = nullptr;
+    long count = strtol(getArgs()[1].c_str(), &end, 10);
+    valid = *end == '\0' && count > 0;
+    m_count = count;
+  }
+  if (!valid)
+  {
+    std::cerr << "smash error: corecv: invalid arguments\n";
+    throw std::logic_error("CorecvCommand::CorecvCommand");
+  }
+  m_name = getArgs()[0];
+}
+
+CorecvCommand::~CorecvCommand()
+{
+  // default
+}
+
+void CorecvCommand::execute()
+{
+  CoprocList::Coproc *coproc = _running_coproc("corecv", m_name);
+  if (coproc == nullptr)
+  {
+    setExitStatus(1);
+    return;
+  }
+  if (m_count > coproc->in_flight)
+  {
+    errno = ENOENT;
+    _coproc_error("corecv", *coproc);
+    setExitStatus(1);
+    return;
+  }
+  SmallShell::getInstance().setInterrupted(false);
+  std::string answer;
+  for (size_t i = 0; i < m_count; i++)
+  {
+    if (!SmallShell::getInstance().getCoprocs().receive(*coproc, 0, answer, _coproc_interrupted))
+    {
+      _coproc_error("corecv", *coproc);
+      setExitStatus(1);
+      return;
+    }
+    std::cout << answer << "\n";
+  }
+}
+
+// * BuiltInCommand 30 (CoreqCommand)
+
+CoreqCommand::CoreqCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_name(),
+      m_request()
+{
+  if (getName() != "coreq")
+  {
+    throw std::logic_error("wrong name");
+  }
+  if (!_parse_request(getArgs(), m_name, m_request))
+  {
+    std::cerr << "smash error: coreq: invalid arguments\n";
+    throw std::logic_error("CoreqCommand::CoreqCommand");
+  }
+}
+
+CoreqCommand::~CoreqCommand()
+{
+  // default
+}
+
+void CoreqCommand::execute()
+{
+  CoprocList &coprocs = SmallShell::getInstance().getCoprocs();
+  CoprocList::Coproc *coproc = _running_coproc("coreq", m_name);
+  if (coproc == nullptr)
+  {
+    setExitStatus(1);
+    return;
+  }
+  SmallShell::getInstance().setInterrupted(false);
+  std::string answer;
+  // its answer comes after the answers to the requests that are already in flight
+  if (!coprocs.send(*coproc, m_request, _coproc_interrupted) ||
+      !coprocs.receive(*coproc, coproc->in_flight - 1, answer, _coproc_interrupted))
+  {
+    _coproc_error("coreq", *coproc);
+    setExitStatus(1);
+    return;
+  }
+  std::cout << answer << "\n";
+}
+
+// * BuiltInCommand 31 (MemoCommand)
+
+MemoCommand::MemoCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line),
+      m_stats(false),
+      m_content(false),
+      m_inputs(),
+      m_command_line(),
+      m_command(nullptr)
+{
+  if (getName() != "memo")
+  {
+    throw std::logic_error("wrong name");
+  }
+  const std::vector<std::string> &args = getArgs();
+  if (args.size() == 1 && args[0] == "stats")
+  {
+    m_stats = true;
+    return;
+  }
+  size_t i = 0;
+  bool valid = true;
+  while (valid && i < args.size() && args[i][0] == '-')
+  {
+    const std::string &arg = args[i++];
+    if (arg == "--")
+    {
+      break;
+    }
+    if (arg == "-c")
+    {
+      m_content = true;
+    }
+    else if (arg == "--inputs")
+    {
+      // the files go on until the -- before the command
+      while (i < args.size() && args[i] != "--")
+      {
+        m_inputs.push_back(args[i++]);
+      }
+      valid = i < args.size() && !m_inputs.empty();
+      i++;
+      break;
+    }
+    else
+    {
+      valid = false;
+    }
+  }
+  if (!valid || i >= args.size())
+  {
+    std::cerr << "smash error: memo: invalid arguments\n";
+    throw std::logic_error("MemoCommand::MemoCommand");
+  }
+  for (; i < args.size(); i++)
+  {
+    m_command_line += (m_command_line.empty() ? "" : " ") + getLineArgs()[i];
+  }
+  // the line of memo was already expanded, its key is the line the command runs
+  m_command = SmallShell::getInstance().CreateCommand(m_command_line.c_str(), true);
+  if (m_command == nullptr)
+  {
+    throw std::logic_error("MemoCommand::MemoCommand");
+  }
+  if (!m_command->isExternal())
+  {
+    delete m_command;
+    std::cerr << "smash error: memo: invalid arguments\n";
+    throw std::logic_error("MemoCommand::MemoCommand");
+  }
+}
+
+MemoCommand::~MemoCommand()
+{
+  delete m_command;
+}
+
+bool MemoCommand::_key(std::string &key)
+{
+  static const char *const VARIABLES[] = {"PATH", "LANG", "LC_ALL", "LC_COLLATE", "LC_CTYPE", "LC_MESSAGES",
+                                          "LC_NUMERIC", "LC_TIME", "TZ"};
+  const Environment &environment = SmallShell::getInstance().getEnvironment();
+  // every part is on a line of its own and a line of the command can not be one of the others
+  key = "command " + m_command_line + "\n";
+  char *cwd = getcwd(nullptr, 0);
+  key += "cwd " + std::string(cwd != nullptr ? cwd : "") + "\n";
+  free(cwd);
+  std::string value;
+  for (const char *name : VARIABLES)
+  {
+    if (environment.get(name, value))
+    {
+      key += "env " + std::string(name) + "=" + value + "\n";
+    }
+  }
+  for (const std::string &input : m_inputs)
+  {
+    struct stat status;
+    if (stat(input.c_str(), &status) == -1)
+    {
+      std::cerr << "smash error: memo: " << input << ": " << strerror(errno) << "\n";
+      return false;
+    }
+    key += "input " + input + " " + std::to_string(status.st_dev) + ":" + std::to_string(status.st_ino) + " " +
+           std::to_string(status.st_size) + " " + std::to_string(status.st_mtim.tv_sec) + "." +
+           std::to_string(status.st_mtim.tv_nsec);
+    if (m_content)
+    {
+      int fd = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+      {
+        std::cerr << "smash error: memo: " << input << ": " << strerror(errno) << "\n";
+        return false;
+      }
+      MemoCache::Hasher hasher;
+      char buffer[64 * 1024];
+      ssize_t count;
+      while ((count = read(fd, buffer, sizeof(buffer))) > 0 || (count == -1 && errno == EINTR))
+      {
+        hasher.update(buffer, std::max(count, (ssize_t)0));
+      }
+      int error = errno;
+      close(fd);
+      if (count == -1)
+      {
+        std::cerr << "smash error: memo: " << input << ": " << strerror(error) << "\n";
+        return false;
+      }
+      key += " " + hasher.hex();
+    }
+    key += "\n";
+  }
+  return true;
+}
+
+void MemoCommand::_run_captured(int out_fd, int err_fd)
+{
+  std::cout.flush();
+  std::cerr.flush();
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_err = dup(STDERR_FILENO);
+  if (saved_out == -1 || saved_err == -1 || dup2(out_fd, STDOUT_FILENO) == -1 || dup2(err_fd, STDERR_FILENO) == -1)
+  {
+    perror("smash error: dup2 failed");
+    if (saved_out != -1)
+    {
+      dup2(saved_out, STDOUT_FILENO);
+      close(saved_out);
+    }
+    if (saved_err != -1)
+    {
+      dup2(saved_err, STDERR_FILENO);
+      close(saved_err);
+    }
+    m_command->setExitStatus(1);
+    return;
+  }
+  try
+  {
+    m_command->execute();
+  }
+  catch (const std::exception &e)
+  {
+    m_command->setExitStatus(1);
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+}
+
+void MemoCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  std::string directory;
+  unsigned long long max_bytes = 0;
+  if (!_memo_settings(smash.getEnvironment(), directory, max_bytes))
+  {
+    std::cerr << "smash error: memo: there is no cache directory, set SMASH_MEMO_DIR\n";
+    setExitStatus(1);
+    return;
+  }
+  MemoCache cache(directory, max_bytes);
+  if (m_stats)
+  {
+    MemoCache::Stats stats;
+    if (!cache.stats(&stats))
+    {
+      perror("smash error: memo failed");
+      setExitStatus(1);
+      return;
+    }
+    unsigned long long runs = stats.hits + stats.misses;
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(1) << (runs ? 100.0 * stats.hits / runs : 0.0) << "%";
+    std::ostringstream saved;
+    saved << std::fixed << std::setprecision(3) << stats.saved_ms / 1000.0 << "s";
+    std::cout << "hits: " << stats.hits << "\nmisses: " << stats.misses << "\nhit rate: " << rate.str()
+              << "\ntime saved: " << saved.str() << "\nentries: " << stats.entries << " (" << stats.bytes
+              << " bytes)\n";
+    return;
+  }
+
+  std::string key;
+  if (!_key(key))
+  {
+    setExitStatus(1);
+    return;
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  int status = 0;
+  long long elapsed_ms = 0;
+  long long start_ms = _monotonic_ms();
+  if (cache.replay(key, STDOUT_FILENO, STDERR_FILENO, &status, &elapsed_ms))
+  {
+    cache.count(true, elapsed_ms - (_monotonic_ms() - start_ms));
+    setExitStatus(status);
+    return;
+  }
+
+  // a miss: the outputs go to memfds, they are printed once the command is done and then kept
+  int out_fd = memfd_create("smash-memo-stdout", MFD_CLOEXEC);
+  int err_fd = memfd_create("smash-memo-stderr", MFD_CLOEXEC);
+  if (out_fd == -1 || err_fd == -1)
+  {
+    perror("smash error: memfd_create failed");
+    if (out_fd != -1)
+    {
+      close(out_fd);
+    }
+    setExitStatus(1);
+    return;
+  }
+  smash.setInterrupted(false);
+  start_ms = _monotonic_ms();
+  _run_captured(out_fd, err_fd);
+  elapsed_ms = _monotonic_ms() - start_ms;
+  status = m_command->getExitStatus();
+  struct stat out_status, err_status;
+  if (fstat(out_fd, &out_status) == 0 && fstat(err_fd, &err_status) == 0)
+  {
+    MemoCache::copy(out_fd, 0, out_status.st_size, STDOUT_FILENO);
+    MemoCache::copy(err_fd, 0, err_status.st_size, STDERR_FILENO);
+  }
+  // an interrupted run did not print what a whole run prints
+  if (!smash.wasInterrupted() && status < 128 && !cache.store(key, status, elapsed_ms, out_fd, err_fd))
+  {
+    perror("smash error: memo failed");
+  }
+  cache.count(false, 0);
+  close(out_fd);
+  close(err_fd);
+  setExitStatus(status);
+}
+
+// * BuiltInCommand 11 (ExportCommand)
+
+ExportCommand::ExportCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "export")
+  {
+    throw std::logic_error("wrong name");
+  }
+  for (const std::string &arg : getArgs())
+  {
+    if (!_is_valid_name(arg.substr(0, arg.find('='))))
+    {
+      std::cerr << "smash error: export: `" << arg << "': not a valid identifier\n";
+      throw std::logic_error("ExportCommand::ExportCommand");
+    }
+  }
+}
+
+ExportCommand::~ExportCommand()
+{
+  // default
+}
+
+void ExportCommand::execute()
+{
+  Environment &environment = SmallShell::getInstance().getEnvironment();
+  if (getArgs().empty())
+  {
+    environment.printExported();
+    return;
+  }
+  for (const std::string &arg : getArgs())
+  {
+    size_t equal = arg.find('=');
+    if (equal != std::string::npos)
+    {
+      environment.set(arg.substr(0, equal), arg.substr(equal + 1));
+    }
+    environment.setExported(arg.substr(0, equal));
+  }
+}
+
+// * BuiltInCommand 12 (UnsetCommand)
+
+UnsetCommand::UnsetCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (getName() != "unset")
+  {
+    throw std::logic_error("wrong name");
+  }
+  for (const std::string &arg : getArgs())
+  {
+    if (!_is_valid_name(arg))
+    {
+      std::cerr << "smash error: unset: `" << arg << "': not a valid identifier\n";
+      throw std::logic_error("UnsetCommand::UnsetCommand");
+    }
+  }
+}
+
+UnsetCommand::~UnsetCommand()
+{
+  // default
+}
+
+void UnsetCommand::execute()
+{
+  for (const std::string &arg : getArgs())
+  {
+    SmallShell::getInstance().getEnvironment().unset(arg);
+  }
+}
+
+// * BuiltInCommand 13 (AssignmentCommand)
+
+AssignmentCommand::AssignmentCommand(const char *cmd_line)
+    : BuiltInCommand(cmd_line)
+{
+  if (!_is_assignment(getName()))
+  {
+    throw std::logic_error("wrong name");
+  }
+  for (const std::string &arg : getArgs())
+  {
+    if (!_is_assignment(arg))
+    {
+      throw std::logic_error("wrong name"); // `NAME=value cmd`, not only assignments
+    }
+  }
+}
+
+AssignmentCommand::~AssignmentCommand()
+{
+  // default
+}
+
+void AssignmentCommand::execute()
+{
+  Environment &environment = SmallShell::getInstance().getEnvironment();
+  std::vector<std::string> words(1, getName());
+  words.insert(words.end(), getArgs().begin(), getArgs().end());
+  for (const std::string &word : words)
+  {
+    size_t equal = word.find('=');
+    environment.set(word.substr(0, equal), word.substr(equal + 1));
+  }
+}
+
+/* *
+ * The OutputRing class
+ */
+
+OutputRing::OutputRing(size_t capacity)
+    : m_data(),
+      m_capacity(capacity),
+      m_written(0)
+{
+}
+
+void OutputRing::append(const char *data, size_t size)
+{
+  // keeps only the last m_capacity bytes, byte n of the output is at n % m_capacity
+  if (size > m_capacity)
+  {
+    m_written += size - m_capacity;
+    data += size - m_capacity;
+    size = m_capacity;
+  }
+  while (size > 0)
+  {
+    size_t position = m_written % m_capacity;
+    size_t chunk = std::min(size, m_capacity - position);
+    if (m_data.size() < position + chunk) // grows until the first wrap
+    {
+      m_data.resize(position + chunk);
+    }
+    memcpy(m_data.data() + position, data, chunk);
+    m_written += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+std::string OutputRing::since(unsigned long long offset) const
+{
+  unsigned long long first = (m_written > m_capacity) ? m_written - m_capacity : 0;
+  offset = std::max(offset, first);
+  std::string data;
+  data.reserve(m_written - offset);
+  while (offset < m_written)
+  {
+    size_t position = offset % m_capacity;
+    size_t chunk = std::min((unsigned long long)(m_capacity - position), m_written - offset);
+    data.append(m_data.data() + position, chunk);
+    offset += chunk;
+  }
+  return data;
+}
+
+/* *
+ * The JobsList class
+ */
+
+/* The JobEntry class methods */
+JobsList::JobEntry::JobEntry(const std::string &cmd, pid_t pgid, const std::vector<Member> &members, int job_id)
+    : m_command(cmd),
+      m_job_pid(pgid),
+      m_members(members),
+      m_last_member(members.back().pid),
+      m_status(0),
+      m_job_id(job_id),
+      m_start_ms(_monotonic_ms()),
+      m_queued(),
+      m_stopped(false),
+      m_adopted(false)
+{
+}
+
+JobsList::JobEntry::JobEntry(const std::string &cmd, const Queued &queued, int job_id)
+    : m_command(cmd),
+      m_job_pid(0),
+      m_members(),
+      m_last_member(-1),
+      m_status(0),
+      m_job_id(job_id),
+      m_start_ms(_monotonic_ms()),
+      m_queued(queued),
+      m_stopped(false),
+      m_adopted(false)
+{
+}
+
+JobsList::JobEntry::~JobEntry()
+{
+  // the pidfds are closed by JobsList, a JobEntry is copied around inside the vector
+}
+
+const std::string &JobsList::JobEntry::getCMDLine()
+{
+  return m_command;
+}
+
+pid_t JobsList::JobEntry::getJobPid()
+{
+  return m_job_pid;
+}
+
+int JobsList::JobEntry::getJobID()
+{
+  return m_job_id;
+}
+
+pid_t JobsList::JobEntry::getPgid()
+{
+  return m_job_pid;
+}
+
+const std::vector<JobsList::JobEntry::Member> &JobsList::JobEntry::getMembers()
+{
+  return m_members;
+}
+
+bool JobsList::JobEntry::hasUntrackedMembers()
+{
+  for (const Member &member : m_members)
+  {
+    if (member.pidfd == -1)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool JobsList::JobEntry::reapMembers()
+{
+  for (std::vector<Member>::iterator it = m_members.begin(); it != m_members.end();)
+  {
+    // TODO what happens when its zombie?
+    int wstatus = 0;
+    pid_t res = waitpid(it->pid, &wstatus, WNOHANG);
+    if (res == -1 || res == it->pid)
+    {
+      if (res == it->pid && it->pid == m_last_member)
+      {
+        m_status = _status_from_wait(wstatus);
+      }
+      if (it->pidfd != -1)
+      {
+        close(it->pidfd);
+      }
+      it = m_members.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  return m_members.empty();
+}
+
+bool JobsList::JobEntry::reapMember(pid_t pid)
+{
+  std::vector<Member>::iterator it = m_members.begin();
+  while (it != m_members.end() && it->pid != pid)
+  {
+    ++it;
+  }
+  if (it == m_members.end())
+  {
+    return m_members.empty();
+  }
+  int wstatus = 0;
+  pid_t res = waitpid(pid, &wstatus, WNOHANG);
+  if (res == 0) // did not exit after all (stopped)
+  {
+    return false;
+  }
+  if (res == pid && pid == m_last_member)
+  {
+    m_status = _status_from_wait(wstatus);
+  }
+  if (it->pidfd != -1)
+  {
+    close(it->pidfd);
+  }
+  m_members.erase(it);
+  return m_members.empty();
+}
+
+long long JobsList::JobEntry::getStartTime()
+{
+  return m_start_ms;
+}
+
+int JobsList::JobEntry::getStatus()
+{
+  return m_status;
+}
+
+int JobsList::JobEntry::sendSignal(int sig)
+{
+  // while the leader is alive its pidfd reaches the whole group in one call (linux 6.9)
+  bool sent = !m_members.empty() && m_members.front().pid == m_job_pid && m_members.front().pidfd != -1 &&
+              _pidfd_send_signal(m_members.front().pidfd, sig, PIDFD_SIGNAL_PROCESS_GROUP) == 0;
+  // the members are our unreaped sons and a group is not reused while any of them is left, so one killpg reaches
+  // them all. ESRCH: they already exited and wait to be reaped
+  if (!sent && !m_members.empty() && killpg(m_job_pid, sig) == -1 && errno != ESRCH)
+  {
+    return -1;
+  }
+  // smash only learns of a stop it caused, so it keeps the state the signal gave the job
+  if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU)
+  {
+    m_stopped = true;
+  }
+  else if (sig == SIGCONT)
+  {
+    m_stopped = false;
+  }
+  return 0;
+}
+
+void JobsList::JobEntry::releaseQueued()
+{
+  for (int &fd : m_queued.fds)
+  {
+    if (fd != -1)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  delete m_queued.command;
+  m_queued.command = nullptr;
+}
+
+void JobsList::JobEntry::closePidfds()
+{
+  for (Member &member : m_members)
+  {
+    if (member.pidfd != -1)
+    {
+      close(member.pidfd);
+      member.pidfd = -1;
+    }
+  }
+}
+
+/* The JobList class methods */
+
+// the epoll data of the admission timer in the exit events set, job ids start at 1
+static const uint64_t ADMISSION_EVENT = 0;
+
+int JobsList::size() const
+{
+  return m_jobs.size();
+}
+
+JobsList::JobsList()
+    : m_exit_events_fd(epoll_create1(EPOLL_CLOEXEC)),
+      m_untracked(),
+      m_admission(),
+      m_queue(),
+      m_queue_order(0),
+      m_starting_job_id(0),
+      m_admission_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_admission_timer_armed(false),
+      m_capture(false),
+      m_logs(),
+      m_open_logs(0),
+      m_capture_fd(-1),
+      m_saved_fds{-1, -1},
+      m_journal(),
+      m_owner_pid(getpid())
+{
+  if (m_exit_events_fd == -1)
+  {
+    perror("smash error: epoll_create1 failed");
+  }
+  if (m_exit_events_fd != -1 && m_admission_timer_fd != -1)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = ADMISSION_EVENT;
+    epoll_ctl(m_exit_events_fd, EPOLL_CTL_ADD, m_admission_timer_fd, &event);
+  }
+}
+
+JobsList::~JobsList()
+{
+  for (std::pair<const int, JobEntry> &entry : m_jobs)
+  {
+    entry.second.closePidfds();
+    if (entry.second.isQueued())
+    {
+      entry.second.releaseQueued();
+    }
+  }
+  if (m_exit_events_fd != -1)
+  {
+    close(m_exit_events_fd);
+  }
+  if (m_admission_timer_fd != -1)
+  {
+    close(m_admission_timer_fd);
+  }
+  for (std::pair<const int, Log> &entry : m_logs)
+  {
+    closeLog(entry.second);
+  }
+}
+
+// assumes a valid command
+void JobsList::addJob(Command *cmd, pid_t pid)
+{
+  addJob(cmd, pid, std::vector<pid_t>(1, pid));
+}
+
+void JobsList::addJob(Command *cmd, pid_t pgid, const std::vector<pid_t> &members)
+{
+  if (cmd)
+  {
+    addJob(_unmark_literal(cmd->getCMDLine()), pgid, members);
+  }
+}
+
+int JobsList::addJob(const std::string &cmd_line, pid_t pgid, const std::vector<pid_t> &members, int job_id)
+{
+  bool returns = job_id != 0 && m_jobs.find(job_id) == m_jobs.end(); // a new id when it was taken meanwhile
+  if (!returns)
+  {
+    job_id = m_starting_job_id ? m_starting_job_id : (m_jobs.size() ? m_jobs.rbegin()->first + 1 : 1);
+    m_finished_statuses.erase(job_id); // the id is reused, the old status is not its status
+    std::map<int, Log>::iterator old_log = m_logs.find(job_id); // and the old log is not its log
+    if (old_log != m_logs.end())
+    {
+      closeLog(old_log->second);
+      m_logs.erase(old_log);
+    }
+  }
+  if (m_capture_fd != -1)
+  {
+    Log log = {OutputRing(LOG_SIZE), m_capture_fd, 0};
+    m_capture_fd = -1;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)job_id << 32; // pid 0: the pipe of the log and not a member
+    if (m_exit_events_fd != -1)
+    {
+      epoll_ctl(m_exit_events_fd, EPOLL_CTL_ADD, log.fd, &event);
+    }
+    m_logs.insert(std::make_pair(job_id, log));
+    m_open_logs++;
+  }
+
+  // the members are our unreaped sons, so their pids can not be reused before we open the pidfds
+  std::vector<JobEntry::Member> tracked;
+  for (pid_t pid : members)
+  {
+    JobEntry::Member member = {pid, _pidfd_open(pid)};
+    watchMember(job_id, member);
+    tracked.push_back(member);
+  }
+  m_jobs.insert(std::make_pair(job_id, JobEntry(cmd_line, pgid, tracked, job_id)));
+  m_journal.record(job_id, pgid, members, cmd_line);
+  return job_id;
+}
+
+bool JobsList::openJournal(const std::string &base, std::vector<int> &adopted)
+{
+  std::vector<JobJournal::Record> records;
+  if (!m_journal.open(base, &records))
+  {
+    return false;
+  }
+  for (const JobJournal::Record &record : records)
+  {
+    if (m_jobs.find(record.job_id) != m_jobs.end())
+    {
+      continue;
+    }
+    std::vector<JobEntry::Member> members;
+    std::vector<pid_t> pids;
+    for (const JobJournal::Member &recorded : record.members)
+    {
+      // the pidfd holds the process it was opened for, so the start time read after it is the start time of that
+      // process. another one that got the pid since then starts later
+      JobEntry::Member member = {recorded.pid, _pidfd_open(recorded.pid)};
+      unsigned long long ticks = 0;
+      if (member.pidfd != -1 && JobJournal::startTicks(recorded.pid, &ticks) && ticks == recorded.start_ticks)
+      {
+        members.push_back(member);
+        pids.push_back(member.pid);
+      }
+      else if (member.pidfd != -1)
+      {
+        close(member.pidfd);
+      }
+    }
+    if (members.empty()) // it finished while no smash was there
+    {
+      continue;
+    }
+    for (const JobEntry::Member &member : members)
+    {
+      watchMember(record.job_id, member);
+    }
+    JobEntry &job = m_jobs.insert(std::make_pair(record.job_id, JobEntry(record.command, record.pgid, members,
+                                                                          record.job_id))).first->second;
+    job.setAdopted(true);
+    m_journal.record(record.job_id, record.pgid, pids, record.command);
+    adopted.push_back(record.job_id);
+  }
+  return true;
+}
+
+void JobsList::printJobsList()
+{
+  for (std::pair<const int, JobEntry> &entry : m_jobs)
+  {
+    const char *state = entry.second.isQueued() ? " (queued)" : (entry.second.isStopped() ? " (stopped)" : "");
+    std::cout << "[" << entry.first << "] " << entry.second.getCMDLine() << state << "\n";
+  }
+}
+
+void JobsList::killAllJobs()
+{
+  signalAllJobs(SIGKILL);
+  // SIGKILL can not be handled, so every member exits and a smash that keeps running (a daemon) is left without zombies
+  waitAllJobs(-1);
+  while (!m_jobs.empty()) // the wait failed
+  {
+    eraseJob(m_jobs.begin());
+  }
+  m_untracked.clear();
+  m_queue.clear();
+  updateAdmissionTimer();
+  for (std::pair<const int, Log> &entry : m_logs)
+  {
+    closeLog(entry.second);
+  }
+  m_logs.clear();
+}
+
+void JobsList::signalAllJobs(int sig)
+{
+  std::map<int, JobEntry>::iterator it = m_jobs.begin();
+  while (it != m_jobs.end())
+  {
+    JobEntry &job = it->second;
+    if (job.isQueued()) // never started, there is nothing to signal
+    {
+      eraseJob(it++);
+      continue;
+    }
+    std::cout << job.getJobPid() << ": " << job.getCMDLine() << "\n";
+    if (job.sendSignal(sig) != 0) // failure
+    {
+      perror("smash error: kill failed");
+    }
+    else if (sig != SIGKILL && sig != SIGCONT && job.isStopped())
+    {
+      job.sendSignal(SIGCONT); // a stopped job gets the signal once it runs again
+    }
+    ++it;
+  }
+}
+
+size_t JobsList::waitAllJobs(long long deadline_ms)
+{
+  while (!m_jobs.empty())
+  {
+    if (deadline_ms != -1 && _monotonic_ms() >= deadline_ms)
+    {
+      break;
+    }
+    if (!waitForExits(deadline_ms) && errno != EINTR)
+    {
+      break;
+    }
+  }
+  return m_jobs.size();
+}
+
+bool JobsList::waitForExits(long long deadline_ms)
+{
+  long long now_ms = _monotonic_ms();
+  int timeout = (deadline_ms == -1) ? -1 : (int)std::max(0LL, std::min(deadline_ms - now_ms, (long long)INT_MAX));
+  // a member without a pidfd is only found by waitid, it is looked for every 10 ms
+  if ((!m_untracked.empty() || m_exit_events_fd == -1) && (timeout == -1 || timeout > 10))
+  {
+    timeout = 10;
+  }
+  // the pidfds of all the members are in the exit events set, one poll waits for any of them
+  struct pollfd exits = {m_exit_events_fd, POLLIN, 0};
+  int ready = poll(&exits, (m_exit_events_fd == -1) ? 0 : 1, timeout);
+  int saved_errno = errno;
+  if (ready == -1 && errno != EINTR)
+  {
+    perror("smash error: poll failed");
+  }
+  removeFinishedJobs();
+  errno = saved_errno;
+  return ready != -1;
+}
+
+void JobsList::removeFinishedJobs()
+{
+  // only the members whose pidfd reported an exit are reaped, the others are not touched
+  if (m_exit_events_fd != -1)
+  {
+    struct epoll_event events[64];
+    int count = 0;
+    do
+    {
+      count = epoll_wait(m_exit_events_fd, events, 64, 0);
+      for (int i = 0; i < count; i++)
+      {
+        if (events[i].data.u64 == ADMISSION_EVENT)
+        {
+          uint64_t expirations = 0;
+          (void)!read(m_admission_timer_fd, &expirations, sizeof(expirations));
+          continue;
+        }
+        if ((events[i].data.u64 & 0xffffffff) == 0)
+        {
+          drainLog(events[i].data.u64 >> 32);
+          continue;
+        }
+        reapMember(events[i].data.u64 >> 32, (pid_t)(events[i].data.u64 & 0xffffffff));
+      }
+    } while (count == 64);
+  }
+
+  if (!m_untracked.empty())
+  {
+    reapUntrackedMembers();
+  }
+  // the jobs that finished made room for the queued ones
+  if (!m_queue.empty())
+  {
+    admitQueuedJobs();
+  }
+  // the epoll set is shared with the sons, one that dropped a log would take it out of the set of smash too
+  if (!m_logs.empty() && isOwner())
+  {
+    dropLogs(false);
+  }
+
+  while (m_finished_statuses.size() > MAX_FINISHED_STATUSES)
+  {
+    m_finished_statuses.erase(m_finished_statuses.begin());
+  }
+}
+
+bool JobsList::reapMember(int jobId, pid_t pid)
+{
+  Tracer::Span span("reap", "jobs");
+  std::map<int, JobEntry>::iterator it = m_jobs.find(jobId);
+  if (it == m_jobs.end() || !it->second.reapMember(pid))
+  {
+    return false;
+  }
+  // the last member is gone, remember its status for `wait`
+  m_finished_statuses[jobId] = it->second.getStatus();
+  eraseJob(it);
+  return true;
+}
+
+void JobsList::reapUntrackedMembers()
+{
+  // waitid peeks at an exited son without reaping it, one of ours is reaped through its job.
+  // every member is looked up once at most, so a member that was not reaped can not loop forever
+  bool poll_all = false;
+  for (size_t peeks = m_untracked.size(); peeks > 0 && !m_untracked.empty(); peeks--)
+  {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0)
+    {
+      return; // no son exited
+    }
+    std::map<pid_t, int>::iterator it = m_untracked.find(info.si_pid);
+    if (it == m_untracked.end())
+    {
+      // an exited son that is not an untracked member (of another session of the daemon) hides the others
+      poll_all = true;
+      break;
+    }
+    int job_id = it->second;
+    m_untracked.erase(it);
+    reapMember(job_id, info.si_pid);
+  }
+  if (!poll_all)
+  {
+    return;
+  }
+
+  for (std::map<int, JobEntry>::iterator it = m_jobs.begin(); it != m_jobs.end();)
+  {
+    JobEntry &job = it->second;
+    // a job is finished only when every member of its process group has finished
+    if (job.hasUntrackedMembers() && job.reapMembers())
+    {
+      m_finished_statuses[job.getJobID()] = job.getStatus();
+      std::map<int, JobEntry>::iterator finished = it++;
+      eraseJob(finished);
+      continue;
+    }
+    ++it;
+  }
+}
+
+void JobsList::watchMember(int job_id, const JobEntry::Member &member)
+{
+  if (member.pidfd != -1 && m_exit_events_fd != -1)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)job_id << 32) | (uint32_t)member.pid;
+    epoll_ctl(m_exit_events_fd, EPOLL_CTL_ADD, member.pidfd, &event);
+  }
+  else
+  {
+    m_untracked[member.pid] = job_id; // no pidfds (too many open files?), removeFinishedJobs looks for it
+  }
+}
+
+void JobsList::eraseJob(std::map<int, JobEntry>::iterator it)
+{
+  std::map<int, Log>::iterator log = m_logs.find(it->first);
+  if (log != m_logs.end() && log->second.finished_ms == 0)
+  {
+    log->second.finished_ms = _monotonic_ms(); // kept for a while to be looked at
+  }
+  if (it->second.isQueued())
+  {
+    const JobEntry::Queued &queued = it->second.getQueued();
+    m_queue.erase(std::make_tuple(-queued.priority, queued.order, it->first));
+    it->second.releaseQueued();
+    updateAdmissionTimer();
+  }
+  for (const JobEntry::Member &member : it->second.getMembers())
+  {
+    if (member.pidfd == -1)
+    {
+      m_untracked.erase(member.pid);
+    }
+  }
+  it->second.closePidfds();
+  m_journal.erase(it->first);
+  m_jobs.erase(it);
+}
+
+bool JobsList::getFinishedStatus(int jobId, int *status) const
+{
+  std::map<int, int>::const_iterator it = m_finished_statuses.find(jobId);
+  if (it == m_finished_statuses.end())
+  {
+    return false;
+  }
+  *status = it->second;
+  return true;
+}
+
+JobsList::JobEntry *JobsList::getJobById(int jobId)
+{
+  std::map<int, JobEntry>::iterator it = m_jobs.find(jobId);
+  return (it != m_jobs.end()) ? &it->second : nullptr;
+}
+
+void JobsList::removeJobById(int jobId)
+{
+  std::map<int, JobEntry>::iterator it = m_jobs.find(jobId);
+  if (it != m_jobs.end())
+  {
+    eraseJob(it);
+  }
+}
+
+std::vector<int> JobsList::getJobIds() const
+{
+  std::vector<int> ids;
+  for (const std::pair<const int, JobEntry> &entry : m_jobs)
+  {
+    ids.push_back(entry.first);
+  }
+  return ids;
+}
+
+JobsList::JobEntry *JobsList::getLastJob()
+{
+  return m_jobs.size() ? &m_jobs.rbegin()->second : nullptr;
+}
+
+JobsList::JobEntry *JobsList::getLastStoppedJob()
+{
+  for (std::map<int, JobEntry>::reverse_iterator it = m_jobs.rbegin(); it != m_jobs.rend(); ++it)
+  {
+    if (it->second.isStopped())
+    {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+// * admission control
+
+void JobsList::setAdmission(const Admission &admission)
+{
+  m_admission = admission;
+  updateAdmissionTimer();
+  admitQueuedJobs(); // a higher limit lets the queued jobs start now
+}
+
+bool JobsList::admits()
+{
+  return m_queue.empty() && hasRoom();
+}
+
+bool JobsList::queueJob(Command *cmd, int priority)
+{
+  JobEntry::Queued queued = {cmd, {-1, -1, -1, -1}, priority, m_queue_order++};
+  bool opened = true;
+  for (int i = 0; i < 3; i++)
+  {
+    queued.fds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    opened = opened && queued.fds[i] != -1;
+  }
+  queued.fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (!opened || queued.fds[3] == -1) // no fds left, it is started right away instead
+  {
+    queued.command = nullptr;
+    for (int fd : queued.fds)
+    {
+      if (fd != -1)
+      {
+        close(fd);
+      }
+    }
+    return false;
+  }
+
+  int job_id = m_jobs.size() ? m_jobs.rbegin()->first + 1 : 1;
+  m_finished_statuses.erase(job_id);
+  m_jobs.insert(std::make_pair(job_id, JobEntry(_unmark_literal(cmd->getCMDLine()), queued, job_id)));
+  m_queue.insert(std::make_tuple(-priority, queued.order, job_id));
+  updateAdmissionTimer();
+  return true;
+}
+
+void JobsList::admitQueuedJobs()
+{
+  if (!isOwner())
+  {
+    return;
+  }
+  // the pressure of a job shows up only after it ran for a while, so it lets one job start at a time
+  bool paced = m_admission.max_cpu_pressure > 0 || m_admission.max_memory_pressure > 0;
+  int started = 0;
+  while (!m_queue.empty() && !(paced && started > 0) && hasRoom())
+  {
+    startQueuedJob(std::get<2>(*m_queue.begin()));
+    started++;
+  }
+}
+
+bool JobsList::startQueuedJob(int jobId)
+{
+  std::map<int, JobEntry>::iterator it = m_jobs.find(jobId);
+  if (it == m_jobs.end() || !it->second.isQueued())
+  {
+    return false;
+  }
+  JobEntry job = it->second;
+  const JobEntry::Queued &queued = job.getQueued();
+  m_queue.erase(std::make_tuple(-queued.priority, queued.order, jobId));
+  m_jobs.erase(it); // addJob puts it back under the same id when it starts
+
+  // it runs with the stdin, stdout, stderr and the directory it was submitted with
+  std::cout.flush();
+  int saved[4];
+  for (int i = 0; i < 3; i++)
+  {
+    saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    dup2(queued.fds[i], i);
+  }
+  saved[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fchdir(queued.fds[3]) == -1)
+  {
+    perror("smash error: chdir failed");
+  }
+
+  m_starting_job_id = jobId;
+  bool captured = beginCapture();
+  try
+  {
+    queued.command->execute();
+  }
+  catch (const std::exception &e)
+  {
+    queued.command->setExitStatus(1);
+  }
+  if (captured)
+  {
+    endCapture();
+  }
+  m_starting_job_id = 0;
+  if (m_jobs.find(jobId) == m_jobs.end()) // it could not start
+  {
+    m_finished_statuses[jobId] = queued.command->getExitStatus() ? queued.command->getExitStatus() : 1;
+  }
+
+  std::cout.flush();
+  for (int i = 0; i < 3; i++)
+  {
+    if (saved[i] != -1)
+    {
+      dup2(saved[i], i);
+      close(saved[i]);
+    }
+  }
+  if (saved[3] != -1)
+  {
+    if (fchdir(saved[3]) == -1)
+    {
+      perror("smash error: chdir failed");
+    }
+    close(saved[3]);
+  }
+  job.releaseQueued();
+  updateAdmissionTimer();
+  return true;
+}
+
+bool JobsList::cancelQueuedJob(int jobId, int sig)
+{
+  std::map<int, JobEntry>::iterator it = m_jobs.find(jobId);
+  if (it == m_jobs.end() || !it->second.isQueued())
+  {
+    return false;
+  }
+  m_finished_statuses[jobId] = 128 + sig;
+  eraseJob(it);
+  return true;
+}
+
+double JobsList::readPressure(const char *resource)
+{
+  // "some avg10=1.23 avg60=... total=..." on the first line
+  int fd = open((std::string("/proc/pressure/") + resource).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    return -1;
+  }
+  char buffer[256];
+  ssize_t count = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  double avg10 = -1;
+  if (count <= 0)
+  {
+    return -1;
+  }
+  buffer[count] = '\0';
+  if (sscanf(buffer, "some avg10=%lf", &avg10) != 1)
+  {
+    return -1;
+  }
+  return avg10;
+}
+
+bool JobsList::hasRoom()
+{
+  if (m_admission.max_running && m_jobs.size() - m_queue.size() >= m_admission.max_running)
+  {
+    return false;
+  }
+  if (m_admission.max_cpu_pressure > 0 && readPressure("cpu") > m_admission.max_cpu_pressure)
+  {
+    return false;
+  }
+  if (m_admission.max_memory_pressure > 0 && readPressure("memory") > m_admission.max_memory_pressure)
+  {
+    return false;
+  }
+  return true;
+}
+
+void JobsList::updateAdmissionTimer()
+{
+  bool arm = !m_queue.empty() && (m_admission.max_cpu_pressure > 0 || m_admission.max_memory_pressure > 0);
+  if (m_admission_timer_fd == -1 || arm == m_admission_timer_armed)
+  {
+    return;
+  }
+  // avg10 is updated every 2 seconds, looking more often than every second finds nothing new
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_interval.tv_sec = arm ? 1 : 0;
+  timer.it_value.tv_sec = arm ? 1 : 0;
+  if (timerfd_settime(m_admission_timer_fd, 0, &timer, nullptr) == -1)
+  {
+    perror("smash error: timerfd_settime failed");
+  }
+  m_admission_timer_armed = arm;
+}
+
+// * output capture
+
+bool JobsList::beginCapture()
+{
+  if (!m_capture)
+  {
+    return false;
+  }
+  dropLogs(true);
+  if ((m_logs.size() + 1) * LOG_SIZE > LOGS_TOTAL) // every log belongs to a running job, this one is not captured
+  {
+    return false;
+  }
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("smash error: pipe failed");
+    return false;
+  }
+  // smash reads the pipe only when it has nothing else to do
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  std::cout.flush();
+  std::cerr.flush();
+  m_saved_fds[0] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  m_saved_fds[1] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+  dup2(fds[1], STDOUT_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  close(fds[1]);
+  m_capture_fd = fds[0];
+  return true;
+}
+
+void JobsList::endCapture()
+{
+  std::cout.flush();
+  std::cerr.flush();
+  for (int i = 0; i < 2; i++)
+  {
+    if (m_saved_fds[i] != -1)
+    {
+      dup2(m_saved_fds[i], STDOUT_FILENO + i);
+      close(m_saved_fds[i]);
+      m_saved_fds[i] = -1;
+    }
+  }
+  if (m_capture_fd != -1) // no job was added (the fork failed)
+  {
+    close(m_capture_fd);
+    m_capture_fd = -1;
+  }
+}
+
+const OutputRing *JobsList::getLog(int jobId) const
+{
+  std::map<int, Log>::const_iterator it = m_logs.find(jobId);
+  return (it != m_logs.end()) ? &it->second.ring : nullptr;
+}
+
+int JobsList::getLogFd(int jobId) const
+{
+  std::map<int, Log>::const_iterator it = m_logs.find(jobId);
+  return (it != m_logs.end()) ? it->second.fd : -1;
+}
+
+void JobsList::drainLog(int jobId)
+{
+  std::map<int, Log>::iterator it = m_logs.find(jobId);
+  if (!isOwner() || it == m_logs.end() || it->second.fd == -1)
+  {
+    return;
+  }
+  Log &log = it->second;
+  // a bounded number of reads, a job that writes without a pause does not keep smash here
+  char buffer[16384];
+  for (int reads = 0; reads < 64; reads++)
+  {
+    ssize_t count = read(log.fd, buffer, sizeof(buffer));
+    if (count > 0)
+    {
+      log.ring.append(buffer, count);
+      continue;
+    }
+    if (count == 0 || (errno != EAGAIN && errno != EINTR)) // every writer closed it
+    {
+      closeLog(log);
+    }
+    return;
+  }
+}
+
+void JobsList::closeLog(Log &log)
+{
+  if (log.fd != -1)
+  {
+    if (m_exit_events_fd != -1)
+    {
+      epoll_ctl(m_exit_events_fd, EPOLL_CTL_DEL, log.fd, nullptr);
+    }
+    close(log.fd);
+    log.fd = -1;
+    m_open_logs--;
+  }
+}
+
+void JobsList::dropLogs(bool make_room)
+{
+  long long now = _monotonic_ms();
+  std::map<int, Log>::iterator oldest = m_logs.end();
+  for (std::map<int, Log>::iterator it = m_logs.begin(); it != m_logs.end();)
+  {
+    long long finished = it->second.finished_ms;
+    if (finished != 0 && now - finished > LOG_KEEP_MS)
+    {
+      closeLog(it->second);
+      it = m_logs.erase(it);
+      continue;
+    }
+    if (finished != 0 && (oldest == m_logs.end() || finished < oldest->second.finished_ms))
+    {
+      oldest = it;
+    }
+    ++it;
+  }
+  // a new log needs room, the one of the job that finished first goes (one per job that starts is enough)
+  if (make_room && (m_logs.size() + 1) * LOG_SIZE > LOGS_TOTAL && oldest != m_logs.end())
+  {
+    closeLog(oldest->second);
+    m_logs.erase(oldest);
+  }
+}
+
+/* *
+ * The Environment class
+ */
+
+Environment::Environment()
+    : m_variables(),
+      m_envp(),
+      m_envp_changed(true)
+{
+  for (char **entry = environ; entry && *entry; entry++)
+  {
+    std::string variable(*entry);
+    size_t equal = variable.find('=');
+    if (equal != std::string::npos)
+    {
+      Variable imported = {variable, true, true};
+      m_variables[variable.substr(0, equal)] = imported;
+    }
+  }
+}
+
+Environment::~Environment()
+{
+  // default
+}
+
+bool Environment::get(const std::string &name, std::string &value) const
+{
+  std::map<std::string, Variable>::const_iterator it = m_variables.find(name);
+  if (it == m_variables.end() || !it->second.assigned)
+  {
+    return false;
+  }
+  value = it->second.entry.substr(name.size() + 1); // the entry holds "NAME=value"
+  return true;
+}
+
+void Environment::set(const std::string &name, const std::string &value)
+{
+  Variable &variable = m_variables[name]; // a new variable is not exported
+  variable.entry = name + "=" + value;
+  variable.assigned = true;
+  if (variable.exported)
+  {
+    m_envp_changed = true;
+  }
+}
+
+void Environment::setExported(const std::string &name)
+{
+  std::map<std::string, Variable>::iterator it = m_variables.find(name);
+  if (it == m_variables.end())
+  {
+    // `export NAME` of a variable that was not set exports it once it gets a value, till then it is only marked
+    Variable variable = {name + "=", true, false};
+    m_variables.insert(std::make_pair(name, variable));
+    return;
+  }
+  it->second.exported = true;
+  m_envp_changed = true;
+}
+
+void Environment::unset(const std::string &name)
+{
+  std::map<std::string, Variable>::iterator it = m_variables.find(name);
+  if (it != m_variables.end())
+  {
+    m_envp_changed = m_envp_changed || it->second.exported;
+    m_variables.erase(it);
+  }
+}
+
+void Environment::printExported() const
+{
+  for (const std::pair<const std::string, Variable> &variable : m_variables)
+  {
+    if (variable.second.exported && !variable.second.assigned)
+    {
+      std::cout << "export " << variable.first << "\n";
+    }
+    else if (variable.second.exported)
+    {
+      std::cout << "export " << variable.first << "=\"" << variable.second.entry.substr(variable.first.size() + 1)
+                << "\"\n";
+    }
+  }
+}
+
+char **Environment::envp()
+{
+  if (m_envp_changed)
+  {
+    m_envp.clear();
+    for (std::pair<const std::string, Variable> &variable : m_variables)
+    {
+      if (variable.second.exported && variable.second.assigned)
+      {
+        m_envp.push_back(&variable.second.entry[0]);
+      }
+    }
+    m_envp.push_back(nullptr);
+    m_envp_changed = false;
+  }
+  return m_envp.data();
+}
+
+std::vector<char *> Environment::envp(const std::vector<std::string> &overrides)
+{
+  std::vector<char *> block;
+  for (const std::string &entry : overrides)
+  {
+    block.push_back(const_cast<char *>(entry.c_str()));
+  }
+  // the cached block is sorted by name, skip the names that were overridden
+  for (char **entry = envp(); *entry; entry++)
+  {
+    bool overridden = false;
+    for (const std::string &override : overrides)
+    {
+      size_t length = override.find('=') + 1; // including the '='
+      if (strncmp(*entry, override.c_str(), length) == 0)
+      {
+        overridden = true;
+        break;
+      }
+    }
+    if (!overridden)
+    {
+      block.push_back(*entry);
+    }
+  }
+  block.push_back(nullptr);
+  return block;
+}
+
+/* *
+ * The Scheduler class
+ */
+
+Scheduler::Scheduler()
+    : m_heap(),
+      m_positions(),
+      m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_next_id(1),
+      m_armed_ms(-1)
+{
+  if (m_timer_fd == -1)
+  {
+    perror("smash error: timerfd_create failed");
+  }
+}
+
+Scheduler::~Scheduler()
+{
+  if (m_timer_fd != -1)
+  {
+    close(m_timer_fd);
+  }
+}
+
+int Scheduler::add(const std::string &command, long long next_ms, long long interval_ms, bool overlap)
+{
+  Entry entry = {m_next_id++, command, next_ms, interval_ms, overlap, 0, 0};
+  m_heap.push_back(entry);
+  m_positions[entry.id] = m_heap.size() - 1;
+  siftUp(m_heap.size() - 1);
+  arm();
+  return entry.id;
+}
+
+bool Scheduler::remove(int id)
+{
+  std::map<int, size_t>::iterator it = m_positions.find(id);
+  if (it == m_positions.end())
+  {
+    return false;
+  }
+  removeAt(it->second);
+  arm();
+  return true;
+}
+
+std::vector<Scheduler::Entry> Scheduler::takeDue(long long now_ms)
+{
+  std::vector<Entry> due;
+  while (!m_heap.empty() && m_heap[0].next_ms <= now_ms)
+  {
+    due.push_back(m_heap[0]);
+    if (m_heap[0].interval_ms)
+    {
+      // the runs that were missed (smash was busy with a foreground command) are not made up for
+      long long interval = m_heap[0].interval_ms;
+      m_heap[0].next_ms += ((now_ms - m_heap[0].next_ms) / interval + 1) * interval;
+      siftDown(0);
+    }
+    else
+    {
+      removeAt(0);
+    }
+  }
+  if (!due.empty())
+  {
+    // the expirations are not needed, only the readability is cleared
+    uint64_t expirations = 0;
+    if (m_timer_fd != -1 && read(m_timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+    {
+      perror("smash error: read failed");
+    }
+    m_armed_ms = -1;
+    arm();
+  }
+  return due;
+}
+
+void Scheduler::setLastJob(int id, int job_id, pid_t job_pid)
+{
+  std::map<int, size_t>::iterator it = m_positions.find(id);
+  if (it != m_positions.end())
+  {
+    m_heap[it->second].last_job_id = job_id;
+    m_heap[it->second].last_job_pid = job_pid;
+  }
+}
+
+std::vector<Scheduler::Entry> Scheduler::getEntries() const
+{
+  std::vector<Entry> entries = m_heap;
+  std::sort(entries.begin(), entries.end(), earlier);
+  return entries;
+}
+
+// * Scheduler Private
+
+bool Scheduler::earlier(const Entry &a, const Entry &b)
+{
+  // entries due at the same time run in the order they were scheduled
+  return a.next_ms < b.next_ms || (a.next_ms == b.next_ms && a.id < b.id);
+}
+
+void Scheduler::swapEntries(size_t a, size_t b)
+{
+  std::swap(m_heap[a], m_heap[b]);
+  m_positions[m_heap[a].id] = a;
+  m_positions[m_heap[b].id] = b;
+}
+
+void Scheduler::siftUp(size_t index)
+{
+  while (index > 0 && earlier(m_heap[index], m_heap[(index - 1) / 2]))
+  {
+    swapEntries(index, (index - 1) / 2);
+    index = (index - 1) / 2;
+  }
+}
+
+void Scheduler::siftDown(size_t index)
+{
+  while (true)
+  {
+    size_t smallest = index;
+    for (size_t child = 2 * index + 1; child <= 2 * index + 2 && child < m_heap.size(); child++)
+    {
+      if (earlier(m_heap[child], m_heap[smallest]))
+      {
+        smallest = child;
+      }
+    }
+    if (smallest == index)
+    {
+      return;
+    }
+    swapEntries(index, smallest);
+    index = smallest;
+  }
+}
+
+void Scheduler::removeAt(size_t index)
+{
+  m_positions.erase(m_heap[index].id);
+  if (index != m_heap.size() - 1)
+  {
+    m_heap[index] = m_heap.back();
+    m_positions[m_heap[index].id] = index;
+    m_heap.pop_back();
+    // the entry from the end can belong above or below the removed one
+    siftUp(index);
+    siftDown(m_positions[m_heap[index].id] == index ? index : m_positions[m_heap[index].id]);
+  }
+  else
+  {
+    m_heap.pop_back();
+  }
+}
+
+void Scheduler::arm()
+{
+  long long deadline = m_heap.empty() ? -1 : m_heap[0].next_ms;
+  if (m_timer_fd == -1 || deadline == m_armed_ms)
+  {
+    return;
+  }
+  // a zero it_value disarms, a deadline that already passed fires right away
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
+  if (deadline != -1)
+  {
+    timer.it_value.tv_sec = deadline / 1000;
+    timer.it_value.tv_nsec = (deadline % 1000) * 1000000 + 1;
+  }
+  if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &timer, nullptr) == -1)
+  {
+    perror("smash error: timerfd_settime failed");
+  }
+  m_armed_ms = deadline;
+}
+
+/* *
+ * The CoprocList class
+ */
+
+CoprocList::CoprocList()
+    : m_coprocs()
+{
+}
+
+CoprocList::~CoprocList()
+{
+  for (std::pair<const std::string, Coproc> &entry : m_coprocs)
+  {
+    setExited(entry.second);
+  }
+}
+
+bool CoprocList::add(const std::string &name, const std::string &command, bool restart)
+{
+  if (m_coprocs.count(name))
+  {
+    return false;
+  }
+  Coproc coproc = {name, command, restart, -1, 0, -1, -1, "", std::deque<std::string>(), 0, 0, 0, 0};
+  m_coprocs.insert(std::make_pair(name, coproc));
+  return true;
+}
+
+bool CoprocList::remove(const std::string &name)
+{
+  std::map<std::string, Coproc>::iterator it = m_coprocs.find(name);
+  if (it == m_coprocs.end())
+  {
+    return false;
+  }
+  setExited(it->second);
+  m_coprocs.erase(it);
+  return true;
+}
+
+CoprocList::Coproc *CoprocList::get(const std::string &name)
+{
+  std::map<std::string, Coproc>::iterator it = m_coprocs.find(name);
+  return (it == m_coprocs.end()) ? nullptr : &it->second;
+}
+
+std::vector<CoprocList::Coproc *> CoprocList::getCoprocs()
+{
+  std::vector<Coproc *> coprocs;
+  for (std::pair<const std::string, Coproc> &entry : m_coprocs)
+  {
+    coprocs.push_back(&entry.second);
+  }
+  return coprocs;
+}
+
+void CoprocList::setRunning(Coproc &coproc, pid_t pid, int job_id, int to_fd, int from_fd)
+{
+  setExited(coproc);
+  // smash never blocks on a full pipe, it reads the answers while it waits to write
+  fcntl(to_fd, F_SETFL, fcntl(to_fd, F_GETFL) | O_NONBLOCK);
+  fcntl(from_fd, F_SETFL, fcntl(from_fd, F_GETFL) | O_NONBLOCK);
+  coproc.pid = pid;
+  coproc.job_id = job_id;
+  coproc.to_fd = to_fd;
+  coproc.from_fd = from_fd;
+  coproc.start_ms = _monotonic_ms();
+}
+
+void CoprocList::setExited(Coproc &coproc)
+{
+  for (int *fd : {&coproc.to_fd, &coproc.from_fd})
+  {
+    if (*fd != -1)
+    {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  coproc.pid = -1;
+  coproc.partial.clear();
+  coproc.answers.clear();
+  coproc.in_flight = 0;
+}
+
+bool CoprocList::fill(Coproc &coproc)
+{
+  char buffer[4096];
+  while (true)
+  {
+    ssize_t count = read(coproc.from_fd, buffer, sizeof(buffer));
+    if (count == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count == -1)
+    {
+      return errno == EAGAIN;
+    }
+    if (count == 0) // EOF, a last line without a new line is still an answer
+    {
+      if (!coproc.partial.empty())
+      {
+        coproc.answers.push_back(coproc.partial);
+        coproc.partial.clear();
+      }
+      errno = EPIPE;
+      return false;
+    }
+    size_t begin = 0;
+    for (ssize_t i = 0; i < count; i++)
+    {
+      if (buffer[i] == '\n')
+      {
+        coproc.partial.append(buffer + begin, i - begin);
+        coproc.answers.push_back(coproc.partial);
+        coproc.partial.clear();
+        begin = i + 1;
+      }
+    }
+    coproc.partial.append(buffer + begin, count - begin);
+  }
+}
+
+bool CoprocList::send(Coproc &coproc, const std::string &line, const std::function<bool()> &cancelled)
+{
+  if (coproc.to_fd == -1)
+  {
+    errno = EPIPE;
+    return false;
+  }
+  std::string request = line + "\n";
+  size_t sent = 0;
+  while (sent < request.size())
+  {
+    ssize_t res = _write_no_sigpipe(coproc.to_fd, request.data() + sent, request.size() - sent);
+    if (res > 0)
+    {
+      sent += res;
+      continue;
+    }
+    if (res == -1 && errno != EAGAIN && errno != EINTR)
+    {
+      return false;
+    }
+    // its stdin is full, it may wait for us to read its stdout
+    struct pollfd fds[2] = {{coproc.to_fd, POLLOUT, 0}, {coproc.from_fd, POLLIN, 0}};
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR && cancelled())
+      {
+        return false;
+      }
+      continue;
+    }
+    if (fds[1].revents && !fill(coproc))
+    {
+      return false;
+    }
+  }
+  coproc.in_flight++;
+  return true;
+}
+
+bool CoprocList::receive(Coproc &coproc, size_t index, std::string &answer, const std::function<bool()> &cancelled)
+{
+  if (index >= coproc.in_flight)
+  {
+    errno = ENOENT;
+    return false;
+  }
+  if (coproc.from_fd == -1)
+  {
+    errno = EPIPE;
+    return false;
+  }
+  while (coproc.answers.size() <= index)
+  {
+    struct pollfd fds[1] = {{coproc.from_fd, POLLIN, 0}};
+    if (poll(fds, 1, -1) == -1)
+    {
+      if (errno == EINTR && cancelled())
+      {
+        return false;
+      }
+      continue;
+    }
+    if (!fill(coproc) && coproc.answers.size() <= index)
+    {
+      return false;
+    }
+  }
+  answer = coproc.answers[index];
+  coproc.answers.erase(coproc.answers.begin() + index);
+  coproc.in_flight--;
+  return true;
+}
+
+/* *
+ * The Small Shell class
+ */
+
+// * SmallShell Public
+
+// initialize the static variable in SmallShell
+const std::string SmallShell::DEFAULT_PROMPT = "smash";
+SmallShell *SmallShell::s_session = nullptr;
+
+SmallShell::~SmallShell()
+{
+  // default
+}
+
+/**
+ * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
+ */
+Command *SmallShell::CreateCommand(const char *cmd_line, bool expanded)
+{
+  Tracer::Span span("CreateCommand", "parse", cmd_line);
+  return CreateCommand_aux(cmd_line, expanded);
+}
+
+void SmallShell::executeCommand(const char *cmd_line, bool expanded)
+{
+  Tracer::Span span("execute", "smash", cmd_line);
+  m_background_jobs.removeFinishedJobs();
+  reviveCoprocs();
+  Command *cmd = CreateCommand(cmd_line, expanded);
+  bool starts_job = cmd && cmd->isBackground() && ownsProcessGroups() &&
+                    (dynamic_cast<ExternalCommand *>(cmd) || dynamic_cast<PipeCommand *>(cmd));
+  // a background job that is not admitted waits in the queue with the redirections it has now
+  if (starts_job && !m_background_jobs.admits() && m_background_jobs.queueJob(cmd, _job_priority(cmd)))
+  {
+    m_last_status = 0;
+    m_pipe_status = std::vector<int>(1, 0);
+    return;
+  }
+  if (cmd)
+  {
+    bool captured = starts_job && m_background_jobs.beginCapture();
+    try
+    {
+      cmd->execute();
+    }
+    catch (const std::exception &e)
+    {
+      // std::cerr << e.what() << '\n';
+      cmd->setExitStatus(1);
+    }
+    if (captured)
+    {
+      m_background_jobs.endCapture();
+    }
+    m_last_status = cmd->getExitStatus();
+    if (!cmd->isCompound())
+    {
+      m_pipe_status = cmd->getPipeStatus();
+    }
+    delete cmd;
+  }
+  else if (_trim(cmd_line) != "") // the command printed an error while being created
+  {
+    m_last_status = 1;
+    m_pipe_status = std::vector<int>(1, 1);
+  }
+}
 
-SmallShell::~SmallShell()
+std::string SmallShell::expand(const std::string &cmd_line, std::string *for_bash)
 {
-  // default
+  static const std::string PIPESTATUS = "${PIPESTATUS[";
+  std::string expanded;
+  // the text of the line as it is, a value escaped in the line for bash
+  std::string escaped;
+  auto append = [&](const std::string &value) {
+    expanded += _mark_literal(value);
+    escaped += _mark_literal(_bash_escape(value));
+  };
+
+  for (size_t i = 0; i < cmd_line.size(); i++)
+  {
+    if (cmd_line[i] != '$' || i + 1 == cmd_line.size())
+    {
+      expanded += cmd_line[i];
+      escaped += cmd_line[i];
+      continue;
+    }
+    char next = cmd_line[i + 1];
+
+    if (next == '?')
+    {
+      append(std::to_string(m_last_status));
+      i++;
+    }
+    else if (next == '$')
+    {
+      append(std::to_string(m_smash_pid));
+      i++;
+    }
+    else if (next == '(')
+    {
+      size_t end = _find_substitution_end(cmd_line, i);
+      if (end == std::string::npos)
+      {
+        expanded += cmd_line.substr(i); // unbalanced, left as it is
+        escaped += cmd_line.substr(i);
+        break;
+      }
+      append(substituteCommand(cmd_line.substr(i + 2, end - i - 2)));
+      i = end;
+    }
+    else if (cmd_line.compare(i, PIPESTATUS.size(), PIPESTATUS) == 0 && cmd_line.find("]}", i) != std::string::npos)
+    {
+      size_t end = cmd_line.find("]}", i);
+      std::string index = cmd_line.substr(i + PIPESTATUS.size(), end - i - PIPESTATUS.size());
+      for (size_t stage = 0; stage < m_pipe_status.size(); stage++)
+      {
+        if (index == "@" || index == "*")
+        {
+          append((stage ? " " : "") + std::to_string(m_pipe_status[stage]));
+        }
+        else if (index == std::to_string(stage))
+        {
+          append(std::to_string(m_pipe_status[stage]));
+        }
+      }
+      i = end + 1;
+    }
+    else if (next == '{' && cmd_line.find('}', i) != std::string::npos)
+    {
+      size_t end = cmd_line.find('}', i);
+      std::string value;
+      m_environment.get(cmd_line.substr(i + 2, end - i - 2), value); // unset expands to nothing
+      append(value);
+      i = end;
+    }
+    else if (isalpha((unsigned char)next) || next == '_')
+    {
+      size_t end = i + 1;
+      while (end < cmd_line.size() && (isalnum((unsigned char)cmd_line[end]) || cmd_line[end] == '_'))
+      {
+        end++;
+      }
+      std::string value;
+      m_environment.get(cmd_line.substr(i + 1, end - i - 1), value);
+      append(value);
+      i = end - 1;
+    }
+    else
+    {
+      expanded += '$'; // a `$` that does not start anything
+      escaped += '$';
+    }
+  }
+  if (for_bash != nullptr)
+  {
+    *for_bash = escaped;
+  }
+  return expanded;
 }
 
-/**
- * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
- */
-Command *SmallShell::CreateCommand(const char *cmd_line)
+std::string SmallShell::substituteCommand(const std::string &cmd_line)
+{
+  std::string output;
+
+  if (_is_fork_free_builtin(cmd_line))
+  {
+    // a builtin without side effects prints straight into memory, no fork and no pipe
+    Command *cmd = CreateCommand(cmd_line.c_str());
+    if (cmd)
+    {
+      std::ostringstream captured;
+      std::streambuf *original = std::cout.rdbuf(captured.rdbuf());
+      try
+      {
+        cmd->execute();
+      }
+      catch (const std::exception &e)
+      {
+        cmd->setExitStatus(1);
+      }
+      std::cout.rdbuf(original);
+      m_last_status = cmd->getExitStatus();
+      output = captured.str();
+      delete cmd;
+    }
+  }
+  else
+  {
+    int files[2];
+    if (pipe(files) == -1)
+    {
+      perror("smash error: pipe failed");
+      return "";
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+      perror("smash error: fork failed");
+      close(files[0]);
+      close(files[1]);
+      return "";
+    }
+    if (pid == 0) // * son, like a pipeline stage that writes to us
+    {
+      if (dup2(files[1], STDOUT_FILENO) == -1)
+      {
+        perror("smash error: dup2 failed");
+        _exit(1);
+      }
+      close(files[0]);
+      close(files[1]);
+      runInSon(cmd_line, false); // the inside of `$(...)` is a whole line of its own
+    }
+
+    close(files[1]);
+    // the output can be of any size, read it in chunks into the growing string
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(files[0], buffer, sizeof(buffer))) != 0)
+    {
+      if (count == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        perror("smash error: read failed");
+        break;
+      }
+      output.append(buffer, count);
+    }
+    close(files[0]);
+
+    int wstatus = 0;
+    if (waitpid(pid, &wstatus, 0) == -1)
+    {
+      perror("smash error: waitpid failed");
+    }
+    m_last_status = _status_from_wait(wstatus);
+  }
+
+  // like bash, the trailing new lines are removed
+  size_t end = output.find_last_not_of('\n');
+  output.erase((end == std::string::npos) ? 0 : end + 1);
+  return output;
+}
+
+void SmallShell::runInSon(const std::string &cmd_line, bool expanded)
 {
-  return CreateCommand_aux(cmd_line);
+  runInSon(CreateCommand(cmd_line.c_str(), expanded));
 }
 
-void SmallShell::executeCommand(const char *cmd_line)
+void SmallShell::runInSon(Command *cmd)
 {
-  m_background_jobs.removeFinishedJobs();
-  Command *cmd = CreateCommand(cmd_line);
+  // ctrl-C and ctrl-Z stop or kill a son like any command, only smash itself stays
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  // an external command replaces this son directly, anything else runs in it and its status is the exit code
+  int status = 1;
+  ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+  if (external)
+  {
+    external->exec();
+  }
   if (cmd)
   {
     try
     {
       cmd->execute();
     }
-    catch (const std::exception &e)
+    catch (const std::exception &e)
+    {
+      cmd->setExitStatus(1);
+    }
+    status = cmd->getExitStatus();
+    delete cmd;
+  }
+  // _exit and not exit: exit() would rewind the stdin offset we share with smash
+  std::cout.flush();
+  fflush(stdout);
+  Tracer::flushThread();
+  _exit(status);
+}
+
+void SmallShell::enableJobControl(int terminal_fd)
+{
+  if (isatty(terminal_fd) && tcgetpgrp(terminal_fd) == getpgrp() && tcgetattr(terminal_fd, &m_terminal_modes) == 0)
+  {
+    m_terminal_fd = terminal_fd;
+  }
+}
+
+void SmallShell::openJournal()
+{
+  // a script does not take back the jobs of the smash before it unless it asks for a journal
+  std::string base;
+  if (!m_environment.get("SMASH_JOURNAL", base) && isatty(STDIN_FILENO) && m_environment.get("HOME", base))
+  {
+    base += "/.smash_jobs";
+  }
+  if (base.empty() || base == "0")
+  {
+    return;
+  }
+  std::vector<int> adopted;
+  if (!m_background_jobs.openJournal(base, adopted))
+  {
+    perror("smash error: journal failed");
+    return;
+  }
+  for (int job_id : adopted)
+  {
+    std::cout << "[" << job_id << "] " << m_background_jobs.getJobById(job_id)->getCMDLine() << " (adopted)\n";
+  }
+}
+
+bool SmallShell::waitForeground(const std::string &cmd_line, pid_t pgid, const std::vector<pid_t> &members,
+                                std::vector<int> &statuses, int job_id, bool resume)
+{
+  Tracer::Span span("waitpid", "wait", cmd_line);
+  statuses.assign(members.size(), 1);
+  if (!ownsProcessGroups())
+  {
+    // a son of smash waits in the group it was given, ctrl-C and ctrl-Z reach it together with its sons
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      int wstatus = 0;
+      if (waitpid(members[i], &wstatus, 0) == -1)
+      {
+        perror("smash error: waitpid failed");
+        continue;
+      }
+      statuses[i] = _status_from_wait(wstatus);
+    }
+    return true;
+  }
+
+  m_foreground_pgid = pgid;
+  // a job that already exited has no group to take the terminal
+  bool has_terminal = m_terminal_fd != -1 && _set_terminal_pgrp(m_terminal_fd, pgid);
+  if (resume && killpg(pgid, SIGCONT) == -1 && errno != ESRCH)
+  {
+    perror("smash error: kill failed");
+  }
+  std::vector<bool> done(members.size(), false);
+  size_t running = members.size();
+  int stop_signal = 0;
+  bool signaled = false;
+  while (running > 0 && stop_signal == 0)
+  {
+    int wstatus = 0;
+    pid_t pid = waitpid(-pgid, &wstatus, WUNTRACED);
+    if (pid == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (pid == -1)
+    {
+      if (errno != ECHILD) // ECHILD: a member that is not in the group was reaped by someone else
+      {
+        perror("smash error: waitpid failed");
+      }
+      break;
+    }
+    size_t index = std::find(members.begin(), members.end(), pid) - members.begin();
+    if (index == members.size() || done[index])
+    {
+      continue;
+    }
+    if (WIFSTOPPED(wstatus))
+    {
+      int sig = WSTOPSIG(wstatus);
+      if ((sig == SIGTTIN || sig == SIGTTOU) && has_terminal && tcgetpgrp(m_terminal_fd) == pgid)
+      {
+        killpg(pgid, SIGCONT); // it used the terminal just before it was given to it
+        continue;
+      }
+      stop_signal = sig;
+      continue;
+    }
+    statuses[index] = _status_from_wait(wstatus);
+    done[index] = true;
+    running--;
+    if (WIFSIGNALED(wstatus))
+    {
+      signaled = true;
+      if (WTERMSIG(wstatus) == SIGINT)
+      {
+        // ctrl-C in the terminal went to the job and not to smash, a builtin that loops (watch) stops as well
+        setInterrupted(true);
+      }
+    }
+  }
+  if (m_terminal_fd != -1)
+  {
+    if (has_terminal && !_set_terminal_pgrp(m_terminal_fd, getpgrp()))
+    {
+      perror("smash error: tcsetpgrp failed");
+    }
+    if (stop_signal != 0 || signaled)
+    {
+      tcsetattr(m_terminal_fd, TCSADRAIN, &m_terminal_modes);
+    }
+  }
+  m_foreground_pgid = -1;
+  span.end();
+  if (stop_signal == 0)
+  {
+    return true;
+  }
+
+  std::vector<pid_t> left;
+  for (size_t i = 0; i < members.size(); i++)
+  {
+    if (!done[i])
+    {
+      statuses[i] = 128 + stop_signal;
+      left.push_back(members[i]);
+    }
+  }
+  job_id = m_background_jobs.addJob(cmd_line, pgid, left, job_id);
+  m_background_jobs.getJobById(job_id)->setStopped(true);
+  std::cout << "[" << job_id << "] " << cmd_line << " (stopped)\n";
+  return false;
+}
+
+// * SmallShell Private
+
+SmallShell::SmallShell()
+    : m_prompt(DEFAULT_PROMPT),
+      m_background_jobs(), // default c'tor (empty list)
+      m_environment(),     // the environment smash was started with
+      m_scheduler(),       // nothing scheduled
+      m_foreground_pgid(-1),
+      m_terminal_fd(-1),
+      m_terminal_modes(),
+      m_last_status(0),
+      m_pipe_status(1, 0),
+      m_pipefail(false),
+      m_smash_pid(getpid()),
+      m_old_pwd(),
+      m_cwd(_start_cwd()),
+      m_dir_stack(),
+      m_quit(false),
+      m_interrupted(0)
+{
+}
+
+SmallShell *SmallShell::createSession()
+{
+  return new SmallShell();
+}
+
+void SmallShell::setSession(SmallShell *session)
+{
+  s_session = session;
+}
+
+bool SmallShell::changeDir(const std::string &path)
+{
+  if (path.empty())
+  {
+    errno = ENOENT;
+    return false;
+  }
+  std::string logical = path;
+  if (!m_cwd.empty() || path[0] == '/')
+  {
+    logical = _normalize_path((path[0] == '/') ? path : m_cwd + "/" + path);
+  }
+  if (_chdir_long(logical) == -1)
+  {
+    // `..` after a symbolic link may not exist logically, then the path is taken as is (like `cd -P`)
+    int error = errno;
+    if (logical == path || _chdir_long(path) == -1)
+    {
+      errno = error;
+      return false;
+    }
+    logical.clear();
+  }
+  if (logical.empty() || logical[0] != '/')
+  {
+    char *physical = getcwd(nullptr, 0);
+    logical = (physical != nullptr) ? physical : "";
+    free(physical);
+  }
+  m_old_pwd = m_cwd;
+  m_cwd = logical;
+  m_environment.set("OLDPWD", m_old_pwd);
+  m_environment.set("PWD", m_cwd);
+
+  // z learns from every directory change, a database that can not be opened only costs z its history
+  if (_open_z_data(m_environment) && !m_cwd.empty())
+  {
+    Frecency::getInstance().visit(m_cwd, time(nullptr));
+  }
+  return true;
+}
+
+std::vector<std::string> &SmallShell::getDirStack()
+{
+  return m_dir_stack;
+}
+
+Scheduler &SmallShell::getScheduler()
+{
+  return m_scheduler;
+}
+
+CoprocList &SmallShell::getCoprocs()
+{
+  return m_coprocs;
+}
+
+bool SmallShell::startCoproc(CoprocList::Coproc &coproc)
+{
+  int to[2];
+  int from[2];
+  if (pipe2(to, O_CLOEXEC) == -1)
+  {
+    perror("smash error: pipe failed");
+    return false;
+  }
+  if (pipe2(from, O_CLOEXEC) == -1)
+  {
+    perror("smash error: pipe failed");
+    close(to[0]);
+    close(to[1]);
+    return false;
+  }
+  Command *cmd = CreateCommand(coproc.command.c_str(), true);
+  if (cmd == nullptr) // it printed why
+  {
+    for (int fd : {to[0], to[1], from[0], from[1]})
+    {
+      close(fd);
+    }
+    return false;
+  }
+  pid_t pid = -1;
+  const int fds[3] = {to[0], from[1], STDERR_FILENO};
+  ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+  if (external && Zygote::getInstance().isRunning())
+  {
+    Tracer::Span span("spawn", "process", coproc.command);
+    pid = external->spawn(fds, 0);
+  }
+  if (pid == -1)
+  {
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0) // * son
+    {
+      if (setpgid(0, 0) == -1 || dup2(to[0], STDIN_FILENO) == -1 || dup2(from[1], STDOUT_FILENO) == -1)
+      {
+        perror("smash error: dup2 failed");
+        _exit(1);
+      }
+      // a builtin runs in this son without an exec, the ends of smash must not stay open in it
+      close(to[1]);
+      close(from[0]);
+      runInSon(cmd);
+    }
+    if (pid > 0)
+    {
+      setpgid(pid, pid);
+    }
+  }
+  delete cmd;
+  close(to[0]);
+  close(from[1]);
+  if (pid == -1)
+  {
+    perror("smash error: fork failed");
+    close(to[1]);
+    close(from[0]);
+    return false;
+  }
+  // it keeps its job id across restarts while nothing else took it
+  int job_id = m_background_jobs.addJob("coproc " + coproc.name + " " + coproc.command, pid,
+                                        std::vector<pid_t>(1, pid), coproc.job_id);
+  m_coprocs.setRunning(coproc, pid, job_id, to[1], from[0]);
+  return true;
+}
+
+void SmallShell::reviveCoprocs()
+{
+  if (m_coprocs.size() == 0 || !ownsProcessGroups())
+  {
+    return;
+  }
+  long long now_ms = _monotonic_ms();
+  for (CoprocList::Coproc *coproc : m_coprocs.getCoprocs())
+  {
+    // a job id is reused, the pid tells if it is still the same job
+    JobsList::JobEntry *job = m_background_jobs.getJobById(coproc->job_id);
+    if (coproc->pid == -1 || (job != nullptr && job->getJobPid() == coproc->pid))
+    {
+      continue;
+    }
+    bool quick = now_ms - coproc->start_ms < CoprocList::QUICK_EXIT_MS;
+    coproc->quick_exits = quick ? coproc->quick_exits + 1 : 0;
+    m_coprocs.setExited(*coproc);
+    if (!coproc->restart)
+    {
+      continue;
+    }
+    if (coproc->quick_exits >= CoprocList::MAX_QUICK_EXITS)
+    {
+      std::cerr << "smash error: coproc: " << coproc->name << " exits right after it starts, it is not restarted\n";
+      coproc->restart = false;
+      continue;
+    }
+    if (startCoproc(*coproc))
+    {
+      coproc->restarts++;
+    }
+  }
+}
+
+void SmallShell::runDueSchedules()
+{
+  std::vector<Scheduler::Entry> due = m_scheduler.takeDue(_monotonic_ms());
+  if (due.empty())
+  {
+    return;
+  }
+  m_background_jobs.removeFinishedJobs();
+  int last_status = m_last_status;
+  std::vector<int> pipe_status = m_pipe_status;
+  for (const Scheduler::Entry &entry : due)
+  {
+    // a last run that was queued (pid 0) is the same job after it started
+    JobsList::JobEntry *last_run = m_background_jobs.getJobById(entry.last_job_id);
+    if (!entry.overlap && last_run != nullptr &&
+        (last_run->getJobPid() == entry.last_job_pid || entry.last_job_pid == 0))
+    {
+      continue; // the last run did not finish, this one is skipped
+    }
+    JobsList::JobEntry *job = m_background_jobs.getLastJob();
+    int last_id = job ? job->getJobID() : 0;
+    pid_t last_pid = job ? job->getJobPid() : -1;
+    executeCommand((entry.command + "&").c_str(), true);
+    job = m_background_jobs.getLastJob();
+    if (job != nullptr && (job->getJobID() != last_id || job->getJobPid() != last_pid))
     {
-      // std::cerr << e.what() << '\n';
+      m_scheduler.setLastJob(entry.id, job->getJobID(), job->getJobPid());
     }
-    delete cmd;
   }
-  setCurrForegroundPID(-1);
+  m_last_status = last_status;
+  m_pipe_status = pipe_status;
 }
 
-// * SmallShell Private
-
-SmallShell::SmallShell()
-    : m_prompt(DEFAULT_PROMPT),
-      m_background_jobs(), // default c'tor (empty list)
-      m_currForegroundPID(-1)
+JobsList &SmallShell::getJobsList()
 {
+  return m_background_jobs;
 }
 
-JobsList &SmallShell::getJobsList()
+Environment &SmallShell::getEnvironment()
 {
-  return m_background_jobs;
+  return m_environment;
 }
 
 const std::string &SmallShell::getPrompt() const
@@ -1250,12 +6394,45 @@ void SmallShell::setPrompt(const std::string &newPrompt)
   m_prompt = newPrompt;
 }
 
-Command *SmallShell::CreateCommand_aux(const char *cmd_line)
+Command *SmallShell::CreateCommand_aux(const char *cmd_line, bool expanded)
 {
   if (*cmd_line == '\0')
   {
     return nullptr;
   }
+
+  // the parts of an expanded line (pipeline stages, the command of a redirection) are never expanded twice,
+  // a value that contains `$(...)` must not run
+  // the classes read the line from one scan, and not each with a search of its own
+  LineScan::Scope scope(cmd_line);
+  std::string expanded_line;
+  if (!expanded)
+  {
+    try
+    {
+      return new ListCommand(cmd_line);
+    }
+    catch (const std::exception &e)
+    {
+      if (std::string(e.what()) == "ListCommand::ListCommand")
+      {
+        return nullptr;
+      }
+    }
+
+    // a single pipeline, the statuses it refers to are the ones from before it runs
+    std::string for_bash;
+    expanded_line = expand(cmd_line, &for_bash);
+    scope.rescan(expanded_line.c_str());
+    // a line with `*` or `?` runs in bash, which parses it once more: there the values are escaped and none runs
+    if (LineScan::of(expanded_line.c_str()).has(LineScan::GLOB))
+    {
+      expanded_line = for_bash;
+      scope.rescan(expanded_line.c_str());
+    }
+    cmd_line = expanded_line.c_str();
+  }
+
   try
   {
     return new RedirectionCommand(cmd_line);
@@ -1280,6 +6457,32 @@ Command *SmallShell::CreateCommand_aux(const char *cmd_line)
     }
   }
 
+  try
+  {
+    return new AssignmentCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+  }
+
+  // `NAME=value cmd` puts NAME in the environment of cmd only
+  std::vector<std::string> assignments;
+  std::string command = _split_assignments(cmd_line, assignments);
+  for (std::string &assignment : assignments)
+  {
+    assignment = _unmark_literal(assignment);
+  }
+  Command *cmd = CreateSimpleCommand(command.c_str());
+  if (cmd)
+  {
+    cmd->setEnvOverrides(assignments);
+  }
+  return cmd;
+}
+
+Command *SmallShell::CreateSimpleCommand(const char *cmd_line)
+{
+  LineScan::Scope scope(cmd_line);
   try
   {
     return new ChangePromptCommand(cmd_line);
@@ -1388,6 +6591,262 @@ Command *SmallShell::CreateCommand_aux(const char *cmd_line)
     }
   }
 
+  try
+  {
+    return new WaitCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "WaitCommand::WaitCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new JobtopCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "JobtopCommand::JobtopCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new WatchCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "WatchCommand::WatchCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new ScheduleCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+  }
+
+  try
+  {
+    return new AtqCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+  }
+
+  try
+  {
+    return new AtrmCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "AtrmCommand::AtrmCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new AdmitCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "AdmitCommand::AdmitCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new JoblogCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "JoblogCommand::JoblogCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new TraceCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "TraceCommand::TraceCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new PushdCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "PushdCommand::PushdCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new PopdCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "PopdCommand::PopdCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new DirsCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "DirsCommand::DirsCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new ZCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "ZCommand::ZCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new BackgroundCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "BackgroundCommand::BackgroundCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new CoprocCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "CoprocCommand::CoprocCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new CosendCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "CosendCommand::CosendCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new CorecvCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "CorecvCommand::CorecvCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new CoreqCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "CoreqCommand::CoreqCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new MemoCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "MemoCommand::MemoCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new ExportCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "ExportCommand::ExportCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new UnsetCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "UnsetCommand::UnsetCommand")
+    {
+      return nullptr;
+    }
+  }
+
+  try
+  {
+    return new SetCommand(cmd_line);
+  }
+  catch (const std::exception &e)
+  {
+    if (std::string(e.what()) == "SetCommand::SetCommand")
+    {
+      return nullptr;
+    }
+  }
+
   try
   {
     return new ExternalCommand(cmd_line);
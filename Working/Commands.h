@@ -2,8 +2,18 @@
 #define SMASH_COMMAND_H_
 
 #include <vector>
+#include <deque>
+#include <functional>
 #include <list>
+#include <map>
+#include <set>
 #include <string>
+#include <tuple>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include "journal.h"
 
 #define COMMAND_ARGS_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
@@ -26,6 +36,8 @@ class Command
   /* variables */
   GroundType m_ground_type; // should come before the command line
   std::string m_cmd_line;   // command line
+  int m_exit_status;        // 0 on success, like $? in bash
+  std::vector<std::string> m_env_overrides; // NAME=value from `NAME=value cmd`, only for this command
 
 public:
   /* methods */
@@ -38,6 +50,17 @@ public:
   bool isBackground() const { return m_ground_type == GroundType::Background; }
   void setGround(GroundType ground) { m_ground_type = ground; }
   std::string m_remove_background_sign(const char *cmd_line) const;
+
+  int getExitStatus() const { return m_exit_status; }
+  void setExitStatus(int status) { m_exit_status = status; }
+  // the statuses of every stage, a simple command is a pipeline of one
+  virtual std::vector<int> getPipeStatus() const { return std::vector<int>(1, m_exit_status); }
+  // compound commands run their parts through SmallShell::executeCommand which records the statuses
+  virtual bool isCompound() const { return false; }
+  // runs external programs only (a pipeline or a redirection of them too), no builtin that could change smash
+  virtual bool isExternal() const { return false; }
+  const std::vector<std::string> &getEnvOverrides() const { return m_env_overrides; }
+  void setEnvOverrides(const std::vector<std::string> &overrides) { m_env_overrides = overrides; }
 };
 
 /*
@@ -58,16 +81,29 @@ class ExternalCommand : public Command
     Complex
   };
   Complexity m_complexity;
+  std::vector<std::string> m_argv; // parsed once, a command that runs many times (watch) is not parsed again
 
   pid_t m_pid;
+  static rlim_t s_files_limit; // RLIM_INFINITY when smash did not raise its own
 
   /* methods */
   Complexity _get_complexity_type(const char *cmd_line);
+  std::vector<std::string> _build_argv() const;
 
 public:
   ExternalCommand(const char *cmd_line);
   virtual ~ExternalCommand();
   void execute() override;
+  // replaces the current process with the command (used after fork)
+  [[noreturn]] void exec();
+  // the arguments the command is exec'd with, `/bin/bash -c <line>` for a complex command
+  const std::vector<std::string> &getArgv() const { return m_argv; }
+  // starts the command through the zygote with the given stdin, stdout and stderr, -1 if it did not
+  pid_t spawn(const int fds[3], pid_t pgid);
+  bool isExternal() const override { return true; }
+  // the soft limit of open files the commands get: the one smash started with, before it raised its own for its
+  // pidfds. a program that uses select() breaks on an fd past 1024
+  static void setFilesLimit(rlim_t limit) { s_files_limit = limit; }
   const pid_t getPID() const
   {
     return m_pid;
@@ -82,9 +118,40 @@ public:
  * Special Commands
  */
 
+/* *
+ * The ListCommand contains commands separated by `;`, `&&`, `||` or a background `&`.
+ * `&&` runs the next command only if the previous one succeeded, `||` only if it failed.
+ * The list must be checked before anything else since its parts can be pipes or redirections.
+ */
+class ListCommand : public Command
+{
+public:
+  /* types */
+  enum class Connector
+  {
+    Sequential,
+    And,
+    Or
+  };
+
+  /* methods */
+  explicit ListCommand(const char *cmd_line);
+  virtual ~ListCommand();
+  void execute() override;
+  bool isCompound() const override { return true; }
+
+private:
+  /* variables */
+  // each command with the connector that comes after it
+  std::vector<std::pair<std::string, Connector>> m_commands;
+};
+
+class BuiltInCommand;
+
 /* *
  * The pipe command contains 2 commands and the type of piping (| or |&)
  * If you see the character "|" or "|&" in the command, then its a pipe :-)
+ * Side effect free builtins (showpid, pwd, jobs) run inside smash, only external stages are forked.
  */
 class PipeCommand : public Command
 {
@@ -100,14 +167,20 @@ public:
   PipeCommand(const char *cmd_line);
   virtual ~PipeCommand();
   void execute() override;
+  std::vector<int> getPipeStatus() const override { return m_stage_statuses; }
+  bool isExternal() const override;
 
 private:
   /* variables */
   PipeType m_pipe_type;
   std::string m_cmd_1;
   std::string m_cmd_2;
+  std::vector<int> m_stage_statuses;
+  int m_report_fd; // set in the son that runs the tail of a longer pipeline, its stage statuses go back through it
 
   PipeCommand::PipeType _get_pipe_type(const char *cmd_line);
+  BuiltInCommand *_create_fork_free_stage(const std::string &cmd_line);
+  pid_t _fork_stage(const std::string &cmd_line, int files[2], bool is_writer, pid_t pgid, int *report = nullptr);
   std::string _get_cmd_1(const char *cmd_line);
   std::string _get_cmd_2(const char *cmd_line);
 };
@@ -138,6 +211,8 @@ public:
   explicit RedirectionCommand(const char *cmd_line);
   virtual ~RedirectionCommand();
   void execute() override;
+  bool isCompound() const override { return true; }
+  bool isExternal() const override;
   // void prepare() override; // ? what are these
   // void cleanup() override; // ? what are these
 };
@@ -162,11 +237,14 @@ public:
   unsigned int numOfArgs() const { return m_args.size(); }
   const std::string &getName() const { return m_name; }
   const std::vector<std::string> &getArgs() const { return m_args; }
+  // the arguments as they are in the line, for a command that creates a command of them (watch, memo...)
+  const std::vector<std::string> &getLineArgs() const { return m_line_args; }
 
 private:
   /* variables */
   std::string m_name;
   std::vector<std::string> m_args;
+  std::vector<std::string> m_line_args; // an expanded value still has its | > & ; marked, see _mark_literal
   /* methods */
   std::string m_parse_name(const char *cmd_line) const;
   std::vector<std::string> m_parse_args(const char *cmd_line) const;
@@ -200,7 +278,8 @@ public:
 /** Command number 3:
  * @brief `pwd` command has no arguments.
  *    pwd prints the full path of the current working directory. In the next command (cd command) will explain how to change the current working directory.
- *    You may use `getcwd` system call to retrieve the current working directory.
+ *    smash keeps the logical working directory (the way cd got there, symbolic links kept, like $PWD), so pwd prints
+ *    it without a system call and without a limit on its length. getcwd is used only when smash has none.
  *    If any number of arguments were provided with pwd then they will be ignored.
  */
 class GetCurrDirCommand : public BuiltInCommand
@@ -222,15 +301,13 @@ public:
  *    If the last working directory is empty and “cd -“ was called (before calling cd with some path to change current working directory to it) then it should print the following error message:
  *        ```smash error: cd: OLDPWD not set```
  *    If `chdir()` system call fails (e.g., <path> argument points to a non-existing path) then perror should be used to print a proper error message (as described in Error Handling section).
+ *
+ *    The path is resolved against the logical working directory (`..` removes the last component, like `cd -L`), and
+ *    one that does not exist that way is tried as is. A path longer than PATH_MAX is changed to a part at a time.
+ *    cd without an argument changes to $HOME. Every directory cd changes to is a visit for `z`.
  */
 class ChangeDirCommand : public BuiltInCommand
 {
-  /* static variables */
-  static std::string CD_PATH_HISTORY;
-
-  /* methods */
-  std::string get_parent_directory(const std::string &path) const;
-
 public:
   ChangeDirCommand(const char *cmd_line);
   virtual ~ChangeDirCommand();
@@ -258,6 +335,9 @@ class ForegroundCommand : public BuiltInCommand
 {
   int m_id;
 
+  // prints the log of a captured job while it runs, its pipe would fill up while fg only waits
+  void _follow_log(const std::vector<pid_t> &members);
+
 public:
   ForegroundCommand(const char *cmd_line);
   virtual ~ForegroundCommand();
@@ -265,10 +345,14 @@ public:
 };
 
 /** Command number 7:
- * @brief
+ * @brief `quit` ends smash once the line is done. `quit kill` kills the jobs first and reaps them, with
+ *    `--grace <seconds>` they get SIGTERM together and the ones still running at the deadline get SIGKILL.
  */
 class QuitCommand : public BuiltInCommand
 {
+  /* variables */
+  long long m_grace_ms; // 0 for SIGKILL right away
+
 public:
   QuitCommand(const char *cmd_line);
   virtual ~QuitCommand();
@@ -276,13 +360,20 @@ public:
 };
 
 /** Command number 8:
- * @brief
+ * @brief `kill -<signal> <target>...` signals jobs, the signal is a number or a name (`-9`, `-KILL`, `-SIGKILL`).
+ *    A target is a job id (`3` or `%3`), a range of ids (`%5-%40`) or a pattern of command lines (`%sleep*`).
+ *    The targets are resolved against the jobs list once, every job they name gets the signal once and one line sums
+ *    it up (the line of a single job when the only target is its id).
  */
 class KillCommand : public BuiltInCommand
 {
   /* variables */
   int m_signal_number;
-  int m_job_id;
+  int m_job_id; // the only target when it is a job id, else 0
+  std::vector<std::string> m_targets;
+
+  // adds the ids of the jobs a target names, false when it names none
+  bool resolve(const std::string &target, std::set<int> &ids);
 
 public:
   KillCommand(const char *cmd_line);
@@ -291,16 +382,453 @@ public:
 };
 
 /**
- * @brief
+ * @brief `chmod [-R] <mode> <path>...` changes the mode of every path. The mode is octal (`755`) or symbolic
+ *    (`u+x,g-w`, `a=rX`, see ModeSpec in chmod.h).
+ *    With -R the directories are walked on a pool of threads (see ChmodTree) without following symbolic links, and a
+ *    failure is printed (sorted by path, the first 1000) after the walk instead of stopping it. ctrl-C stops the walk.
  */
 class ChmodCommand : public BuiltInCommand
 {
+  /* variables */
+  bool m_recursive;
+  std::string m_mode;
+  std::vector<std::string> m_paths;
+
 public:
   ChmodCommand(const char *cmd_line);
   virtual ~ChmodCommand();
   void execute() override;
 };
 
+/**
+ * @brief `set -o <option>` turns a shell option on and `set +o <option>` turns it off.
+ *    `set -o` alone prints the options. With `pipefail` the status of a pipeline is the status of the last stage
+ *    that failed instead of the status of the last stage. With `capture` the stdout and stderr of the background
+ *    jobs that start go to a log of their own in memory instead of the terminal (see `joblog`).
+ */
+class SetCommand : public BuiltInCommand
+{
+public:
+  SetCommand(const char *cmd_line);
+  virtual ~SetCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `wait [-n] [-t secs] [job-id...]` blocks until the given jobs (all jobs if none were given) finish
+ *    and prints `[<job-id>] exit <status>` for each of them. With -n it returns as soon as one of them finished.
+ *    With -t it gives up after secs seconds with status 124. It sleeps on the exit events set of the jobs
+ *    list, so it needs no descriptors of its own and a member without a pidfd is still found by waitid.
+ */
+class WaitCommand : public BuiltInCommand
+{
+  /* variables */
+  bool m_any;
+  long long m_timeout_ms; // -1 for no timeout
+  std::vector<int> m_job_ids;
+
+public:
+  WaitCommand(const char *cmd_line);
+  virtual ~WaitCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `jobtop [-s cpu|mem|time|id] [-d secs] [-n frames]` shows every job with its elapsed time, %CPU, RSS and state,
+ *    redrawn in place every secs seconds (1 by default) until ctrl-C or until it drew the given number of frames.
+ *    When the output is not a terminal it prints a single frame unless -n is given.
+ *    /proc/<pid>/stat and statm of every member are opened once and re-read with pread on every frame, and the rows
+ *    are sorted by a key computed once per frame (only the rows that fit on the terminal are fully sorted).
+ */
+class JobtopCommand : public BuiltInCommand
+{
+  /* types */
+  enum class SortKey
+  {
+    Cpu,
+    Memory,
+    Time,
+    Id
+  };
+  struct ProcFiles
+  {
+    int stat_fd;
+    int statm_fd;
+    long long cpu_ticks;  // utime + stime at the last sample
+    long long sampled_ms; // when it was sampled, -1 before the first sample
+    bool seen;            // still a member on this frame, the files of the others are closed
+  };
+  struct Row
+  {
+    int job_id;
+    pid_t pgid;
+    char state;
+    long long elapsed_ms;
+    double cpu_percent;
+    long long rss_kb;
+    std::string command;
+  };
+
+  /* variables */
+  SortKey m_sort_key;
+  long long m_delay_ms;
+  long long m_frames; // -1 for no limit
+  std::map<pid_t, ProcFiles> m_files;
+
+  /* methods */
+  // reads the state, the cpu time and the resident pages of a member, false if it is gone
+  bool _sample(ProcFiles &files, char *state, long long *cpu_ticks, long long *rss_pages);
+  void _draw_frame(bool in_place);
+
+public:
+  JobtopCommand(const char *cmd_line);
+  virtual ~JobtopCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `watch [-n secs] [-d] [-c count] <command>` runs the command every secs seconds (2 by default) until ctrl-C,
+ *    or count times. The command is parsed (and expanded) once and the same command runs again on every tick of a
+ *    timerfd, so the runs do not drift and an iteration costs one spawn of an external command and nothing else.
+ *    On a terminal every run is drawn over the last one under an `Every <secs>s: <command>` header.
+ *    With -d the output is captured in a memfd and after the first run only its changes are printed:
+ *    `+ line` for a line that is new and `- line` for a line that is gone.
+ */
+class WatchCommand : public BuiltInCommand
+{
+  /* variables */
+  long long m_interval_ms;
+  bool m_diff;
+  long long m_count; // -1 for no limit
+  std::string m_command_line;
+  Command *m_command;
+
+  /* methods */
+  // runs the command once with its stdout in the memfd and returns what it printed
+  std::string _run_captured(int memfd);
+
+public:
+  WatchCommand(const char *cmd_line);
+  virtual ~WatchCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `at <time> <command>` runs the command once in the background, time is HH:MM[:SS] (the next time the
+ *    clock shows it) or +<duration>. `every [-o] <duration> <command>` runs it every duration, the first run is one
+ *    duration from now. A duration is a number of seconds or a number with s, m, h or d.
+ *    The runs are background jobs in the jobs list. A run of `every` is skipped while the job of its last run did not
+ *    finish yet, unless -o allows the runs to overlap. The command line is expanded once, when it is scheduled.
+ */
+class ScheduleCommand : public BuiltInCommand
+{
+public:
+  ScheduleCommand(const char *cmd_line);
+  virtual ~ScheduleCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `atq` lists the scheduled commands in the order they run next.
+ */
+class AtqCommand : public BuiltInCommand
+{
+public:
+  AtqCommand(const char *cmd_line);
+  virtual ~AtqCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `atrm <id>...` cancels scheduled commands, a job that one of them already started keeps running.
+ */
+class AtrmCommand : public BuiltInCommand
+{
+public:
+  AtrmCommand(const char *cmd_line);
+  virtual ~AtrmCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `admit [-j max] [-c cpu%] [-m mem%]` sets the admission control of background jobs, 0 turns a limit off.
+ *    With -j at most max background jobs run, with -c and -m a job does not start while the `some avg10` of
+ *    /proc/pressure/cpu or /proc/pressure/memory is above the given %. A background command that is not admitted
+ *    waits in the queue as a queued job (shown by `jobs`, cancelled by `kill`, started at once by `fg`) and starts
+ *    when a job finishes or the pressure drops. `JOBPRIO=<n> cmd &` queues it before the jobs with a lower $JOBPRIO,
+ *    the ones with the same priority start in the order they came. Without arguments it prints the settings.
+ */
+class AdmitCommand : public BuiltInCommand
+{
+  /* variables */
+  // -1 for the limits that were not given, they stay as they are
+  long long m_max_running;
+  double m_max_cpu_pressure;
+  double m_max_memory_pressure;
+
+public:
+  AdmitCommand(const char *cmd_line);
+  virtual ~AdmitCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `joblog [-f] <job-id>` prints what a captured job (`set -o capture`) wrote last, the last 64 KiB of it.
+ *    With -f it then follows the output until the job and everything it started closed it, or until ctrl-C.
+ *    The log of a job is kept for a minute after the job finished.
+ */
+class JoblogCommand : public BuiltInCommand
+{
+  /* variables */
+  bool m_follow;
+  int m_job_id;
+
+public:
+  JoblogCommand(const char *cmd_line);
+  virtual ~JoblogCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `trace on <file>` records spans of what smash does (see trace.h) into file as trace-event JSON,
+ *    `trace off` writes the rest and closes it, `trace` prints where the trace goes.
+ *    SMASH_TRACE=<file> in the environment of smash traces from its start.
+ */
+class TraceCommand : public BuiltInCommand
+{
+  /* variables */
+  bool m_on;
+  std::string m_path;
+
+public:
+  TraceCommand(const char *cmd_line);
+  virtual ~TraceCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `pushd <dir>` changes to dir and pushes the last working directory on the directory stack,
+ *    `pushd` without an argument swaps the working directory with the top of the stack. Both print the stack like dirs.
+ */
+class PushdCommand : public BuiltInCommand
+{
+public:
+  PushdCommand(const char *cmd_line);
+  virtual ~PushdCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `popd` changes to the directory on the top of the directory stack and removes it, then prints the stack.
+ */
+class PopdCommand : public BuiltInCommand
+{
+public:
+  PopdCommand(const char *cmd_line);
+  virtual ~PopdCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `dirs` prints the working directory and then the directory stack from its top, in one line.
+ *    `dirs -v` prints one directory per line with its position, `dirs -c` clears the stack.
+ */
+class DirsCommand : public BuiltInCommand
+{
+  /* variables */
+  bool m_clear;
+  bool m_verbose;
+
+public:
+  DirsCommand(const char *cmd_line);
+  virtual ~DirsCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `z <fragment>...` changes to the directory with the highest frecency (see frecency.h) whose path has every
+ *    fragment in it, in order and ignoring case. Every directory cd, pushd, popd and z change to is a visit.
+ *    `z -l [fragment]...` lists the matches with their scores (the highest last), `z -e <fragment>...` prints the one
+ *    z would change to, `z -a <dir>` adds a visit of dir.
+ *    The database is $SMASH_Z_DATA, or ~/.smash_z.
+ */
+class ZCommand : public BuiltInCommand
+{
+  /* variables */
+  char m_mode; // '\0' to change directory, or the option
+  std::vector<std::string> m_fragments;
+
+public:
+  ZCommand(const char *cmd_line);
+  virtual ~ZCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `bg [job-id]` continues a stopped job in the background, the last stopped one without a job-id.
+ */
+class BackgroundCommand : public BuiltInCommand
+{
+  /* variables */
+  int m_id;
+
+public:
+  BackgroundCommand(const char *cmd_line);
+  virtual ~BackgroundCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `coproc [-r] NAME command` starts a coprocess (see CoprocList) as a job, -r starts it again whenever it exits.
+ *    `coproc` lists them, `coproc -k NAME` closes its stdin, sends it SIGTERM and forgets it.
+ */
+class CoprocCommand : public BuiltInCommand
+{
+  /* variables */
+  char m_mode; // 'l' to list, 's' to start, 'k' to kill
+  bool m_restart;
+  std::string m_name;
+  std::string m_command;
+
+public:
+  CoprocCommand(const char *cmd_line);
+  virtual ~CoprocCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `cosend NAME request` writes a request line to a coprocess and does not wait for its answer.
+ */
+class CosendCommand : public BuiltInCommand
+{
+  /* variables */
+  std::string m_name;
+  std::string m_request;
+
+public:
+  CosendCommand(const char *cmd_line);
+  virtual ~CosendCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `corecv NAME [count]` prints the answers to the oldest count requests in flight (1 by default), it waits
+ *    for the ones that did not come yet.
+ */
+class CorecvCommand : public BuiltInCommand
+{
+  /* variables */
+  std::string m_name;
+  size_t m_count;
+
+public:
+  CorecvCommand(const char *cmd_line);
+  virtual ~CorecvCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `coreq NAME request` sends a request and prints its answer, the answers to the requests that were already
+ *    in flight stay for corecv.
+ */
+class CoreqCommand : public BuiltInCommand
+{
+  /* variables */
+  std::string m_name;
+  std::string m_request;
+
+public:
+  CoreqCommand(const char *cmd_line);
+  virtual ~CoreqCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `memo [-c] [--inputs <file>... --] <command>` runs the command once and then replays what it printed (stdout,
+ *    then stderr) and its exit status for as long as nothing it depends on changed: the command line, the cwd, $PATH,
+ *    the locale variables and $TZ, and the size and mtime of the input files (their content as well with -c).
+ *    The stdin of the command is not part of it. The outputs are kept in $SMASH_MEMO_DIR (~/.smash_memo) up to
+ *    $SMASH_MEMO_MAX bytes (K, M or G, 256M by default) and the least recently used go first (see MemoCache).
+ *    A run that was interrupted or killed by a signal is not kept. `memo stats` prints the hits, the misses, the
+ *    hit rate, the time the hits saved and the size of the cache.
+ *    Only external commands (and pipelines and redirections of them) are memoized, a hit must not skip what a
+ *    builtin does to smash (cd, export).
+ */
+class MemoCommand : public BuiltInCommand
+{
+  /* variables */
+  bool m_stats;
+  bool m_content;
+  std::vector<std::string> m_inputs;
+  std::string m_command_line;
+  Command *m_command;
+
+  /* methods */
+  // what the output depends on, false (and printed) when an input can not be looked at
+  bool _key(std::string &key);
+  // runs the command with its stdout and stderr in out_fd and err_fd
+  void _run_captured(int out_fd, int err_fd);
+
+public:
+  MemoCommand(const char *cmd_line);
+  virtual ~MemoCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `export` prints the exported variables, `export NAME[=value]...` sets and exports them.
+ */
+class ExportCommand : public BuiltInCommand
+{
+public:
+  ExportCommand(const char *cmd_line);
+  virtual ~ExportCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `unset NAME...` removes the variables.
+ */
+class UnsetCommand : public BuiltInCommand
+{
+public:
+  UnsetCommand(const char *cmd_line);
+  virtual ~UnsetCommand();
+  void execute() override;
+};
+
+/**
+ * @brief A line of only `NAME=value` words sets shell variables, they are not exported unless they already were.
+ */
+class AssignmentCommand : public BuiltInCommand
+{
+public:
+  AssignmentCommand(const char *cmd_line);
+  virtual ~AssignmentCommand();
+  void execute() override;
+};
+
+/* *
+ * The OutputRing class
+ * The last bytes of an output, in a ring of a fixed size that is allocated as the output comes.
+ */
+
+class OutputRing
+{
+public:
+  explicit OutputRing(size_t capacity);
+  void append(const char *data, size_t size);
+  // the bytes after offset (counted from the start of the output), the ones that were overwritten are skipped
+  std::string since(unsigned long long offset) const;
+  // the bytes written so far, the offset of the next one
+  unsigned long long written() const { return m_written; }
+
+private:
+  std::vector<char> m_data;
+  size_t m_capacity;
+  unsigned long long m_written;
+};
+
 /* *
  * The JobsList class
  */
@@ -311,18 +839,73 @@ public:
   class JobEntry
   {
   public:
+    /* types */
+    struct Member
+    {
+      pid_t pid;
+      int pidfd; // -1 if it could not be opened
+    };
+    // a background command that waits in the admission queue, it did not start yet
+    struct Queued
+    {
+      Command *command; // owned by the list until it starts or is cancelled
+      int fds[4];       // the stdin, stdout, stderr and working directory it was submitted with
+      int priority;     // $JOBPRIO when it was submitted, a higher one starts first
+      unsigned long long order; // the ones with the same priority start in this order
+    };
+
     /* methods */
-    JobEntry(const std::string& cmd, pid_t job_pid, int job_id);
+    JobEntry(const std::string &cmd, pid_t pgid, const std::vector<Member> &members, int job_id);
+    JobEntry(const std::string &cmd, const Queued &queued, int job_id);
     ~JobEntry();
     const std::string &getCMDLine();
     pid_t getJobPid();
     int getJobID();
+    pid_t getPgid();
+    const std::vector<Member> &getMembers();
+    bool hasUntrackedMembers();
+    // reaps the members that finished, returns true when none is left
+    bool reapMembers();
+    // reaps one member that is known to have exited, returns true when none is left
+    bool reapMember(pid_t pid);
+    // the status of the last member of the pipeline (valid once it was reaped)
+    int getStatus();
+    // signals the whole group in one call and keeps the stopped state, returns -1 on failure
+    int sendSignal(int sig);
+    // stopped by ctrl-Z, SIGSTOP or SIGTSTP through kill, until bg, fg or SIGCONT
+    bool isStopped() const { return m_stopped; }
+    void setStopped(bool stopped) { m_stopped = stopped; }
+    // taken back from the journal of a smash that exited: not a son, its exit is seen through the pidfds only
+    bool isAdopted() const { return m_adopted; }
+    void setAdopted(bool adopted) { m_adopted = adopted; }
+    void closePidfds();
+    // CLOCK_MONOTONIC in ms, when the job was added to the list
+    long long getStartTime();
+    bool isQueued() const { return m_queued.command != nullptr; }
+    const Queued &getQueued() const { return m_queued; }
+    // closes the fds of a queued job and deletes its command, like the pidfds it is done by JobsList
+    void releaseQueued();
 
   private:
     /* variables */
     std::string m_command;
-    pid_t m_job_pid; // since the job is run in the background we must have used fork()
-    int m_job_id;    // the job id in the list
+    pid_t m_job_pid;               // the process group leader (the job itself if its not a pipeline)
+    std::vector<Member> m_members; // every process of the group that was not reaped yet
+    pid_t m_last_member;           // its status is the status of the job
+    int m_status;
+    int m_job_id;                  // the job id in the list
+    long long m_start_ms;          // not the wall clock, a change of the system time does not change the elapsed time
+    Queued m_queued;               // command is nullptr once the job runs
+    bool m_stopped;
+    bool m_adopted;
+  };
+
+  // the limits a background command has to be under to start right away
+  struct Admission
+  {
+    size_t max_running;         // 0 for no limit
+    double max_cpu_pressure;    // the `some avg10` of /proc/pressure/cpu in %, 0 to not look at it
+    double max_memory_pressure; // the same of /proc/pressure/memory
   };
 
   /* methods */
@@ -330,16 +913,283 @@ public:
   JobsList();
   ~JobsList();
   void addJob(Command *cmd, pid_t pid);
+  void addJob(Command *cmd, pid_t pgid, const std::vector<pid_t> &members);
+  // job_id 0 is the next id, else a job that left the list comes back (a stopped fg) and keeps its id and log
+  int addJob(const std::string &cmd_line, pid_t pgid, const std::vector<pid_t> &members, int job_id = 0);
   void printJobsList();
+  // SIGKILL to every job and reaps them all, the queued ones are dropped and the logs closed
   void killAllJobs();
+  // sends sig to every job at once and prints it, SIGCONT too so a stopped job handles it. the queued ones are dropped
+  void signalAllJobs(int sig);
+  // reaps the jobs as they exit until none is left or deadline_ms (CLOCK_MONOTONIC, -1 for none), returns how many are
+  // left
+  size_t waitAllJobs(long long deadline_ms);
+  // sleeps until a member exits or deadline_ms (-1 for none) and reaps whatever exited, false if the sleep failed or
+  // was interrupted by a signal (errno tells)
+  bool waitForExits(long long deadline_ms);
   void removeFinishedJobs();
   JobEntry *getJobById(int jobId);
   void removeJobById(int jobId);
   JobEntry *getLastJob();
+  // the stopped job with the highest id, nullptr if none is stopped
+  JobEntry *getLastStoppedJob();
+  std::vector<int> getJobIds() const;
+  // the status of a job that was already removed from the list, false if it is not known
+  bool getFinishedStatus(int jobId, int *status) const;
+  // reaps a member whose pidfd reported its exit, removes the job and returns true if it was the last one
+  bool reapMember(int jobId, pid_t pid);
+  // readable when a member of a job exits (or when the queue should be looked at again), -1 without pidfds
+  int getExitEventsFd() const { return m_exit_events_fd; }
+  // journals the running jobs from now on (see JobJournal) and takes back the jobs of the smash that owned the journal
+  // before, if they still run. adopted gets their ids. false with errno when there is no journal
+  bool openJournal(const std::string &base, std::vector<int> &adopted);
+
+  // * admission control
+  const Admission &getAdmission() const { return m_admission; }
+  void setAdmission(const Admission &admission);
+  // false when a background command has to wait in the queue: too many jobs run, the pressure is too high,
+  // or others wait before it
+  bool admits();
+  // queues a background command as a job that did not start, the list takes the command. false if it can not
+  bool queueJob(Command *cmd, int priority);
+  // starts the queued jobs, the first ones by priority and then by the order they came, while admits() allows.
+  // only in the process that made the list, a son that started its copy of the queue would run a job twice
+  void admitQueuedJobs();
+  // starts a queued job now, admitted or not (fg), false if it is not queued
+  bool startQueuedJob(int jobId);
+  // removes a queued job without starting it, `wait` gets the status of a job killed by sig
+  bool cancelQueuedJob(int jobId, int sig);
+  size_t queuedCount() const { return m_queue.size(); }
+
+  // * output capture
+  void setCapture(bool capture) { m_capture = capture; }
+  bool isCapturing() const { return m_capture; }
+  // before a background command starts: its stdout and stderr become a pipe, the job addJob adds gets it.
+  // false when nothing is captured (capture is off, or there is no room left for another log)
+  bool beginCapture();
+  // after the command started: stdout and stderr are those of smash again
+  void endCapture();
+  // the log of a job that is captured (or finished a short while ago), nullptr if there is none
+  const OutputRing *getLog(int jobId) const;
+  // the pipe of the log, -1 when every process that could write to it closed it
+  int getLogFd(int jobId) const;
+  // reads what is in the pipe of the log, removeFinishedJobs does it when the exit events say so.
+  // only in the process that made the list, what a son read from the pipe would never get to the log of smash
+  void drainLog(int jobId);
+  bool hasOpenLogs() const { return m_open_logs > 0; }
+  // the `some avg10` of /proc/pressure/<resource> in %, -1 when it can not be read
+  static double readPressure(const char *resource);
+
+private:
+  /* variables */
+  static const size_t MAX_FINISHED_STATUSES = 4096;
+  static const size_t LOG_SIZE = 64 * 1024;         // of every job
+  static const size_t LOGS_TOTAL = 64 * LOG_SIZE;   // of all the jobs together
+  static const long long LOG_KEEP_MS = 60 * 1000;   // after the job finished
+
+  /* types */
+  struct Log
+  {
+    OutputRing ring;
+    int fd;                // the read end of the pipe, -1 once it was closed by all its writers
+    long long finished_ms; // when the job finished, 0 while it runs
+  };
+
+  std::map<int, JobEntry> m_jobs; // by job id, so an exit event finds its job without a scan
+  std::map<int, int> m_finished_statuses; // job id -> status of the jobs that finished
+  int m_exit_events_fd;                   // epoll of the pidfds of all members, readable when one exits
+  std::map<pid_t, int> m_untracked;       // pid -> job id of the members without a pidfd (too many open files)
+  Admission m_admission;
+  std::set<std::tuple<int, unsigned long long, int>> m_queue; // (-priority, order, job id) of the queued jobs
+  unsigned long long m_queue_order;
+  int m_starting_job_id; // a queued job that starts keeps its id, addJob gives it this one
+  int m_admission_timer_fd; // in the exit events set, the pressure is checked again while jobs wait for it
+  bool m_admission_timer_armed;
+  bool m_capture;
+  std::map<int, Log> m_logs; // by job id, a log is dropped when its id is reused
+  size_t m_open_logs;        // the logs with a pipe, the exit events set has to be watched for them
+  int m_capture_fd;          // the read end of the pipe of the job that starts now, -1 when none
+  int m_saved_fds[2];        // the stdout and stderr of smash while it starts
+  JobJournal m_journal;
+  pid_t m_owner_pid; // a son forked from smash has a copy of the list, the jobs, the queue and the logs are not its own
+
+  /* methods */
+  // true when one more job may start, the queue aside
+  bool hasRoom();
+  bool isOwner() const { return getpid() == m_owner_pid; }
+  // the timer runs while jobs wait and the pressure is looked at, a job that exits does not free the pressure
+  void updateAdmissionTimer();
+  void closeLog(Log &log);
+  // drops the logs of finished jobs after LOG_KEEP_MS, or the oldest ones before that when room is needed
+  void dropLogs(bool make_room);
+  // puts the pidfd of a member in the exit events set, or the member in the untracked ones when it has none
+  void watchMember(int job_id, const JobEntry::Member &member);
+  // removes a job from the list and from the index of the untracked members
+  void eraseJob(std::map<int, JobEntry>::iterator it);
+  // the untracked members that exited, found without a waitpid for every one of them
+  void reapUntrackedMembers();
+};
+
+/* *
+ * The Environment class
+ * The variables of the shell, the exported ones are passed to the sons.
+ * The envp block is kept ready for exec and only rebuilt after a variable changed.
+ */
+
+class Environment
+{
+public:
+  /* methods */
+  Environment(); // starts with the environment smash got
+  ~Environment();
+  // false if the variable is not set
+  bool get(const std::string &name, std::string &value) const;
+  void set(const std::string &name, const std::string &value);
+  void setExported(const std::string &name);
+  void unset(const std::string &name);
+  void printExported() const;
+
+  // the NULL terminated block of the exported variables
+  char **envp();
+  // the block with `NAME=value` overrides on top, only pointers are copied (meant for the son after fork)
+  std::vector<char *> envp(const std::vector<std::string> &overrides);
+
+private:
+  /* types */
+  struct Variable
+  {
+    std::string entry; // "NAME=value", what envp points to
+    bool exported;
+    bool assigned; // false after `export NAME` of a variable that was not set: it is not set and not in envp yet
+  };
+
+  /* variables */
+  std::map<std::string, Variable> m_variables;
+  std::vector<char *> m_envp;
+  bool m_envp_changed;
+};
+
+/* *
+ * The Scheduler class
+ * The commands of `at` and `every` in a min-heap by the time of their next run, one timerfd is armed for the first.
+ * The heap keeps the position of every entry, so scheduling, cancelling and running one are O(log n).
+ */
+
+class Scheduler
+{
+public:
+  /* types */
+  struct Entry
+  {
+    int id;
+    std::string command;
+    long long next_ms;     // CLOCK_MONOTONIC
+    long long interval_ms; // 0 for `at`, it runs once
+    bool overlap;          // runs even while the job of its last run did not finish
+    int last_job_id;       // the job of its last run, 0 before the first one
+    pid_t last_job_pid;    // a job id is reused, the pid tells if it is still the same job
+  };
+
+  /* methods */
+  Scheduler();
+  ~Scheduler();
+  Scheduler(Scheduler const &) = delete;
+  void operator=(Scheduler const &) = delete;
+  // returns the id of the new entry
+  int add(const std::string &command, long long next_ms, long long interval_ms, bool overlap);
+  // false if there is no entry with the id
+  bool remove(int id);
+  // takes out the entries that are due, the recurring ones go back with their next run after now
+  std::vector<Entry> takeDue(long long now_ms);
+  void setLastJob(int id, int job_id, pid_t job_pid);
+  // the entries in the order they run next
+  std::vector<Entry> getEntries() const;
+  // readable when the first entry is due, -1 when the timerfd could not be created
+  int getTimerFd() const { return m_timer_fd; }
+
+private:
+  /* variables */
+  std::vector<Entry> m_heap;
+  std::map<int, size_t> m_positions; // id -> index of the entry in the heap
+  int m_timer_fd;
+  int m_next_id;
+  long long m_armed_ms; // the deadline the timerfd is set to, -1 when it is disarmed
+
+  /* methods */
+  static bool earlier(const Entry &a, const Entry &b);
+  void swapEntries(size_t a, size_t b);
+  void siftUp(size_t index);
+  void siftDown(size_t index);
+  void removeAt(size_t index);
+  // sets the timerfd to the first entry, only when that changed
+  void arm();
+};
+
+/* *
+ * The CoprocList class
+ * Named coprocesses: commands that keep running with their stdin and stdout on pipes of smash, for tools that are slow
+ * to start and then answer a line for every line they read. A request is written without waiting for its answer, so
+ * many can be in flight, and the answers are taken in the order the requests were sent. SmallShell starts them (as
+ * jobs) and starts again the ones that should restart when their job is gone.
+ */
+
+class CoprocList
+{
+public:
+  /* types */
+  struct Coproc
+  {
+    std::string name;
+    std::string command;
+    bool restart;                    // started again when it exits
+    pid_t pid;                       // -1 while it does not run
+    int job_id;                      // its job in the jobs list
+    int to_fd;                       // the write end of its stdin, -1 while it does not run
+    int from_fd;                     // the read end of its stdout
+    std::string partial;             // read from it and not a whole line yet
+    std::deque<std::string> answers; // whole lines that no request took yet
+    size_t in_flight;                // requests whose answer was not taken yet
+    unsigned int restarts;
+    unsigned int quick_exits;        // in a row, each one less than QUICK_EXIT_MS after it started
+    long long start_ms;              // CLOCK_MONOTONIC
+  };
+
+  /* methods */
+  CoprocList();
+  ~CoprocList();
+  CoprocList(CoprocList const &) = delete;
+  void operator=(CoprocList const &) = delete;
+  // false if there is one with the name already, it does not run until setRunning
+  bool add(const std::string &name, const std::string &command, bool restart);
+  // closes its pipes (it reads EOF) and forgets it, it is not started again
+  bool remove(const std::string &name);
+  // nullptr if there is none with the name
+  Coproc *get(const std::string &name);
+  // by name
+  std::vector<Coproc *> getCoprocs();
+  size_t size() const { return m_coprocs.size(); }
+  // it runs from now on with the given ends of its pipes, they are made non blocking
+  void setRunning(Coproc &coproc, pid_t pid, int job_id, int to_fd, int from_fd);
+  // it exited: closes its pipes, the requests in flight and the answers that were not taken are lost
+  void setExited(Coproc &coproc);
+  // writes a request (line and a new line), reading its answers meanwhile so that neither pipe fills up.
+  // false with errno: EPIPE when it exited, EINTR when cancelled
+  bool send(Coproc &coproc, const std::string &line, const std::function<bool()> &cancelled);
+  // takes the answer to a request in flight, index 0 is the oldest one. false with errno like send, ENOENT when
+  // fewer requests are in flight
+  bool receive(Coproc &coproc, size_t index, std::string &answer, const std::function<bool()> &cancelled);
+
+  static const long long QUICK_EXIT_MS = 1000;
+  // a coprocess that exits right after it started this many times in a row is not started again
+  static const unsigned int MAX_QUICK_EXITS = 3;
 
 private:
   /* variables */
-  std::vector<JobEntry> m_jobs;
+  std::map<std::string, Coproc> m_coprocs;
+
+  /* methods */
+  // reads what it wrote so far, false at EOF or on an error (errno)
+  bool fill(Coproc &coproc);
 };
 
 /* *
@@ -353,43 +1203,121 @@ public:
   static const std::string DEFAULT_PROMPT; // originally set to "smash" (in .cpp)
 
   /* methods */
-  Command *CreateCommand(const char *cmd_line);
+  // expanded: the line was already expanded (a part of a pipeline or a redirection), do not expand it again
+  Command *CreateCommand(const char *cmd_line, bool expanded = false);
   SmallShell(SmallShell const &) = delete;     // disable copy ctor
   void operator=(SmallShell const &) = delete; // disable = operator
-  static SmallShell &getInstance()             // make SmallShell singleton
+  static SmallShell &getInstance() // make SmallShell singleton
   {
+    // the process the daemon forked for a client serves it with a session of its own, the session is the instance
+    if (s_session)
+    {
+      return *s_session;
+    }
     static SmallShell instance; // Guaranteed to be destroyed.
     // Instantiated on first use.
     return instance;
   }
+  // a new session with a state of its own (prompt, jobs, variables, statuses) for a client of the daemon
+  static SmallShell *createSession();
+  // the session getInstance() returns until it is set back to nullptr
+  static void setSession(SmallShell *session);
+  bool isSession() const { return s_session == this; }
+  // set by the ctrl-C handler, a builtin that loops (watch) checks it between its runs
+  void setInterrupted(bool interrupted) { m_interrupted = interrupted; }
+  bool wasInterrupted() const { return m_interrupted; }
+  // after quit the line stops, smash exits once it returns to its loop. quit in a session ends the session and not the
+  // daemon
+  void quit() { m_quit = true; }
+  bool hasQuit() const { return m_quit; }
   ~SmallShell();
-  void executeCommand(const char *cmd_line);
+  void executeCommand(const char *cmd_line, bool expanded = false);
+  // replaces $VAR, ${VAR}, $?, $$, ${PIPESTATUS[...]} and $(...) in the line. for_bash gets the same line with the
+  // values escaped for bash -c, which would run a `$(...)` or a `;` in them. the | > & ; of a value are marked, so
+  // they do not make the line a pipe, a redirection or a background command
+  std::string expand(const std::string &cmd_line, std::string *for_bash = nullptr);
+  // runs the command and returns what it printed without the trailing new lines
+  std::string substituteCommand(const std::string &cmd_line);
+  // runs a command line in a son of smash and exits with its status
+  [[noreturn]] void runInSon(const std::string &cmd_line, bool expanded);
+  // runs a command that was already created (nullptr if it could not be) in a son of smash
+  [[noreturn]] void runInSon(Command *cmd);
 
   JobsList &getJobsList();
+  Environment &getEnvironment();
+  Scheduler &getScheduler();
+  CoprocList &getCoprocs();
+  // starts a coprocess of the list as a job in its own process group, false after printing why it could not
+  bool startCoproc(CoprocList::Coproc &coproc);
+  // notices the coprocesses whose job is gone and starts again the ones that should restart
+  void reviveCoprocs();
+  // starts the scheduled commands that are due, $? and PIPESTATUS stay those of the last line
+  void runDueSchedules();
   const std::string &getPrompt() const;
   void setPrompt(const std::string &newPrompt);
 
-  const pid_t getCurrForegroundPID() const
-  {
-    return m_currForegroundPID;
-  }
+  // the process group of the foreground job, -1 while there is none (the ctrl-C and ctrl-Z handlers forward to it)
+  pid_t getForegroundPgid() const { return m_foreground_pgid; }
+  // smash hands the terminal to its foreground jobs, only when it is interactive and in the foreground of fd itself
+  void enableJobControl(int terminal_fd);
+  // the jobs go to the journal $SMASH_JOURNAL (~/.smash_jobs when smash is interactive) and the jobs a smash that
+  // exited left there are taken back and printed
+  void openJournal();
+  /**
+   * waits for the members of a foreground job (all of them in the group pgid) and sets the status of each one.
+   * resume continues a stopped job once it has the terminal. When the job stops (ctrl-Z) it goes back to the jobs list
+   * as stopped (as job_id if it is not 0), every member that did not exit gets 128 + the signal and false is returned
+   */
+  bool waitForeground(const std::string &cmd_line, pid_t pgid, const std::vector<pid_t> &members,
+                      std::vector<int> &statuses, int job_id = 0, bool resume = false);
 
-  void setCurrForegroundPID(pid_t pid)
-  {
-    m_currForegroundPID = pid;
-  }
+  int getLastStatus() const { return m_last_status; }
+  const std::vector<int> &getPipeStatus() const { return m_pipe_status; }
+  bool isPipefail() const { return m_pipefail; }
+  // false in the sons of smash (pipeline stages), they stay in the process group they were given
+  bool ownsProcessGroups() const { return getpid() == m_smash_pid; }
+  void setPipefail(bool pipefail) { m_pipefail = pipefail; }
+  // the last working directory for `cd -`, empty until cd succeeds once
+  const std::string &getOldPwd() const { return m_old_pwd; }
+  void setOldPwd(const std::string &old_pwd) { m_old_pwd = old_pwd; }
+  // the logical working directory, empty if smash could not find out where it started
+  const std::string &getCwd() const { return m_cwd; }
+  // changes the working directory (path is relative to the logical one) and updates PWD and OLDPWD, false with errno
+  bool changeDir(const std::string &path);
+  // the directories of pushd, the top is the last one
+  std::vector<std::string> &getDirStack();
 
 private:
+  /* static variables */
+  static SmallShell *s_session;
+
   /* variables */
   std::string m_prompt; // originally set to DEFAULT_PROMPT
   JobsList m_background_jobs;
+  Environment m_environment;
+  Scheduler m_scheduler;
+  CoprocList m_coprocs;
+
+  volatile sig_atomic_t m_foreground_pgid;
+  int m_terminal_fd;              // -1 without job control
+  struct termios m_terminal_modes; // restored when a job stops or is killed, it may have left the terminal raw
 
-  pid_t m_currForegroundPID;
+  int m_last_status;              // $?
+  std::vector<int> m_pipe_status; // PIPESTATUS of the last pipeline
+  bool m_pipefail;
+  pid_t m_smash_pid;
+  std::string m_old_pwd;
+  std::string m_cwd;
+  std::vector<std::string> m_dir_stack;
+  bool m_quit;
+  volatile sig_atomic_t m_interrupted;
 
   /* methods */
   SmallShell(); // private c'tor
 
-  Command *CreateCommand_aux(const char *cmd_line);
+  Command *CreateCommand_aux(const char *cmd_line, bool expanded);
+  // the builtins and the external commands (everything that is not a list, a redirection or a pipe)
+  Command *CreateSimpleCommand(const char *cmd_line);
 };
 
 #endif // SMASH_COMMAND_H_
@@ -0,0 +1,84 @@
+#!/bin/bash
+# chmod -R of smash (chmod.h) against coreutils chmod -R: the same modes on copies of a small generated tree must
+# give the same modes, then both change a generated tree of a million entries (files, directories, symbolic links).
+# The check runs the walk with 1 and with 8 threads whatever the CPUs are.
+# usage: bench/chmod.sh [entries]
+
+DIR=$(dirname "$0")
+ENTRIES=${1:-1000000}
+WORK=$(mktemp -d)
+BINARY="$WORK/chmod_tree"
+trap 'rm -rf "$WORK"' EXIT
+g++ --std=c++11 -O2 -Wall -pthread -o "$BINARY" "$DIR/chmod_tree.cpp" "$DIR/../chmod.cpp" || exit 1
+
+# entries spread over nested directories of up to 100 entries, every 50th is a symbolic link out of the tree
+generate()
+{
+  python3 - "$1" "$2" <<'PY'
+import os, sys
+root, count = sys.argv[1], int(sys.argv[2])
+made, queue = 0, [root]
+os.makedirs(root)
+while made < count:
+    parent = queue.pop(0)
+    for i in range(100):
+        if made >= count:
+            break
+        path = os.path.join(parent, "e%d" % i)
+        if i % 10 == 0:
+            os.mkdir(path)
+            queue.append(path)
+        elif i % 50 == 1:
+            os.symlink("/etc/hostname", path)
+        else:
+            open(path, "w").close()
+        made += 1
+    if not queue:
+        queue.append(parent)
+PY
+}
+
+modes()
+{
+  find "$1" -printf '%m %y %P\n' | sort
+}
+
+# every mode on copies of the small tree, the same modes as coreutils or the script stops
+compare()
+{
+  for mode in "$@"; do
+    for threads in 1 8; do
+      cp -a "$WORK/small" "$WORK/ours"
+      cp -a "$WORK/small" "$WORK/theirs"
+      CHMOD_TREE_THREADS=$threads "$BINARY" "$mode" "$WORK/ours" 2>/dev/null
+      chmod -R "$mode" "$WORK/theirs" 2>/dev/null
+      if ! diff <(modes "$WORK/ours") <(modes "$WORK/theirs") >/dev/null; then
+        echo "chmod: $mode with $threads threads differs from coreutils"
+        diff <(modes "$WORK/ours") <(modes "$WORK/theirs") | head
+        exit 1
+      fi
+      rm -rf "$WORK/ours" "$WORK/theirs"
+    done
+  done
+}
+
+generate "$WORK/small" 5000
+chmod -R 640 "$WORK/small" 2>/dev/null
+chmod -R u+rwx "$WORK/small"
+compare 755 0640 u+x,g-w a=rX go-rwx u=g +t o+t o+w,a-x g+s 700,a+X
+# directories with the set-id and the sticky bits: they keep the set-id bits unless the mode names them
+chmod -R 6755 "$WORK/small"
+find "$WORK/small" -type d -exec chmod 7755 {} +
+compare 755 0755 00755 2700 o=rx u=rwx a=rwx g-s u-s,o-t go=u
+echo "chmod: every mode agrees with coreutils"
+
+generate "$WORK/big" "$ENTRIES"
+sync
+for round in 1 2; do
+  mode=$([ $round = 1 ] && echo 750 || echo go-w)
+  start=$(date +%s%N)
+  chmod -R "$mode" "$WORK/big"
+  echo "coreutils chmod -R $mode: $(( ($(date +%s%N) - start) / 1000000 )) ms"
+  "$BINARY" "$mode" "$WORK/big"
+  CHMOD_TREE_THREADS=8 "$BINARY" "$mode" "$WORK/big"
+done
@@ -0,0 +1,41 @@
+/**
+ * chmod -R of smash (ChmodTree of chmod.h) outside of smash, for bench/chmod.sh: changes the paths, prints the
+ * failures and the time the walk took to stderr.
+ * usage: [CHMOD_TREE_THREADS=n] chmod_tree <mode> <path>...
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include "../chmod.h"
+
+static long long _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+  ModeSpec spec;
+  if (argc < 3 || !spec.parse(argv[1]))
+  {
+    std::cerr << "usage: chmod_tree <mode> <path>...\n";
+    return 1;
+  }
+  std::vector<std::string> roots(argv + 2, argv + argc);
+  const char *threads = getenv("CHMOD_TREE_THREADS");
+  ChmodTree tree(spec, nullptr, threads ? strtoul(threads, nullptr, 10) : 0);
+  long long start = _now_ns();
+  tree.run(roots);
+  long long took = _now_ns() - start;
+  for (const std::string &error : tree.errors())
+  {
+    std::cerr << "chmod_tree: " << error << "\n";
+  }
+  std::cerr << "chmod_tree: " << (threads ? threads : std::to_string(ChmodTree::threads())) << " threads, " << tree.changed() << " changed, "
+            << tree.failed() << " failed, " << took / 1000000 << " ms\n";
+  return tree.failed() == 0 ? 0 : 1;
+}
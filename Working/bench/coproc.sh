@@ -0,0 +1,50 @@
+#!/bin/bash
+# Requests to a tool that is slow to start (a python interpreter): a new process for every request against one
+# coprocess (`coproc`), one request at a time (`coreq`) and all of them in flight before the answers are read
+# (`cosend` then `corecv`). The time between two `date` commands divided by the requests is the cost of one.
+# usage: bench/coproc.sh [smash binary] [requests]
+
+SMASH=${1:-./smash}
+N=${2:-500}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# answers a request (a number) with its square, from its arguments or from every line it reads
+cat > "$WORK/worker.py" <<'PY'
+import sys, json, decimal  # the imports stand for the start up of a real tool
+if len(sys.argv) > 1:
+    print(int(sys.argv[1]) ** 2)
+else:
+    for line in sys.stdin:
+        print(int(line) ** 2, flush=True)
+PY
+
+run() # <setup line> <request line, N is replaced by the number> [line after the requests], prints us per request
+{
+  local input="$WORK/input"
+  echo "$1" > "$input"
+  echo "date +%s%N" >> "$input"
+  for ((i = 0; i < N; i++)); do
+    echo "${2//N/$i}" >> "$input"
+  done
+  [ -n "$3" ] && echo "$3" >> "$input"
+  echo "date +%s%N" >> "$input"
+  echo "quit kill" >> "$input"
+  "$SMASH" < "$input" 2> /dev/null > "$WORK/output"
+  grep -o "[0-9]\{19\}" "$WORK/output" | awk -v n="$N" 'NR == 1 { start = $1 } NR == 2 { printf "%.1f\n", ($1 - start) / 1000 / n }'
+}
+
+# the last answer must be the square of the last request
+check() # <name> <setup> <request> [after]
+{
+  "$SMASH" < <(echo "$2"; for ((i = 0; i < N; i++)); do echo "${3//N/$i}"; done; [ -n "$4" ] && echo "$4"; echo "quit kill") \
+    2> /dev/null | grep -q "$(((N - 1) * (N - 1)))$" || { echo "coproc: $1 did not answer"; exit 1; }
+}
+
+check "coreq" "coproc w python3 $WORK/worker.py" "coreq w N"
+check "cosend" "coproc w python3 $WORK/worker.py" "cosend w N" "corecv w $N"
+
+printf "%-40s %12s\n" "requests of $N" "us/request"
+printf "%-40s %12s\n" "python3 worker.py N (a process each)" "$(run "" "python3 $WORK/worker.py N")"
+printf "%-40s %12s\n" "coreq w N" "$(run "coproc w python3 $WORK/worker.py" "coreq w N")"
+printf "%-40s %12s\n" "cosend w N, then corecv w $N" "$(run "coproc w python3 $WORK/worker.py" "cosend w N" "corecv w $N")"
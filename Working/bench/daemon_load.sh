@@ -0,0 +1,84 @@
+#!/bin/bash
+# Load test of `smash --daemon`: concurrent clients, each with a session of its own.
+# Every client changes its prompt and its directory and checks that it sees only its own state,
+# then the time is compared with starting a new smash for every command line.
+# usage: bench/daemon_load.sh [smash binary] [clients] [lines per client]
+
+SMASH=${1:-./smash}
+CLIENTS=${2:-100}
+LINES=${3:-50}
+
+WORK=$(mktemp -d)
+SOCK="$WORK/smash.sock"
+trap 'kill $DAEMON 2> /dev/null; rm -rf "$WORK"' EXIT
+
+"$SMASH" --daemon "$SOCK" &
+DAEMON=$!
+for ((i = 0; i < 50; i++)); do
+  [ -S "$SOCK" ] && break
+  sleep 0.1
+done
+
+for ((c = 0; c < CLIENTS; c++)); do
+  mkdir "$WORK/d$c"
+  {
+    echo "chprompt c$c"
+    echo "cd $WORK/d$c"
+    for ((i = 0; i < LINES; i++)); do
+      echo "pwd"
+    done
+    echo "quit"
+  } > "$WORK/in$c"
+done
+
+start=$(date +%s%N)
+for ((c = 0; c < CLIENTS; c++)); do
+  "$SMASH" --client "$SOCK" < "$WORK/in$c" > "$WORK/out$c" 2>&1 &
+done
+wait $(jobs -p | grep -v "^$DAEMON\$")
+end=$(date +%s%N)
+
+failed=0
+for ((c = 0; c < CLIENTS; c++)); do
+  # the prompt and the directory of the other sessions must never show up
+  if [ "$(grep -o "c$c> $WORK/d$c\$" "$WORK/out$c" | wc -l)" -ne "$LINES" ] ||
+    grep -o "c[0-9]*> " "$WORK/out$c" | grep -qv "^c$c> "; then
+    failed=$((failed + 1))
+  fi
+done
+total=$((CLIENTS * (LINES + 3)))
+printf "%-28s %3d clients %6d lines %10.2f us/line  %d sessions failed\n" "smash --daemon" "$CLIENTS" "$total" \
+  "$(awk -v ns=$((end - start)) -v n="$total" 'BEGIN { print ns / 1000 / n }')" "$failed"
+
+# the same lines with a new smash for every line (cd and chprompt would not even stick)
+start=$(date +%s%N)
+for ((i = 0; i < total / 10; i++)); do
+  echo "pwd" | "$SMASH" > /dev/null 2>&1
+done
+end=$(date +%s%N)
+printf "%-28s %3s         %6d lines %10.2f us/line\n" "smash per line" "" "$((total / 10))" \
+  "$(awk -v ns=$((end - start)) -v n=$((total / 10)) 'BEGIN { print ns / 1000 / n }')"
+
+# the output may hold any byte, a NUL does not end the response of a line
+printf 'printf a\\000b\\n\necho after\nquit\n' | "$SMASH" --client "$SOCK" > "$WORK/nul" 2>&1
+if ! printf 'smash> a\000b\nsmash> after\nsmash> ' | cmp -s - "$WORK/nul"; then
+  echo "smash --daemon: a NUL in the output cut the response"
+  failed=$((failed + 1))
+fi
+
+# a long foreground command of one session does not hold the lines of another one
+printf 'sleep 2\nquit\n' | "$SMASH" --client "$SOCK" > /dev/null 2>&1 &
+SLOW=$!
+sleep 0.2
+start=$(date +%s%N)
+printf 'echo hi\nquit\n' | "$SMASH" --client "$SOCK" > "$WORK/fast" 2>&1
+end=$(date +%s%N)
+wait $SLOW
+latency=$(((end - start) / 1000000))
+printf "%-28s %10d ms for a line while another session runs sleep 2\n" "smash --daemon" "$latency"
+if [ "$latency" -ge 1000 ] || ! grep -q "^smash> hi$" "$WORK/fast"; then
+  echo "smash --daemon: the sleep of one session held the line of another"
+  failed=$((failed + 1))
+fi
+
+[ "$failed" -eq 0 ]
@@ -0,0 +1,166 @@
+/**
+ * Checks the frecency database of z (frecency.h) and measures its queries.
+ * check: several processes visit the same database at once, across its growth from the initial capacity, and every
+ * visit must be counted once in the end.
+ * bench: 100k directories, then the time of a z lookup (best) and of a full listing (query) for a few fragments.
+ * Built and run by bench/frecency.sh.
+ * usage: frecency check <file> | frecency bench <file> [entries]
+ */
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../frecency.h"
+
+static const long long NOW = 1700000000;
+
+static long long _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static std::string _directory(std::mt19937 &random)
+{
+  static const char *PARTS[] = {"home", "user", "src", "projects", "build", "lib", "include", "docs", "tests",
+                                "Release", "Debug", "node_modules", "vendor", "tmp", "var", "log", "cache"};
+  std::string path;
+  int depth = 2 + random() % 5;
+  for (int i = 0; i < depth; i++)
+  {
+    path += "/";
+    path += PARTS[random() % 17];
+  }
+  return path + "/d" + std::to_string(random() % 1000000);
+}
+
+// * check
+
+static int _check(const std::string &file)
+{
+  const int WRITERS = 4;
+  const int VISITS = 3000; // each writer, enough to grow the database from its initial capacity a few times
+  unlink(file.c_str());
+  for (int writer = 0; writer < WRITERS; writer++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      Frecency &frecency = Frecency::getInstance();
+      frecency.setPath(file);
+      for (int i = 0; i < VISITS; i++)
+      {
+        // a directory of its own and one that every writer visits
+        if (!frecency.visit("/w" + std::to_string(writer) + "/" + std::to_string(i), NOW) ||
+            !frecency.visit("/shared/" + std::to_string(i % 10), NOW))
+        {
+          perror("frecency: visit");
+          _exit(1);
+        }
+      }
+      _exit(0);
+    }
+  }
+  bool failed = false;
+  for (int writer = 0; writer < WRITERS; writer++)
+  {
+    int status;
+    wait(&status);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+
+  Frecency &frecency = Frecency::getInstance();
+  frecency.setPath(file);
+  size_t expected = WRITERS * VISITS + 10;
+  if (failed || frecency.size() != expected)
+  {
+    std::cerr << "frecency: " << frecency.size() << " entries and not " << expected << "\n";
+    return 1;
+  }
+  // aging may have lowered the ranks, but all the shared directories got the same visits
+  std::vector<Frecency::Match> shared = frecency.query(std::vector<std::string>(1, "/shared/"), NOW);
+  if (shared.size() != 10 || shared.front().score != shared.back().score)
+  {
+    std::cerr << "frecency: the shared directories were not counted alike\n";
+    return 1;
+  }
+  Frecency::Match match;
+  if (!frecency.best(std::vector<std::string>{"W3", "/2999"}, NOW, &match) || match.path != "/w3/2999")
+  {
+    std::cerr << "frecency: best of w3 2999 is not /w3/2999\n";
+    return 1;
+  }
+  std::cout << "frecency: " << WRITERS << " processes, " << expected << " entries, every visit counted\n";
+  return 0;
+}
+
+// * bench
+
+static int _bench(const std::string &file, size_t count)
+{
+  unlink(file.c_str());
+  Frecency &frecency = Frecency::getInstance();
+  frecency.setPath(file);
+  std::mt19937 random(11);
+  long long start = _now_ns();
+  for (size_t i = 0; i < count; i++)
+  {
+    frecency.visit(_directory(random), NOW - random() % 1000000);
+  }
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "frecency: " << frecency.size() << " entries, " << (_now_ns() - start) / 1000.0 / count
+            << " us per visit\n";
+
+  std::cout << std::left << std::setw(28) << "fragments" << std::right << std::setw(10) << "matches" << std::setw(14)
+            << "best us" << std::setw(14) << "query us" << "\n";
+  std::vector<std::vector<std::string>> queries = {{"d4242"}, {"release", "d1"}, {"node", "cache"}, {"s"},
+                                                   {"nothing-like-it"}};
+  for (const std::vector<std::string> &fragments : queries)
+  {
+    const int ROUNDS = 50;
+    Frecency::Match match;
+    start = _now_ns();
+    for (int round = 0; round < ROUNDS; round++)
+    {
+      frecency.best(fragments, NOW, &match);
+    }
+    double best_us = (_now_ns() - start) / 1000.0 / ROUNDS;
+    size_t matches = 0;
+    start = _now_ns();
+    for (int round = 0; round < ROUNDS; round++)
+    {
+      matches = frecency.query(fragments, NOW).size();
+    }
+    double query_us = (_now_ns() - start) / 1000.0 / ROUNDS;
+    std::string name;
+    for (const std::string &fragment : fragments)
+    {
+      name += (name.empty() ? "" : " ") + fragment;
+    }
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << matches << std::setw(14)
+              << best_us << std::setw(14) << query_us << "\n";
+  }
+  unlink(file.c_str());
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string mode = (argc > 2) ? argv[1] : "";
+  if (mode == "check")
+  {
+    return _check(argv[2]);
+  }
+  if (mode == "bench")
+  {
+    return _bench(argv[2], argc > 3 ? strtoul(argv[3], nullptr, 10) : 100000);
+  }
+  std::cerr << "usage: frecency check <file> | frecency bench <file> [entries]\n";
+  return 1;
+}
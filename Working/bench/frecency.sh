@@ -0,0 +1,12 @@
+#!/bin/bash
+# Concurrent visits of the frecency database of z (frecency.h) from several processes, then the time of a lookup
+# among 100k directories (see frecency.cpp).
+# usage: bench/frecency.sh [entries]
+
+DIR=$(dirname "$0")
+BINARY=$(mktemp)
+DATA=$(mktemp -u)
+trap 'rm -f "$BINARY" "$DATA" "$DATA".new.*' EXIT
+g++ --std=c++11 -O2 -Wall -o "$BINARY" "$DIR/frecency.cpp" "$DIR/../frecency.cpp" || exit 1
+"$BINARY" check "$DATA" || exit 1
+"$BINARY" bench "$DATA" "${1:-100000}"
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Stopping and continuing many jobs: a `kill` line for every job against one `kill` with a range of jobs.
+# The time between two `date` commands divided by the jobs is the cost of signalling one.
+# usage: bench/kill_batch.sh [smash binary] [jobs]
+
+SMASH=${1:-./smash}
+N=${2:-500}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+run() # <lines that signal the jobs>, prints us per job
+{
+  local input="$WORK/input"
+  for ((i = 0; i < N; i++)); do
+    echo "sleep 1000&" >> "$input"
+  done
+  echo "date +%s%N" >> "$input"
+  cat >> "$input"
+  echo "date +%s%N" >> "$input"
+  echo "quit kill" >> "$input"
+  "$SMASH" < "$input" 2> /dev/null | grep -o "[0-9]\{19\}" |
+    awk -v n="$N" 'NR == 1 { start = $1 } NR == 2 { printf "%.1f\n", ($1 - start) / 1000 / n }'
+  rm -f "$input"
+}
+
+printf "%-44s %10s\n" "stop and continue $N jobs" "us/job"
+printf "%-44s %10s\n" "kill -19 <id> and kill -18 <id>" \
+  "$(run < <(for ((i = 1; i <= N; i++)); do echo "kill -19 $i"; done; for ((i = 1; i <= N; i++)); do echo "kill -18 $i"; done))"
+printf "%-44s %10s\n" "kill -STOP %1-%$N and kill -CONT %sleep*" \
+  "$(run < <(echo "kill -STOP %1-%$N"; echo "kill -CONT %sleep*"))"
@@ -0,0 +1,307 @@
+/**
+ * Checks the engines of LineScan (scan.h) against each other and against the std::string searches of the
+ * classifiers they replaced, then measures them on long generated lines.
+ * check: random lines (every whitespace character, the specials, control and non-ASCII bytes, lengths around the
+ * 16/32/64 blocks) are scanned by every engine the CPU has, and every line ends right before a page that can not be
+ * read, so a read past its end crashes the check.
+ * bench: ns per line and MB/s of the old searches and of every engine.
+ * Built and run by bench/line_scan.sh.
+ * usage: line_scan check [lines] | line_scan bench
+ */
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../scan.h"
+
+static const std::string WHITESPACE = " \n\r\t\f\v";
+static const char *SPECIAL_SETS[LineScan::SPECIAL_COUNT] = {">", "|", "&", "*?", ";"};
+static const char *SPECIAL_NAMES[LineScan::SPECIAL_COUNT] = {"redirect", "pipe", "ampersand", "glob", "semicolon"};
+
+static long long _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static std::vector<LineScan::Engine> _engines()
+{
+  std::vector<LineScan::Engine> engines(1, LineScan::SCALAR);
+  for (int engine = LineScan::SSE2; engine <= LineScan::best(); engine++)
+  {
+    engines.push_back((LineScan::Engine)engine);
+  }
+  return engines;
+}
+
+// * check
+
+/**
+ * A line placed so its last character is the last byte before a PROT_NONE page
+ */
+class GuardedLine
+{
+public:
+  GuardedLine(size_t capacity)
+  {
+    long page = sysconf(_SC_PAGESIZE);
+    m_size = (capacity + page - 1) / page * page;
+    m_memory = (char *)mmap(nullptr, m_size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_memory == MAP_FAILED || mprotect(m_memory + m_size, page, PROT_NONE) == -1)
+    {
+      perror("line_scan: mmap");
+      exit(1);
+    }
+  }
+
+  const char *place(const std::string &line)
+  {
+    char *start = m_memory + m_size - line.size();
+    memcpy(start, line.data(), line.size());
+    return start;
+  }
+
+private:
+  char *m_memory;
+  size_t m_size;
+};
+
+static std::string _random_line(std::mt19937 &random)
+{
+  static const std::string ALPHABET = "abcz09-_=$()/.\"'" + WHITESPACE + ">|&*?;";
+  size_t length;
+  switch (random() % 8)
+  {
+  case 0:
+    length = random() % 4;
+    break;
+  case 1:
+    length = 60 + random() % 10; // around a block
+    break;
+  case 2:
+    length = 1000 + random() % 5000;
+    break;
+  default:
+    length = random() % 200;
+  }
+  std::string line(length, ' ');
+  int mode = random() % 4; // mostly text, mostly whitespace, mostly specials, any byte
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned int pick = random() % 100;
+    if (mode == 3 || pick < 3)
+    {
+      line[i] = (char)(1 + random() % 255); // controls next to \t..\r and bytes >= 0x80
+    }
+    else if ((mode == 1 && pick < 80) || pick < 15)
+    {
+      line[i] = WHITESPACE[random() % WHITESPACE.size()];
+    }
+    else if ((mode == 2 && pick < 60) || pick < 20)
+    {
+      line[i] = ALPHABET[ALPHABET.size() - 1 - random() % 6];
+    }
+    else
+    {
+      line[i] = ALPHABET[random() % ALPHABET.size()];
+    }
+  }
+  // long runs of whitespace at the ends
+  if (random() % 4 == 0)
+  {
+    line = std::string(random() % 80, ' ') + line + std::string(random() % 80, '\t');
+  }
+  return line;
+}
+
+static bool _fail(const std::string &line, const std::string &engine, const std::string &what, size_t expected,
+                  size_t got)
+{
+  std::cerr << "line_scan: " << engine << ": " << what << " is " << got << " and not " << expected
+            << ", line of " << line.size() << " characters:\n";
+  for (unsigned char c : line)
+  {
+    std::cerr << std::hex << std::setw(2) << std::setfill('0') << (int)c << " ";
+  }
+  std::cerr << std::dec << "\n";
+  return false;
+}
+
+static bool _check_line(const std::string &line, const char *placed, LineScan::Engine engine)
+{
+  std::string name = LineScan::engineName(engine);
+  LineScan scan(placed, line.size(), engine);
+
+  size_t begin = line.find_first_not_of(WHITESPACE);
+  size_t end = (begin == std::string::npos) ? 0 : line.find_last_not_of(WHITESPACE) + 1;
+  begin = (begin == std::string::npos) ? 0 : begin;
+  if (scan.begin() != begin)
+  {
+    return _fail(line, name, "begin", begin, scan.begin());
+  }
+  if (scan.end() != end)
+  {
+    return _fail(line, name, "end", end, scan.end());
+  }
+  size_t trim_begin = 1;
+  size_t trim_end = 1;
+  LineScan::trim(placed, line.size(), &trim_begin, &trim_end);
+  if (trim_begin != begin || trim_end != end)
+  {
+    return _fail(line, "trim", "begin,end", begin * 100000 + end, trim_begin * 100000 + trim_end);
+  }
+
+  for (int special = 0; special < LineScan::SPECIAL_COUNT; special++)
+  {
+    size_t first = line.find_first_of(SPECIAL_SETS[special]);
+    size_t last = line.find_last_of(SPECIAL_SETS[special]);
+    if (scan.first((LineScan::Special)special) != first)
+    {
+      return _fail(line, name, std::string("first ") + SPECIAL_NAMES[special], first,
+                   scan.first((LineScan::Special)special));
+    }
+    if (scan.last((LineScan::Special)special) != last)
+    {
+      return _fail(line, name, std::string("last ") + SPECIAL_NAMES[special], last,
+                   scan.last((LineScan::Special)special));
+    }
+  }
+
+  if (scan.positions().size() != (line.size() + 63) / 64)
+  {
+    return _fail(line, name, "words of positions", (line.size() + 63) / 64, scan.positions().size());
+  }
+  size_t expected = line.find_first_of(">|&*?;");
+  size_t position = scan.nextSpecial(0);
+  while (expected != std::string::npos || position != LineScan::npos)
+  {
+    if (position != expected)
+    {
+      return _fail(line, name, "a special position", expected, position);
+    }
+    expected = line.find_first_of(">|&*?;", expected + 1);
+    position = scan.nextSpecial(position + 1);
+  }
+  return true;
+}
+
+static int _check(size_t count)
+{
+  std::vector<LineScan::Engine> engines = _engines();
+  std::mt19937 random(20240601);
+  GuardedLine guarded(64 * 1024);
+  for (size_t i = 0; i < count; i++)
+  {
+    std::string line = _random_line(random);
+    const char *placed = guarded.place(line);
+    for (LineScan::Engine engine : engines)
+    {
+      if (!_check_line(line, placed, engine))
+      {
+        return 1;
+      }
+    }
+  }
+  std::cout << "line_scan: " << count << " lines, engines:";
+  for (LineScan::Engine engine : engines)
+  {
+    std::cout << " " << LineScan::engineName(engine);
+  }
+  std::cout << ", all agree with the std::string searches\n";
+  return 0;
+}
+
+// * bench
+
+// what the classifiers searched for every line before, each of them in a pass of its own
+static size_t _old_searches(const std::string &line)
+{
+  size_t begin = line.find_first_not_of(WHITESPACE);
+  size_t end = line.find_last_not_of(WHITESPACE);
+  size_t redirect = line.find_first_of(">");
+  size_t pipe = line.find_first_of("|");
+  size_t glob = line.find_first_of("*?");
+  size_t list = line.find_first_of(";&|");
+  return begin + end + redirect + pipe + glob + list;
+}
+
+static size_t _new_scan(const std::string &line, LineScan::Engine engine)
+{
+  LineScan scan(line, engine);
+  return scan.begin() + scan.end() + scan.first(LineScan::REDIRECT) + scan.first(LineScan::PIPE) +
+         scan.first(LineScan::GLOB) + scan.first(LineScan::SEMICOLON);
+}
+
+static std::string _command_line(size_t length, std::mt19937 &random)
+{
+  static const char *WORDS[] = {"ls", "-la", "/usr/local/bin", "grep", "-v", "pattern", "cat", "file.txt", "x=1"};
+  std::string line = "  ";
+  while (line.size() < length)
+  {
+    line += WORDS[random() % 9];
+    line += (random() % 50 == 0) ? " | " : " ";
+  }
+  line.resize(length);
+  return line + "> out.txt &  ";
+}
+
+static int _bench()
+{
+  std::mt19937 random(7);
+  std::cout << std::left << std::setw(12) << "line" << std::setw(10) << "engine" << std::right << std::setw(14)
+            << "ns/line" << std::setw(12) << "MB/s" << "\n";
+  std::cout << std::fixed << std::setprecision(1);
+  size_t sink = 0;
+  for (size_t length : {64, 1024, 65536})
+  {
+    std::vector<std::string> lines;
+    for (int i = 0; i < 16; i++)
+    {
+      lines.push_back(_command_line(length, random));
+    }
+    size_t rounds = std::max((size_t)200, (size_t)(64 * 1024 * 1024) / length / lines.size());
+    std::vector<int> engines(1, -1); // -1 for the old searches
+    for (LineScan::Engine engine : _engines())
+    {
+      engines.push_back(engine);
+    }
+    for (int engine : engines)
+    {
+      long long start = _now_ns();
+      for (size_t round = 0; round < rounds; round++)
+      {
+        for (const std::string &line : lines)
+        {
+          sink += (engine == -1) ? _old_searches(line) : _new_scan(line, (LineScan::Engine)engine);
+        }
+      }
+      double ns = (double)(_now_ns() - start) / (rounds * lines.size());
+      std::cout << std::left << std::setw(12) << (std::to_string(length) + " B") << std::setw(10)
+                << (engine == -1 ? "find_*" : LineScan::engineName((LineScan::Engine)engine)) << std::right
+                << std::setw(14) << ns << std::setw(12) << length * 1000.0 / ns << "\n";
+    }
+  }
+  return sink == 42 ? 1 : 0; // keeps the work from being optimized out
+}
+
+int main(int argc, char *argv[])
+{
+  std::string mode = (argc > 1) ? argv[1] : "";
+  if (mode == "check")
+  {
+    return _check(argc > 2 ? strtoul(argv[2], nullptr, 10) : 200000);
+  }
+  if (mode == "bench")
+  {
+    return _bench();
+  }
+  std::cerr << "usage: line_scan check [lines] | line_scan bench\n";
+  return 1;
+}
@@ -0,0 +1,11 @@
+#!/bin/bash
+# Differential check of the engines of the line scanner (scan.h) against each other and against the std::string
+# searches they replaced, then the time of a scan of long generated lines for every engine (see line_scan.cpp).
+# usage: bench/line_scan.sh [lines to check]
+
+DIR=$(dirname "$0")
+BINARY=$(mktemp)
+trap 'rm -f "$BINARY"' EXIT
+g++ --std=c++11 -O2 -Wall -o "$BINARY" "$DIR/line_scan.cpp" "$DIR/../scan.cpp" || exit 1
+"$BINARY" check "${1:-200000}" || exit 1
+"$BINARY" bench
@@ -0,0 +1,30 @@
+#!/bin/bash
+# A deterministic command on an input that does not change, run again and again: without memo, with memo (the first
+# run is a miss, the next ones replay the output) and with memo -c (the input is hashed on every run).
+# The time between two `date` commands divided by the runs is the time of a run.
+# usage: bench/memo.sh [smash binary] [runs] [input lines]
+
+SMASH=${1:-./smash}
+N=${2:-20}
+LINES=${3:-500000}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+seq "$LINES" | awk '{ print ($1 * 7919) % 1000003 }' > "$WORK/data"
+
+run() # <prefix of the command>, prints ms per run
+{
+  local input="$WORK/input"
+  echo "date +%s%N" > "$input"
+  for ((i = 0; i < N; i++)); do
+    echo "$1 sort -n $WORK/data > /dev/null" >> "$input"
+  done
+  echo "date +%s%N" >> "$input"
+  SMASH_MEMO_DIR="$WORK/memo" "$SMASH" < "$input" 2> /dev/null | grep -o "[0-9]\{19\}" |
+    awk -v n="$N" 'NR == 1 { start = $1 } NR == 2 { printf "%.2f\n", ($1 - start) / 1000000 / n }'
+  rm -rf "$input" "$WORK/memo"
+}
+
+printf "%-50s %10s\n" "sort -n of $LINES lines, $N runs" "ms/run"
+printf "%-50s %10s\n" "sort" "$(run "")"
+printf "%-50s %10s\n" "memo --inputs <data> -- sort" "$(run "memo --inputs $WORK/data --")"
+printf "%-50s %10s\n" "memo -c --inputs <data> -- sort" "$(run "memo -c --inputs $WORK/data --")"
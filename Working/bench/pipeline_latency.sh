@@ -0,0 +1,29 @@
+#!/bin/bash
+# Latency of builtin-to-external pipelines (`showpid | cat`, `jobs | grep sleep`).
+# The builtin stage runs inside smash, so every line should cost exactly one fork.
+# usage: bench/pipeline_latency.sh [smash binary] [iterations]
+
+SMASH=${1:-./smash}
+N=${2:-2000}
+
+run() # <label> <command line>
+{
+  local input
+  input=$(mktemp)
+  for ((i = 0; i < N; i++)); do
+    echo "$2" >> "$input"
+  done
+  echo "quit" >> "$input"
+
+  local start end
+  start=$(date +%s%N)
+  "$SMASH" < "$input" > /dev/null 2>&1
+  end=$(date +%s%N)
+  rm -f "$input"
+  printf "%-24s %8d lines %10.2f us/line\n" "$1" "$N" "$(awk -v ns=$((end - start)) -v n="$N" 'BEGIN { print ns / 1000 / n }')"
+}
+
+run "showpid | cat" "showpid | cat"
+run "pwd | cat" "pwd | cat"
+run "jobs | grep sleep" "jobs | grep sleep"
+run "cat /dev/null | cat" "cat /dev/null | cat"
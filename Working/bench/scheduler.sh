@@ -0,0 +1,35 @@
+#!/bin/bash
+# Cost of `at`, `atrm` and of a line of the prompt against the number of scheduled commands.
+# smash schedules N commands far in the future, then cancels them in a shuffled order, `date` commands between the
+# phases give the time per line. Flat columns mean the heap operations do not grow with the number of entries.
+# usage: bench/scheduler.sh [smash binary]
+
+SMASH=${1:-./smash}
+
+run() # <entries>, prints the us per `at`, per `showpid` with the entries scheduled and per `atrm`
+{
+  local input
+  input=$(mktemp)
+  {
+    echo "date +%s%N"
+    awk -v n="$1" 'BEGIN { for (i = 0; i < n; i++) print "at +" 3600 + i % 977 " true" }'
+    echo "date +%s%N"
+    awk 'BEGIN { for (i = 0; i < 1000; i++) print "showpid" }'
+    echo "date +%s%N"
+    awk -v n="$1" 'BEGIN { srand(1); for (i = 1; i <= n; i++) id[i] = i;
+      for (i = n; i > 1; i--) { j = int(rand() * i) + 1; t = id[i]; id[i] = id[j]; id[j] = t }
+      for (i = 1; i <= n; i++) print "atrm " id[i] }'
+    echo "date +%s%N"
+    echo "quit"
+  } > "$input"
+  "$SMASH" < "$input" 2> /dev/null | grep -o "[0-9]\{19\}" |
+    awk -v n="$1" '{ t[NR] = $1 } END { printf "%.1f %.1f %.1f\n", (t[2] - t[1]) / 1000 / n,
+      (t[3] - t[2]) / 1000 / 1000, (t[4] - t[3]) / 1000 / n }'
+  rm -f "$input"
+}
+
+printf "%-10s %12s %14s %12s\n" "entries" "at us/line" "line us/line" "atrm us/line"
+for entries in 1000 10000 50000; do
+  read -r at line atrm < <(run "$entries")
+  printf "%-10d %12s %14s %12s\n" "$entries" "$at" "$line" "$atrm"
+done
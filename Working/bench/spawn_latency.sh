@@ -0,0 +1,35 @@
+#!/bin/bash
+# Latency of starting an external command against the RSS of smash, with and without the zygote.
+# smash is grown with shell variables first, then runs /bin/true many times between two `date` commands,
+# the time between the two dates divided by the spawns is the latency of a spawn (and its wait).
+# usage: bench/spawn_latency.sh [smash binary] [spawns]
+
+SMASH=${1:-./smash}
+M=${2:-2000}
+VALUE=$(printf 'x%.0s' {1..150})
+
+run() # <zygote 0/1> <variables>, prints the RSS of smash in kB and the us per spawn
+{
+  local input output
+  input=$(mktemp)
+  awk -v n="$2" -v value="$VALUE" 'BEGIN { for (i = 0; i < n; i++) print "V" i "=" value }' > "$input"
+  echo "date +%s%N" >> "$input"
+  for ((i = 0; i < M; i++)); do
+    echo "/bin/true" >> "$input"
+  done
+  echo "date +%s%N" >> "$input"
+  echo 'grep VmRSS /proc/$$/status' >> "$input"
+  echo "quit" >> "$input"
+
+  output=$(SMASH_ZYGOTE=$1 "$SMASH" < "$input" 2> /dev/null)
+  rm -f "$input"
+  echo "$output" | grep -o "VmRSS:[[:space:]]*[0-9]*" | grep -o "[0-9]*$"
+  echo "$output" | grep -o "[0-9]\{19\}" | awk -v n="$M" 'NR == 1 { start = $1 } NR == 2 { printf "%.1f\n", ($1 - start) / 1000 / n }'
+}
+
+printf "%-10s %12s %14s %14s\n" "variables" "smash RSS" "fork us/spawn" "zygote us/spawn"
+for vars in 0 50000 200000 400000; do
+  read -r -d '' rss fork < <(run 0 "$vars")
+  read -r -d '' _ zygote < <(run 1 "$vars")
+  printf "%-10d %9d kB %14s %14s\n" "$vars" "$rss" "$fork" "$zygote"
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Stress run of smash with many background jobs: a burst of long jobs, builtins and `jobs` with the table full,
+# `fg` under load, a kill storm, a burst of jobs that finish together.
+# Writes a report with the latency of every phase and the CPU, read/write calls, RSS and fds of smash (see
+# stress_driver.cpp).
+# Every job holds a pidfd and a process, keep the jobs under `ulimit -n` and the pid limit.
+# usage: bench/stress.sh [smash binary] [jobs] [report file]
+
+SMASH=${1:-./smash}
+JOBS=${2:-10000}
+REPORT=${3:-stress_report.txt}
+
+DRIVER=$(mktemp)
+trap 'rm -f "$DRIVER"' EXIT
+g++ --std=c++11 -O2 -Wall -o "$DRIVER" "$(dirname "$0")/stress_driver.cpp" || exit 1
+"$DRIVER" "$SMASH" "$JOBS" "$REPORT"
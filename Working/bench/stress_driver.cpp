@@ -0,0 +1,385 @@
+/**
+ * Drives smash through pipes with scripted workloads of many background jobs and writes a report:
+ * the latency of every command (mean, p50, p99, max and the mean of every tenth of a phase, so a cost that grows
+ * with the job table shows up as rising tenths), and per phase the CPU time, the read/write system calls and the
+ * context switches of smash, its RSS and its open fds, all from /proc.
+ * Built and run by bench/stress.sh.
+ * usage: stress_driver <smash binary> <jobs> <report file>
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const std::string PROMPT = "smash> ";
+
+static long long _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+struct Sample
+{
+  long long rss_kb;
+  long long cpu_ticks;      // utime + stime
+  long long rw_calls;       // syscr + syscw of /proc/<pid>/io, fork, wait, epoll and the others are not counted
+  long long ctxt_switches;  // voluntary + nonvoluntary
+  long long fds;
+};
+
+struct Phase
+{
+  std::string name;
+  std::vector<long long> latencies_ns;
+  Sample before;
+  Sample after;
+  long long output_bytes;
+};
+
+class Smash
+{
+public:
+  Smash(const std::string &binary)
+  {
+    int in[2];
+    int out[2];
+    if (pipe(in) == -1 || pipe(out) == -1)
+    {
+      perror("stress: pipe");
+      exit(1);
+    }
+    m_pid = fork();
+    if (m_pid == 0)
+    {
+      dup2(in[0], STDIN_FILENO);
+      dup2(out[1], STDOUT_FILENO);
+      dup2(out[1], STDERR_FILENO);
+      close(in[0]);
+      close(in[1]);
+      close(out[0]);
+      close(out[1]);
+      execl(binary.c_str(), binary.c_str(), (char *)nullptr);
+      perror("stress: exec smash");
+      _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    m_in = in[1];
+    m_out = out[0];
+    m_output_bytes = 0;
+    waitForPrompt();
+  }
+
+  ~Smash()
+  {
+    close(m_in);
+    close(m_out);
+    waitpid(m_pid, nullptr, 0);
+  }
+
+  pid_t pid() const { return m_pid; }
+  long long outputBytes() const { return m_output_bytes; }
+
+  // sends a line and returns the time until smash prompts again
+  long long run(const std::string &line)
+  {
+    long long start = _now_ns();
+    std::string data = line + "\n";
+    if (write(m_in, data.data(), data.size()) != (ssize_t)data.size())
+    {
+      perror("stress: write to smash");
+      exit(1);
+    }
+    waitForPrompt();
+    return _now_ns() - start;
+  }
+
+  // the last line smash does not answer with a prompt
+  void quit(const std::string &line)
+  {
+    std::string data = line + "\n";
+    (void)!write(m_in, data.data(), data.size());
+    char buffer[65536];
+    while (read(m_out, buffer, sizeof(buffer)) > 0)
+    {
+    }
+  }
+
+  Sample sample() const
+  {
+    Sample sample = {0, 0, 0, 0, 0};
+    std::string path = "/proc/" + std::to_string(m_pid);
+    std::ifstream status(path + "/status");
+    std::string key;
+    long long value;
+    while (status >> key)
+    {
+      if (key == "VmRSS:" && status >> value)
+      {
+        sample.rss_kb = value;
+      }
+      else if ((key == "voluntary_ctxt_switches:" || key == "nonvoluntary_ctxt_switches:") && status >> value)
+      {
+        sample.ctxt_switches += value;
+      }
+    }
+    std::ifstream io(path + "/io");
+    while (io >> key)
+    {
+      if ((key == "syscr:" || key == "syscw:") && io >> value)
+      {
+        sample.rw_calls += value;
+      }
+    }
+    // utime and stime are the 14th and 15th fields, after the command name in parentheses
+    std::ifstream stat(path + "/stat");
+    std::string line;
+    std::getline(stat, line);
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    for (int i = 3; i <= 15 && fields >> field; i++)
+    {
+      if (i >= 14)
+      {
+        sample.cpu_ticks += atoll(field.c_str());
+      }
+    }
+    DIR *fds = opendir((path + "/fd").c_str());
+    if (fds)
+    {
+      while (readdir(fds))
+      {
+        sample.fds++;
+      }
+      closedir(fds);
+      sample.fds -= 2; // . and ..
+    }
+    return sample;
+  }
+
+private:
+  pid_t m_pid;
+  int m_in;
+  int m_out;
+  long long m_output_bytes;
+
+  void waitForPrompt()
+  {
+    // the workloads print nothing that ends with the prompt, so the prompt at the end of the output is the next one
+    std::string tail;
+    char buffer[65536];
+    while (true)
+    {
+      ssize_t count = read(m_out, buffer, sizeof(buffer));
+      if (count == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (count <= 0)
+      {
+        std::cerr << "stress: smash exited\n";
+        exit(1);
+      }
+      m_output_bytes += count;
+      tail.append(buffer, count);
+      if (tail.size() > PROMPT.size())
+      {
+        tail.erase(0, tail.size() - PROMPT.size());
+      }
+      if (tail == PROMPT)
+      {
+        return;
+      }
+    }
+  }
+};
+
+static Phase *_begin(std::vector<Phase> &phases, Smash &smash, const std::string &name)
+{
+  phases.push_back(Phase());
+  phases.back().name = name;
+  phases.back().before = smash.sample();
+  phases.back().output_bytes = smash.outputBytes();
+  std::cerr << "stress: " << name << "\n";
+  return &phases.back();
+}
+
+static void _end(Phase *phase, Smash &smash)
+{
+  phase->after = smash.sample();
+  phase->output_bytes = smash.outputBytes() - phase->output_bytes;
+}
+
+static double _us(long long ns)
+{
+  return ns / 1000.0;
+}
+
+static void _report(std::ostream &out, const std::vector<Phase> &phases, const std::string &binary, int jobs)
+{
+  long ticks = sysconf(_SC_CLK_TCK);
+  out << "smash stress report\n";
+  out << "binary: " << binary << "   jobs: " << jobs << "\n";
+  out << "latency in us from sending a line to the next prompt, rw calls are the read/write system calls of "
+         "/proc/<pid>/io (only those)\n\n";
+  out << std::left << std::setw(34) << "phase" << std::right << std::setw(8) << "lines" << std::setw(11) << "mean"
+      << std::setw(11) << "p50" << std::setw(11) << "p99" << std::setw(11) << "max" << std::setw(10) << "cpu ms"
+      << std::setw(10) << "rw calls" << std::setw(9) << "ctxsw" << std::setw(10) << "rss kB" << std::setw(8) << "fds"
+      << "\n";
+  out << std::fixed << std::setprecision(1);
+  for (const Phase &phase : phases)
+  {
+    std::vector<long long> sorted = phase.latencies_ns;
+    std::sort(sorted.begin(), sorted.end());
+    long long total = 0;
+    for (long long ns : sorted)
+    {
+      total += ns;
+    }
+    size_t n = sorted.size();
+    out << std::left << std::setw(34) << phase.name << std::right << std::setw(8) << n;
+    if (n > 0)
+    {
+      out << std::setw(11) << _us(total / n) << std::setw(11) << _us(sorted[n / 2]) << std::setw(11)
+          << _us(sorted[std::min(n - 1, n * 99 / 100)]) << std::setw(11) << _us(sorted.back());
+    }
+    else
+    {
+      out << std::setw(44) << "";
+    }
+    out << std::setw(10) << (phase.after.cpu_ticks - phase.before.cpu_ticks) * 1000 / ticks << std::setw(10)
+        << phase.after.rw_calls - phase.before.rw_calls << std::setw(9)
+        << phase.after.ctxt_switches - phase.before.ctxt_switches << std::setw(10) << phase.after.rss_kb
+        << std::setw(8) << phase.after.fds << "\n";
+  }
+
+  out << "\nmean latency (us) of every tenth of the long phases, flat unless a cost grows with the job table\n";
+  for (const Phase &phase : phases)
+  {
+    size_t n = phase.latencies_ns.size();
+    if (n < 100)
+    {
+      continue;
+    }
+    out << std::left << std::setw(34) << phase.name << std::right;
+    for (int tenth = 0; tenth < 10; tenth++)
+    {
+      long long total = 0;
+      size_t from = n * tenth / 10;
+      size_t to = n * (tenth + 1) / 10;
+      for (size_t i = from; i < to; i++)
+      {
+        total += phase.latencies_ns[i];
+      }
+      out << std::setw(9) << _us(total / (long long)(to - from));
+    }
+    out << "\n";
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 4)
+  {
+    std::cerr << "usage: stress_driver <smash binary> <jobs> <report file>\n";
+    return 1;
+  }
+  std::string binary = argv[1];
+  int jobs = atoi(argv[2]);
+  signal(SIGPIPE, SIG_IGN);
+
+  Smash smash(binary);
+  std::vector<Phase> phases;
+  phases.reserve(16);
+  Phase *phase;
+
+  phase = _begin(phases, smash, "start long jobs");
+  for (int i = 0; i < jobs; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("sleep 1000&"));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "builtin with the table full");
+  for (int i = 0; i < 1000; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("showpid"));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "jobs with the table full");
+  for (int i = 0; i < 10; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("jobs"));
+  }
+  _end(phase, smash);
+
+  // the sleep is the floor of the latency, what is above it is the cost of fg
+  phase = _begin(phases, smash, "fg of a 50ms job");
+  for (int i = 0; i < 20; i++)
+  {
+    smash.run("sleep 0.05&");
+    phase->latencies_ns.push_back(smash.run("fg"));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "kill storm");
+  for (int i = 1; i <= jobs; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("kill -9 " + std::to_string(i)));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "builtin after the kill storm");
+  for (int i = 0; i < 1000; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("showpid"));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "start jobs that finish together");
+  for (int i = 0; i < jobs; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("sleep 3&"));
+  }
+  _end(phase, smash);
+  // until the last one finished too, the first line after that reaps the whole burst
+  sleep(4);
+  phase = _begin(phases, smash, "first line after the burst");
+  phase->latencies_ns.push_back(smash.run("showpid"));
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "builtin after the burst");
+  for (int i = 0; i < 1000; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("showpid"));
+  }
+  _end(phase, smash);
+
+  phase = _begin(phases, smash, "jobs with the table empty");
+  for (int i = 0; i < 10; i++)
+  {
+    phase->latencies_ns.push_back(smash.run("jobs"));
+  }
+  _end(phase, smash);
+
+  smash.quit("quit kill");
+
+  std::ofstream report(argv[3]);
+  _report(report, phases, binary, jobs);
+  _report(std::cout, phases, binary, jobs);
+  return 0;
+}
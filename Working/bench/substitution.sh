@@ -0,0 +1,31 @@
+#!/bin/bash
+# Cost of `$(...)` command substitution in smash against bash.
+# `$(pwd)` and `$(showpid)` are captured in memory inside smash, `$(cat ...)` goes through a fork and a pipe.
+# usage: bench/substitution.sh [smash binary] [iterations]
+
+SMASH=${1:-./smash}
+N=${2:-2000}
+
+run() # <label> <shell> <command line>
+{
+  local input
+  input=$(mktemp)
+  for ((i = 0; i < N; i++)); do
+    echo "$3" >> "$input"
+  done
+  echo "quit" >> "$input"
+
+  local start end
+  start=$(date +%s%N)
+  "$2" < "$input" > /dev/null 2>&1
+  end=$(date +%s%N)
+  rm -f "$input"
+  printf "%-36s %8d lines %10.2f us/line\n" "$1" "$N" "$(awk -v ns=$((end - start)) -v n="$N" 'BEGIN { print ns / 1000 / n }')"
+}
+
+run "smash: X=\$(pwd)" "$SMASH" 'X=$(pwd)'
+run "bash:  X=\$(pwd)" bash 'X=$(pwd)'
+run "smash: cd \$(pwd)" "$SMASH" 'cd $(pwd)'
+run "bash:  cd \$(pwd)" bash 'cd $(pwd)'
+run "smash: X=\$(cat /etc/hostname)" "$SMASH" 'X=$(cat /etc/hostname)'
+run "bash:  X=\$(cat /etc/hostname)" bash 'X=$(cat /etc/hostname)'
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "chmod.h"
+
+using namespace std;
+
+#ifndef SYS_fchmodat2
+#define SYS_fchmodat2 452
+#endif
+
+static const mode_t ALL_BITS = 07777;
+static const mode_t READ_BITS = S_IRUSR | S_IRGRP | S_IROTH;
+static const mode_t WRITE_BITS = S_IWUSR | S_IWGRP | S_IWOTH;
+static const mode_t EXECUTE_BITS = S_IXUSR | S_IXGRP | S_IXOTH;
+
+// what getdents64 writes, glibc has no declaration of it
+struct LinuxDirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// * Helper Functions
+
+static mode_t _who_bits(char who)
+{
+  switch (who)
+  {
+  case 'u':
+    return S_ISUID | S_IRWXU;
+  case 'g':
+    return S_ISGID | S_IRWXG;
+  case 'o':
+    return S_ISVTX | S_IRWXO;
+  default: // a
+    return ALL_BITS;
+  }
+}
+
+static std::string _join(const std::string &directory, const char *name)
+{
+  return (!directory.empty() && directory.back() == '/') ? directory + name : directory + "/" + name;
+}
+
+/**
+ * fchmodat that does not follow a symbolic link: the fchmodat2 system call of Linux 6.6. glibc emulates the flag
+ * through /proc with 3 more system calls, so an older kernel gets the plain fchmodat, the entry was not a link when
+ * its directory was read.
+ */
+static int _fchmodat_nofollow(int dir_fd, const char *name, mode_t mode)
+{
+  static std::atomic<bool> s_no_fchmodat2(false);
+  if (!s_no_fchmodat2.load(std::memory_order_relaxed))
+  {
+    int res = syscall(SYS_fchmodat2, dir_fd, name, mode, AT_SYMLINK_NOFOLLOW);
+    if (res == 0 || errno != ENOSYS)
+    {
+      return res;
+    }
+    s_no_fchmodat2.store(true, std::memory_order_relaxed);
+  }
+  return fchmodat(dir_fd, name, mode, 0);
+}
+
+// * ModeSpec
+
+ModeSpec::ModeSpec()
+    : m_absolute(true),
+      m_mode(0),
+      m_directory_kept(0),
+      m_clauses()
+{
+}
+
+bool ModeSpec::parse(const std::string &text)
+{
+  m_clauses.clear();
+  if (!text.empty() && text.find_first_not_of("01234567") == std::string::npos)
+  {
+    m_absolute = true;
+    unsigned long mode = strtoul(text.c_str(), nullptr, 8);
+    m_mode = mode & ALL_BITS;
+    m_directory_kept = (text.size() < 5) ? (S_ISUID | S_ISGID) & ~m_mode : 0;
+    return mode <= ALL_BITS;
+  }
+
+  m_absolute = false;
+  mode_t mask = umask(0); // there is no way to read it without setting it
+  umask(mask);
+  size_t i = 0;
+  while (true)
+  {
+    mode_t who = 0;
+    for (; i < text.size() && strchr("ugoa", text[i]) != nullptr; i++)
+    {
+      who |= _who_bits(text[i]);
+    }
+    if (i == text.size() || strchr("+-=", text[i]) == nullptr)
+    {
+      return false;
+    }
+    while (i < text.size() && strchr("+-=", text[i]) != nullptr)
+    {
+      Clause clause;
+      clause.who = (who == 0) ? ALL_BITS : who;
+      clause.umask = (who == 0) ? mask : 0;
+      clause.op = text[i++];
+      clause.perms = 0;
+      clause.copy = '\0';
+      clause.conditional_x = false;
+      if (i < text.size() && strchr("ugo", text[i]) != nullptr)
+      {
+        clause.copy = text[i++];
+      }
+      for (; clause.copy == '\0' && i < text.size() && strchr("rwxXst", text[i]) != nullptr; i++)
+      {
+        switch (text[i])
+        {
+        case 'r':
+          clause.perms |= READ_BITS;
+          break;
+        case 'w':
+          clause.perms |= WRITE_BITS;
+          break;
+        case 'x':
+          clause.perms |= EXECUTE_BITS;
+          break;
+        case 'X':
+          clause.conditional_x = true;
+          break;
+        case 's':
+          clause.perms |= S_ISUID | S_ISGID;
+          break;
+        default: // t
+          clause.perms |= S_ISVTX;
+        }
+      }
+      m_clauses.push_back(clause);
+    }
+    if (i == text.size())
+    {
+      return true;
+    }
+    if (text[i++] != ',')
+    {
+      return false;
+    }
+  }
+}
+
+mode_t ModeSpec::apply(mode_t old_mode, bool is_directory) const
+{
+  if (m_absolute)
+  {
+    return is_directory ? m_mode | (old_mode & m_directory_kept) : m_mode;
+  }
+  mode_t mode = old_mode & ALL_BITS;
+  for (const Clause &clause : m_clauses)
+  {
+    // the set-id bits of a directory change only when the clause names them
+    mode_t kept = is_directory ? (S_ISUID | S_ISGID) & ~(clause.perms & clause.who) : 0;
+    mode_t perms = clause.perms;
+    if (clause.copy != '\0')
+    {
+      int shift = (clause.copy == 'u') ? 6 : (clause.copy == 'g') ? 3 : 0;
+      mode_t bits = (mode >> shift) & 7;
+      perms = bits | bits << 3 | bits << 6;
+    }
+    if (clause.conditional_x && (is_directory || (mode & EXECUTE_BITS) != 0))
+    {
+      perms |= EXECUTE_BITS;
+    }
+    mode_t value = perms & clause.who & ~clause.umask & ~kept;
+    switch (clause.op)
+    {
+    case '+':
+      mode |= value;
+      break;
+    case '-':
+      mode &= ~value;
+      break;
+    default: // =
+      mode = (mode & (~clause.who | kept)) | value;
+    }
+  }
+  return mode;
+}
+
+// * ChmodTree
+
+struct ChmodTree::Directory
+{
+  int fd;
+  std::string path;
+
+  Directory(int fd, const std::string &path) : fd(fd), path(path) {}
+  // closed when the last batch of its entries is done
+  ~Directory() { close(fd); }
+};
+
+struct ChmodTree::Batch
+{
+  std::shared_ptr<Directory> directory;
+  std::vector<char> dirents; // what one getdents64 wrote
+  std::string subdirectory;  // or the name of a directory in it to enter, opened only now
+};
+
+struct ChmodTree::Worker
+{
+  std::mutex mutex; // the owner works on the back of the queue, the thieves on its front
+  std::deque<Batch> queue;
+  std::vector<char> buffer; // for getdents64
+  std::vector<std::string> errors;
+  size_t changed;
+  size_t failed;
+
+  Worker() : buffer(BATCH_BYTES), changed(0), failed(0) {}
+};
+
+ChmodTree::ChmodTree(const ModeSpec &spec, std::function<bool()> cancelled, unsigned int thread_count)
+    : m_spec(spec),
+      m_cancelled(cancelled),
+      m_thread_count((thread_count == 0) ? threads() : thread_count),
+      m_workers(),
+      m_pending(0),
+      m_stop(false),
+      m_sleeping(0),
+      m_mutex(),
+      m_wakeup(),
+      m_changed(0),
+      m_failed(0),
+      m_errors()
+{
+}
+
+ChmodTree::~ChmodTree()
+{
+  // default, the batches left by a cancelled walk close their directories with the workers
+}
+
+unsigned int ChmodTree::threads()
+{
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+  {
+    return CPU_COUNT(&cpus);
+  }
+  unsigned int count = std::thread::hardware_concurrency();
+  return (count == 0) ? 1 : count;
+}
+
+void ChmodTree::run(const std::vector<std::string> &roots)
+{
+  m_workers.clear();
+  unsigned int count = m_thread_count;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    m_workers.emplace_back(new Worker());
+  }
+  m_pending = 0;
+  m_stop = false;
+
+  // a root is followed when it is a symbolic link, like chmod does with the paths it is given
+  Worker &first = *m_workers.front();
+  for (const std::string &root : roots)
+  {
+    struct stat status;
+    if (stat(root.c_str(), &status) == -1)
+    {
+      fail(first, root, errno);
+      continue;
+    }
+    if (!S_ISDIR(status.st_mode))
+    {
+      mode_t mode = m_spec.apply(status.st_mode, false);
+      if (chmod(root.c_str(), mode) == -1)
+      {
+        fail(first, root, errno);
+      }
+      else
+      {
+        first.changed++;
+      }
+      continue;
+    }
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      fail(first, root, errno);
+      continue;
+    }
+    enter(first, std::make_shared<Directory>(fd, root));
+  }
+
+  // the helpers start with every signal blocked, so ctrl-C reaches smash on this thread
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  std::vector<std::thread> helpers;
+  for (unsigned int i = 1; i < count && m_pending > 0; i++)
+  {
+    helpers.emplace_back(&ChmodTree::work, this, i);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  work(0);
+  for (std::thread &helper : helpers)
+  {
+    helper.join();
+  }
+
+  m_errors.clear();
+  for (const std::unique_ptr<Worker> &worker : m_workers)
+  {
+    m_changed += worker->changed;
+    m_failed += worker->failed;
+    m_errors.insert(m_errors.end(), worker->errors.begin(), worker->errors.end());
+  }
+  std::sort(m_errors.begin(), m_errors.end());
+  if (m_errors.size() > MAX_ERRORS)
+  {
+    m_errors.resize(MAX_ERRORS);
+  }
+  m_workers.clear();
+}
+
+void ChmodTree::work(size_t index)
+{
+  Worker &self = *m_workers[index];
+  Batch batch;
+  while (take(index, &batch))
+  {
+    process(self, batch);
+    batch = Batch(); // the directory may close now
+    if (--m_pending == 0)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_wakeup.notify_all();
+    }
+  }
+}
+
+bool ChmodTree::take(size_t index, Batch *batch)
+{
+  Worker &self = *m_workers[index];
+  while (true)
+  {
+    if (index == 0 && m_cancelled && m_cancelled())
+    {
+      m_stop = true;
+    }
+    if (m_stop)
+    {
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(self.mutex);
+      if (!self.queue.empty())
+      {
+        *batch = std::move(self.queue.back());
+        self.queue.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < m_workers.size(); i++)
+    {
+      Worker &victim = *m_workers[(index + i) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.queue.empty())
+      {
+        *batch = std::move(victim.queue.front());
+        victim.queue.pop_front();
+        return true;
+      }
+    }
+    if (m_pending == 0)
+    {
+      return false;
+    }
+    // a batch that is being processed may push more, the timeout covers a push between the check and the wait
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleeping++;
+    m_wakeup.wait_for(lock, std::chrono::milliseconds(10));
+    m_sleeping--;
+  }
+}
+
+void ChmodTree::push(Worker &self, Batch &&batch)
+{
+  m_pending++;
+  {
+    std::lock_guard<std::mutex> lock(self.mutex);
+    self.queue.push_back(std::move(batch));
+  }
+  if (m_sleeping > 0)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wakeup.notify_one();
+  }
+}
+
+void ChmodTree::process(Worker &self, const Batch &batch)
+{
+  if (!batch.subdirectory.empty())
+  {
+    const std::string &name = batch.subdirectory;
+    int fd = openat(batch.directory->fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+    {
+      int error = errno;
+      fail(self, _join(batch.directory->path, name.c_str()), error);
+      return;
+    }
+    enter(self, std::make_shared<Directory>(fd, _join(batch.directory->path, name.c_str())));
+    return;
+  }
+  size_t offset = 0;
+  while (offset < batch.dirents.size())
+  {
+    const LinuxDirent64 *entry = (const LinuxDirent64 *)&batch.dirents[offset];
+    offset += entry->d_reclen;
+    const char *name = entry->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+    {
+      continue;
+    }
+    visit(self, batch.directory, name, entry->d_type);
+  }
+}
+
+void ChmodTree::visit(Worker &self, const std::shared_ptr<Directory> &directory, const char *name,
+                      unsigned char type)
+{
+  struct stat status;
+  bool have_status = false;
+  // an octal mode needs no stat unless the file system did not tell the type
+  if (type == DT_UNKNOWN || (!m_spec.isAbsolute(false) && type != DT_DIR))
+  {
+    if (fstatat(directory->fd, name, &status, AT_SYMLINK_NOFOLLOW) == -1)
+    {
+      int error = errno;
+      fail(self, _join(directory->path, name), error);
+      return;
+    }
+    have_status = true;
+    type = IFTODT(status.st_mode);
+  }
+  if (type == DT_LNK)
+  {
+    return; // never followed and never changed
+  }
+  if (type == DT_DIR)
+  {
+    // opened when the task is taken, the siblings in this batch would otherwise all be open at once
+    Batch batch;
+    batch.directory = directory;
+    batch.subdirectory = name;
+    push(self, std::move(batch));
+    return;
+  }
+  mode_t mode = m_spec.apply(have_status ? status.st_mode : 0, false);
+  if (have_status && (status.st_mode & ALL_BITS) == mode)
+  {
+    return;
+  }
+  if (_fchmodat_nofollow(directory->fd, name, mode) == -1)
+  {
+    int error = errno;
+    fail(self, _join(directory->path, name), error);
+    return;
+  }
+  self.changed++;
+}
+
+void ChmodTree::enter(Worker &self, const std::shared_ptr<Directory> &directory)
+{
+  // before it is read: like chmod -R, a mode without x for us makes the entries unreachable
+  struct stat status;
+  bool absolute = m_spec.isAbsolute(true);
+  if (!absolute && fstat(directory->fd, &status) == -1)
+  {
+    fail(self, directory->path, errno);
+    return;
+  }
+  mode_t mode = m_spec.apply(absolute ? 0 : status.st_mode, true);
+  if (absolute || (status.st_mode & ALL_BITS) != mode)
+  {
+    if (fchmod(directory->fd, mode) == -1)
+    {
+      fail(self, directory->path, errno);
+    }
+    else
+    {
+      self.changed++;
+    }
+  }
+
+  while (true)
+  {
+    long res = syscall(SYS_getdents64, directory->fd, self.buffer.data(), self.buffer.size());
+    if (res == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (res == -1)
+    {
+      fail(self, directory->path, errno);
+      return;
+    }
+    if (res == 0)
+    {
+      return;
+    }
+    Batch batch;
+    batch.directory = directory;
+    batch.dirents.assign(self.buffer.begin(), self.buffer.begin() + res);
+    push(self, std::move(batch));
+  }
+}
+
+void ChmodTree::fail(Worker &self, const std::string &path, int error)
+{
+  self.failed++;
+  if (self.errors.size() < MAX_ERRORS)
+  {
+    self.errors.push_back(path + ": " + strerror(error));
+  }
+}
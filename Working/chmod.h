@@ -0,0 +1,105 @@
+#ifndef SMASH__CHMOD_H_
+#define SMASH__CHMOD_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * @brief A mode of chmod: octal (07777 at most) or symbolic clauses like `u+x,g-w,o=r` and `a+X`, `g=u`.
+ *    A symbolic clause without a who (`+x`) leaves out the bits of the umask, like chmod does. Like chmod does too, a
+ *    directory keeps its set-user-ID and set-group-ID bits unless the mode names them (`s`, an octal mode that sets
+ *    them or has 5 digits), and `o` covers the sticky bit.
+ */
+class ModeSpec
+{
+public:
+  ModeSpec();
+  // false when text is not a mode
+  bool parse(const std::string &text);
+  // an octal mode that does not depend on the old mode of an entry of that kind (no stat is needed)
+  bool isAbsolute(bool is_directory) const { return m_absolute && (!is_directory || m_directory_kept == 0); }
+  mode_t apply(mode_t old_mode, bool is_directory) const;
+
+private:
+  struct Clause
+  {
+    mode_t who;   // the bits the clause may change
+    mode_t umask; // left out when the clause has no who
+    char op;      // + - or =
+    mode_t perms;
+    char copy;    // u g or o for `g=u`, else '\0'
+    bool conditional_x; // X: x for directories and for files that some one may execute already
+  };
+
+  bool m_absolute;
+  mode_t m_mode;
+  mode_t m_directory_kept; // the set-id bits of a directory an octal mode keeps
+  std::vector<Clause> m_clauses;
+};
+
+/**
+ * @brief `chmod -R`: changes roots and everything under them on a pool of threads.
+ *    A task is a batch of entries of one directory (one getdents64 buffer), so a huge flat directory is shared by the
+ *    threads too, or a subdirectory to open. A subdirectory is only opened when its task is taken, so a wide directory
+ *    does not hold an fd for every subdirectory. Every thread has a deque of tasks: it pushes to the back and
+ *    takes from the back (depth first, few directories open), an idle thread steals from the front of another one.
+ *    Entries are reached with openat/fstatat/fchmodat relative to the fd of their directory and symbolic links under a
+ *    root are never followed (nor changed). A failure is recorded and the walk goes on.
+ */
+class ChmodTree
+{
+public:
+  // cancelled is asked between tasks, true stops the walk (ctrl-C), 0 threads is threads()
+  ChmodTree(const ModeSpec &spec, std::function<bool()> cancelled, unsigned int thread_count = 0);
+  ~ChmodTree();
+  ChmodTree(ChmodTree const &) = delete;
+  void operator=(ChmodTree const &) = delete;
+
+  void run(const std::vector<std::string> &roots);
+  size_t changed() const { return m_changed; }
+  size_t failed() const { return m_failed; }
+  // `path: reason` of the first MAX_ERRORS failures, sorted by path
+  const std::vector<std::string> &errors() const { return m_errors; }
+
+  // one for every CPU smash may run on
+  static unsigned int threads();
+
+  static const size_t MAX_ERRORS = 1000;
+  static const size_t BATCH_BYTES = 32 * 1024;
+
+private:
+  struct Directory;
+  struct Batch;
+  struct Worker;
+
+  const ModeSpec &m_spec;
+  std::function<bool()> m_cancelled;
+  unsigned int m_thread_count;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<long> m_pending; // batches pushed and not done yet, the walk is over at 0
+  std::atomic<bool> m_stop;
+  std::atomic<int> m_sleeping;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  size_t m_changed;
+  size_t m_failed;
+  std::vector<std::string> m_errors;
+
+  void work(size_t index);
+  bool take(size_t index, Batch *batch);
+  void push(Worker &self, Batch &&batch);
+  void process(Worker &self, const Batch &batch);
+  void visit(Worker &self, const std::shared_ptr<Directory> &directory, const char *name, unsigned char type);
+  // changes the directory through its fd, then queues its entries
+  void enter(Worker &self, const std::shared_ptr<Directory> &directory);
+  // errno is passed because building the path may change it
+  void fail(Worker &self, const std::string &path, int error);
+};
+
+#endif //SMASH__CHMOD_H_
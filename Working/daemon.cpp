@@ -0,0 +1,520 @@
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "daemon.h"
+#include "Commands.h"
+
+using namespace std;
+
+// a client that sends this much without a new line is disconnected
+static const size_t MAX_PENDING_INPUT = 64 * 1024;
+// the epoll data of the events of a session
+static const uint64_t CLIENT_EVENT = 0;   // the client sent input
+static const uint64_t EXITS_EVENT = 1;    // a job of the session exited
+static const uint64_t SCHEDULE_EVENT = 2; // a scheduled command of the session is due
+
+struct Session
+{
+  SmallShell *shell;
+  int control_fd;    // the trailers go there, the client fd carries the output of the commands and any byte of it
+  std::string input; // what the client sent after its last complete line
+};
+
+// * Helper Functions
+
+static void _ignore_signal(int sig_num)
+{
+  // a handler and not SIG_IGN, so the sons get back the default action when they exec
+}
+
+static bool _make_address(const std::string &socket_path, struct sockaddr_un *address)
+{
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address->sun_path))
+  {
+    std::cerr << "smash error: daemon: socket path is too long\n";
+    return false;
+  }
+  strcpy(address->sun_path, socket_path.c_str());
+  return true;
+}
+
+static bool _send_all(int fd, const std::string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t res = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (res == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (res <= 0)
+    {
+      return false;
+    }
+    sent += res;
+  }
+  return true;
+}
+
+// fd goes to the process at the other end of the socket, with one byte of data
+static bool _send_fd(int socket_fd, int fd)
+{
+  char byte = 0;
+  struct iovec data = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(header), &fd, sizeof(int));
+  ssize_t res;
+  do
+  {
+    res = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+  } while (res == -1 && errno == EINTR);
+  return res == 1;
+}
+
+// the fd _send_fd sent, -1 if there is none
+static int _receive_fd(int socket_fd)
+{
+  char byte;
+  struct iovec data = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t res;
+  do
+  {
+    res = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+  } while (res == -1 && errno == EINTR);
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (res != 1 || header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+  {
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(header), sizeof(int));
+  return fd;
+}
+
+static bool _send_trailer(const Session &session)
+{
+  std::string trailer = std::to_string(session.shell->getLastStatus());
+  if (!session.shell->hasQuit())
+  {
+    trailer += "\t" + session.shell->getPrompt();
+  }
+  trailer += "\n";
+  return _send_all(session.control_fd, trailer);
+}
+
+/**
+ * Runs a line of the session, everything it printed is sent before its trailer
+ */
+static void _run_line(Session &session, const std::string &line)
+{
+  session.shell->executeCommand(line.c_str());
+  std::cout.flush();
+  std::cerr.flush();
+}
+
+/**
+ * Reads what the client sent and runs its complete lines, returns false when the session is over
+ */
+static bool _serve_client(int client_fd, Session &session)
+{
+  char buffer[4096];
+  ssize_t count = read(client_fd, buffer, sizeof(buffer));
+  if (count == -1 && errno == EINTR)
+  {
+    return true;
+  }
+  if (count <= 0)
+  {
+    return false;
+  }
+  session.input.append(buffer, count);
+
+  size_t start = 0;
+  size_t end = 0;
+  while ((end = session.input.find('\n', start)) != std::string::npos)
+  {
+    _run_line(session, session.input.substr(start, end - start));
+    start = end + 1;
+    if (!_send_trailer(session) || session.shell->hasQuit())
+    {
+      return false;
+    }
+  }
+  session.input.erase(0, start);
+  return session.input.size() <= MAX_PENDING_INPUT;
+}
+
+/**
+ * Serves one client in the process forked for it until the client quits or disconnects, returns the exit code.
+ * the session has the cwd, the fds and the sons of this process to itself
+ */
+static int _serve_session(int client_fd)
+{
+  // the trailers have a socket of their own, the first thing the client gets is its end
+  int control[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, control) == -1)
+  {
+    perror("smash error: socketpair failed");
+    return 1;
+  }
+  bool sent = _send_fd(client_fd, control[1]);
+  close(control[1]);
+  if (!sent)
+  {
+    close(control[0]);
+    return 1;
+  }
+  Session session;
+  session.shell = SmallShell::createSession();
+  session.control_fd = control[0];
+  SmallShell::setSession(session.shell);
+  // the output of smash and of its sons goes to the client
+  dup2(client_fd, STDOUT_FILENO);
+  dup2(client_fd, STDERR_FILENO);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    perror("smash error: epoll_create1 failed");
+    return 1;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = CLIENT_EVENT;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event);
+  // the jobs of an idle session are reaped when they exit and not on its next line
+  int exits_fd = session.shell->getJobsList().getExitEventsFd();
+  if (exits_fd != -1)
+  {
+    event.data.u64 = EXITS_EVENT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, exits_fd, &event);
+  }
+  // `at` and `every` of an idle session start on time and not on its next line
+  int timer_fd = session.shell->getScheduler().getTimerFd();
+  if (timer_fd != -1)
+  {
+    event.data.u64 = SCHEDULE_EVENT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+  }
+
+  bool open = _send_trailer(session);
+  struct epoll_event events[3];
+  while (open)
+  {
+    int count = epoll_wait(epoll_fd, events, 3, -1);
+    if (count == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count == -1)
+    {
+      perror("smash error: epoll_wait failed");
+      break;
+    }
+    for (int i = 0; i < count && open; i++)
+    {
+      if (events[i].data.u64 == EXITS_EVENT)
+      {
+        session.shell->getJobsList().removeFinishedJobs();
+      }
+      else if (events[i].data.u64 == SCHEDULE_EVENT)
+      {
+        session.shell->runDueSchedules();
+        std::cout.flush();
+        std::cerr.flush();
+      }
+      else
+      {
+        open = _serve_client(client_fd, session);
+      }
+    }
+  }
+
+  // ends like a hangup of a terminal, the jobs are killed and reaped and nobody is left to read their list
+  std::cout.rdbuf(nullptr);
+  session.shell->getJobsList().killAllJobs();
+  SmallShell::setSession(nullptr);
+  delete session.shell;
+  close(epoll_fd);
+  close(session.control_fd);
+  close(client_fd);
+  return 0;
+}
+
+static void _reap_sessions(int sig_num)
+{
+  int saved_errno = errno;
+  while (waitpid(-1, nullptr, WNOHANG) > 0)
+  {
+  }
+  errno = saved_errno;
+}
+
+// * Daemon
+
+int runDaemon(const std::string &socket_path)
+{
+  struct sockaddr_un address;
+  if (!_make_address(socket_path, &address))
+  {
+    return 1;
+  }
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1)
+  {
+    perror("smash error: socket failed");
+    return 1;
+  }
+  // a socket left by a daemon that did not exit cleanly is replaced, any other file is not
+  struct stat old_file;
+  if (lstat(socket_path.c_str(), &old_file) == 0 && S_ISSOCK(old_file.st_mode))
+  {
+    unlink(socket_path.c_str());
+  }
+  // the sessions run commands as the owner, nobody else may connect. the socket is created with these permissions,
+  // a chmod after bind would leave a moment where anyone could
+  mode_t old_mask = umask(077);
+  int bound = bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+  umask(old_mask);
+  if (bound == -1)
+  {
+    perror("smash error: bind failed");
+    close(listen_fd);
+    return 1;
+  }
+  if (listen(listen_fd, SOMAXCONN) == -1)
+  {
+    perror("smash error: listen failed");
+    close(listen_fd);
+    return 1;
+  }
+
+  // a client that disconnects while its output is written must not kill the daemon
+  signal(SIGPIPE, _ignore_signal);
+  signal(SIGCHLD, _reap_sessions);
+  // the commands read no input, the clients send lines and not a terminal
+  int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd != -1)
+  {
+    dup2(null_fd, STDIN_FILENO);
+    close(null_fd);
+  }
+
+  // every session is a process of its own, a foreground command of one session never holds the lines of another
+  pid_t daemon_pid = getpid();
+  while (true)
+  {
+    int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client_fd == -1 && (errno == EBADF || errno == EINVAL)) // the socket itself is gone
+    {
+      perror("smash error: accept failed");
+      break;
+    }
+    if (client_fd == -1)
+    {
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // the session gets the sons it forks back, and it ends with the daemon
+      signal(SIGCHLD, SIG_DFL);
+      prctl(PR_SET_PDEATHSIG, SIGHUP);
+      if (getppid() != daemon_pid)
+      {
+        _exit(1);
+      }
+      close(listen_fd);
+      _exit(_serve_session(client_fd));
+    }
+    if (pid == -1)
+    {
+      perror("smash error: fork failed");
+    }
+    close(client_fd);
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  return 1;
+}
+
+// * Client
+
+/**
+ * Prints what the daemon sent on the output of the session: one read, or with MSG_DONTWAIT all there is.
+ * false once the daemon closed it
+ */
+static bool _print_output(int fd, int flags)
+{
+  char buffer[4096];
+  while (true)
+  {
+    ssize_t count = recv(fd, buffer, sizeof(buffer), flags);
+    if (count == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0)
+    {
+      return count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    std::cout.write(buffer, count);
+    std::cout.flush();
+    if ((flags & MSG_DONTWAIT) == 0)
+    {
+      return true;
+    }
+  }
+}
+
+/**
+ * Prints the output until the trailer of the line comes, returns false if the daemon closed the connection
+ */
+static bool _read_response(int fd, int control_fd, std::string &pending, int *status, std::string *prompt,
+                           bool *ended)
+{
+  char buffer[4096];
+  bool output_open = true;
+  while (true)
+  {
+    size_t newline = pending.find('\n');
+    if (newline != std::string::npos)
+    {
+      // the command wrote its output before the trailer was sent, it is all in the socket by now
+      if (output_open)
+      {
+        _print_output(fd, MSG_DONTWAIT);
+      }
+      std::string trailer = pending.substr(0, newline);
+      pending.erase(0, newline + 1);
+      size_t tab = trailer.find('\t');
+      *status = atoi(trailer.substr(0, tab).c_str());
+      *ended = (tab == std::string::npos);
+      if (!*ended)
+      {
+        *prompt = trailer.substr(tab + 1);
+      }
+      return true;
+    }
+
+    struct pollfd fds[2] = {{control_fd, POLLIN, 0}, {fd, POLLIN, 0}};
+    if (poll(fds, output_open ? 2 : 1, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    if (output_open && fds[1].revents != 0)
+    {
+      output_open = _print_output(fd, 0);
+    }
+    if (fds[0].revents != 0)
+    {
+      ssize_t count = read(control_fd, buffer, sizeof(buffer));
+      if (count == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      if (count <= 0)
+      {
+        return false;
+      }
+      pending.append(buffer, count);
+    }
+  }
+}
+
+int runClient(const std::string &socket_path)
+{
+  struct sockaddr_un address;
+  if (!_make_address(socket_path, &address))
+  {
+    return 1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    perror("smash error: socket failed");
+    return 1;
+  }
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+  {
+    perror("smash error: connect failed");
+    close(fd);
+    return 1;
+  }
+
+  std::string pending;
+  std::string prompt;
+  int status = 0;
+  bool ended = false;
+  // the daemon greets a new session with the socket of its trailers and then with its prompt
+  int control_fd = _receive_fd(fd);
+  if (control_fd == -1 || !_read_response(fd, control_fd, pending, &status, &prompt, &ended))
+  {
+    std::cerr << "smash error: daemon closed the connection\n";
+    if (control_fd != -1)
+    {
+      close(control_fd);
+    }
+    close(fd);
+    return 1;
+  }
+
+  std::string cmd_line;
+  while (!ended)
+  {
+    std::cout << prompt << "> ";
+    if (!std::getline(std::cin, cmd_line))
+    {
+      break;
+    }
+    if (!_send_all(fd, cmd_line + "\n") || !_read_response(fd, control_fd, pending, &status, &prompt, &ended))
+    {
+      std::cerr << "smash error: daemon closed the connection\n";
+      status = 1;
+      break;
+    }
+  }
+  close(control_fd);
+  close(fd);
+  return status;
+}
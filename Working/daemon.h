@@ -0,0 +1,28 @@
+#ifndef SMASH__DAEMON_H_
+#define SMASH__DAEMON_H_
+
+#include <string>
+
+/**
+ * The protocol of the control socket:
+ *    when a client connects, the daemon sends it one byte with the fd of a second socket (SCM_RIGHTS): the trailers
+ *    come on that one, the connection itself carries only what the commands print, so the output may hold any byte.
+ *    the client sends command lines, each ends with '\n'.
+ *    after every line the daemon sends what the command printed (stdout and stderr) and then, on the second socket,
+ *    a trailer:
+ *        ```<exit status>\t<prompt>\n```
+ *    the command wrote all its output before its trailer is sent: when the trailer comes, the output of the line is
+ *    in the connection already. a trailer is also sent when a client connects (status 0 and the prompt of the new
+ *    session). after `quit` the trailer has no prompt (```<exit status>\n```) and the daemon closes the session.
+ *
+ *    the daemon only accepts: every session runs in a process forked for it when its client connects, with a cwd, fds
+ *    and sons of its own, so a foreground command of one session never holds the lines of another. a session ends
+ *    when its client quits or disconnects, or when the daemon is killed.
+ */
+
+// serves sessions on a unix socket at socket_path until smash is killed, returns 1 if the socket could not be set up
+int runDaemon(const std::string &socket_path);
+// reads lines from stdin, runs them in a session of the daemon and prints like smash, returns the last status
+int runClient(const std::string &socket_path);
+
+#endif //SMASH__DAEMON_H_
@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frecency.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'S', 'M', 'A', 'S', 'H', 'Z', '1', '\0'};
+static const size_t HEADER_SIZE = 64;
+// room for the paths of a new database, per entry
+static const uint64_t ARENA_PER_ENTRY = 64;
+
+struct FrecencyHeader
+{
+  char magic[8];
+  uint32_t count;
+  uint32_t capacity; // entries, a power of 2, the hash table has twice as many slots
+  uint64_t arena_used;
+  uint64_t arena_capacity;
+  double total_rank;
+};
+
+struct FrecencyEntry
+{
+  uint64_t offset; // of the path in the arena
+  uint32_t length;
+  float rank;
+  int64_t last_visit;
+};
+
+const double Frecency::AGING_BASE = 9000;
+const double Frecency::AGING_PER_ENTRY = 10;
+const double Frecency::AGING_FACTOR = 0.99;
+
+// * Helper Functions
+
+static size_t _file_size(uint32_t capacity, uint64_t arena_capacity)
+{
+  return HEADER_SIZE + (size_t)capacity * (sizeof(FrecencyEntry) + sizeof(uint64_t) + 2 * sizeof(uint32_t)) +
+         arena_capacity;
+}
+
+// ASCII only, tolower goes through the locale for every character
+static inline char _lower_char(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a
+static uint64_t _hash(const char *text, size_t length)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static uint64_t _signature(const char *text, size_t length)
+{
+  uint64_t signature = 0;
+  for (size_t i = 0; i + 1 < length; i++)
+  {
+    uint32_t pair = (uint32_t)(unsigned char)_lower_char(text[i]) << 8 | (unsigned char)_lower_char(text[i + 1]);
+    signature |= 1ULL << ((pair * 0x9E3779B1u) >> 26);
+  }
+  return signature;
+}
+
+static std::string _lower(const char *text, size_t length)
+{
+  std::string lower(text, length);
+  for (char &c : lower)
+  {
+    c = _lower_char(c);
+  }
+  return lower;
+}
+
+// the lowercase fragments and the signature an entry needs to match them
+static uint64_t _prepare(const std::vector<std::string> &fragments, std::vector<std::string> *lower)
+{
+  uint64_t signature = 0;
+  for (const std::string &fragment : fragments)
+  {
+    lower->push_back(_lower(fragment.data(), fragment.size()));
+    signature |= _signature(fragment.data(), fragment.size());
+  }
+  return signature;
+}
+
+// every fragment (lowercase) is in the path, each one after the one before it
+static bool _matches(const char *path, size_t length, const std::vector<std::string> &fragments)
+{
+  size_t position = 0;
+  for (const std::string &fragment : fragments)
+  {
+    size_t size = fragment.size();
+    bool found = false;
+    while (!found && position + size <= length)
+    {
+      size_t i = 0;
+      while (i < size && _lower_char(path[position + i]) == fragment[i])
+      {
+        i++;
+      }
+      found = (i == size);
+      position += found ? size : 1;
+    }
+    if (!found)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// * Frecency
+
+Frecency::Frecency()
+    : m_path(),
+      m_fd(-1),
+      m_inode(0),
+      m_map(nullptr),
+      m_map_size(0)
+{
+}
+
+Frecency::~Frecency()
+{
+  unmap();
+}
+
+void Frecency::setPath(const std::string &path)
+{
+  if (path != m_path)
+  {
+    unmap();
+    m_path = path;
+  }
+}
+
+bool Frecency::visit(const std::string &directory, long long now)
+{
+  if (directory.empty() || !lock(LOCK_EX))
+  {
+    return false;
+  }
+  const char *path = directory.data();
+  size_t length = directory.size();
+  uint32_t *slot = findSlot(path, length);
+  if (*slot == 0)
+  {
+    FrecencyHeader *head = header();
+    if (head->count == head->capacity || head->arena_used + length > head->arena_capacity)
+    {
+      uint32_t capacity = head->capacity;
+      while (capacity <= head->count || (uint64_t)capacity * ARENA_PER_ENTRY < head->arena_used + length)
+      {
+        capacity *= 2;
+      }
+      if (!rebuild(capacity * 2, false))
+      {
+        unlock();
+        return false;
+      }
+      head = header();
+      slot = findSlot(path, length);
+    }
+    FrecencyEntry &entry = entries()[head->count];
+    entry.offset = head->arena_used;
+    entry.length = length;
+    entry.rank = 0;
+    signatures()[head->count] = _signature(path, length);
+    memcpy(arena() + head->arena_used, path, length);
+    head->arena_used += length;
+    *slot = ++head->count;
+  }
+
+  FrecencyEntry &entry = entries()[*slot - 1];
+  entry.rank += 1;
+  entry.last_visit = now;
+  FrecencyHeader *head = header();
+  head->total_rank += 1;
+  if (head->total_rank > AGING_BASE + AGING_PER_ENTRY * head->count)
+  {
+    rebuild(head->capacity, true); // a failed aging leaves the database as it is
+  }
+  unlock();
+  return true;
+}
+
+std::vector<Frecency::Match> Frecency::query(const std::vector<std::string> &fragments, long long now)
+{
+  std::vector<Match> matches;
+  if (!lock(LOCK_SH))
+  {
+    return matches;
+  }
+  std::vector<std::string> lower;
+  uint64_t signature = _prepare(fragments, &lower);
+  const uint64_t *entry_signatures = signatures();
+  const FrecencyEntry *table = entries();
+  const char *paths = arena();
+  uint32_t count = header()->count;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const FrecencyEntry &entry = table[i];
+    if ((entry_signatures[i] & signature) != signature || !_matches(paths + entry.offset, entry.length, lower))
+    {
+      continue;
+    }
+    Match match = {std::string(paths + entry.offset, entry.length), score(entry.rank, now - entry.last_visit)};
+    matches.push_back(match);
+  }
+  unlock();
+  std::stable_sort(matches.begin(), matches.end(),
+                   [](const Match &a, const Match &b) { return a.score < b.score; });
+  return matches;
+}
+
+bool Frecency::best(const std::vector<std::string> &fragments, long long now, Match *match)
+{
+  if (!lock(LOCK_SH))
+  {
+    return false;
+  }
+  std::vector<std::string> lower;
+  uint64_t signature = _prepare(fragments, &lower);
+  const uint64_t *entry_signatures = signatures();
+  const FrecencyEntry *table = entries();
+  const char *paths = arena();
+  uint32_t count = header()->count;
+  // the same order as query: of equal scores the last one wins
+  const FrecencyEntry *best = nullptr;
+  double best_score = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if ((entry_signatures[i] & signature) != signature)
+    {
+      continue;
+    }
+    const FrecencyEntry &entry = table[i];
+    double entry_score = score(entry.rank, now - entry.last_visit);
+    if ((best == nullptr || entry_score >= best_score) && _matches(paths + entry.offset, entry.length, lower))
+    {
+      best = &entry;
+      best_score = entry_score;
+    }
+  }
+  if (best != nullptr)
+  {
+    match->path = std::string(paths + best->offset, best->length);
+    match->score = best_score;
+  }
+  unlock();
+  return best != nullptr;
+}
+
+size_t Frecency::size()
+{
+  if (!lock(LOCK_SH))
+  {
+    return 0;
+  }
+  size_t count = header()->count;
+  unlock();
+  return count;
+}
+
+double Frecency::score(double rank, long long age_seconds)
+{
+  if (age_seconds < 3600)
+  {
+    return rank * 4;
+  }
+  if (age_seconds < 86400)
+  {
+    return rank * 2;
+  }
+  if (age_seconds < 604800)
+  {
+    return rank / 2;
+  }
+  return rank / 4;
+}
+
+// * Frecency Private
+
+FrecencyHeader *Frecency::header() const
+{
+  return (FrecencyHeader *)m_map;
+}
+
+FrecencyEntry *Frecency::entries() const
+{
+  return (FrecencyEntry *)(m_map + HEADER_SIZE);
+}
+
+uint64_t *Frecency::signatures() const
+{
+  return (uint64_t *)(m_map + HEADER_SIZE + (size_t)header()->capacity * sizeof(FrecencyEntry));
+}
+
+uint32_t *Frecency::slots() const
+{
+  return (uint32_t *)(signatures() + header()->capacity);
+}
+
+char *Frecency::arena() const
+{
+  return (char *)(slots() + (size_t)header()->capacity * 2);
+}
+
+bool Frecency::lock(int operation)
+{
+  if (m_path.empty())
+  {
+    errno = ENOENT;
+    return false;
+  }
+  while (true)
+  {
+    if (m_map == nullptr)
+    {
+      int fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      if (fd == -1)
+      {
+        return false;
+      }
+      if (!map(fd))
+      {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+      }
+    }
+    int res;
+    do
+    {
+      res = flock(m_fd, operation);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1)
+    {
+      return false;
+    }
+    // another smash may have replaced the file while we waited for it, then the new one is mapped
+    struct stat current;
+    if (stat(m_path.c_str(), &current) == 0 && current.st_ino == m_inode)
+    {
+      return true;
+    }
+    unmap();
+  }
+}
+
+void Frecency::unlock()
+{
+  flock(m_fd, LOCK_UN);
+}
+
+bool Frecency::map(int fd)
+{
+  // the first smash that opens a new file makes it a database, the others wait for it
+  struct stat status;
+  if (flock(fd, LOCK_EX) == -1 || fstat(fd, &status) == -1)
+  {
+    return false;
+  }
+  if (status.st_size == 0)
+  {
+    FrecencyHeader head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.capacity = INITIAL_CAPACITY;
+    head.arena_capacity = INITIAL_CAPACITY * ARENA_PER_ENTRY;
+    if (ftruncate(fd, _file_size(head.capacity, head.arena_capacity)) == -1 ||
+        pwrite(fd, &head, sizeof(head), 0) != (ssize_t)sizeof(head) || fstat(fd, &status) == -1)
+    {
+      flock(fd, LOCK_UN);
+      return false;
+    }
+  }
+  flock(fd, LOCK_UN);
+
+  FrecencyHeader head;
+  if (pread(fd, &head, sizeof(head), 0) != (ssize_t)sizeof(head) || memcmp(head.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      (size_t)status.st_size != _file_size(head.capacity, head.arena_capacity))
+  {
+    errno = EINVAL; // not a database of smash
+    return false;
+  }
+  void *map = mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    return false;
+  }
+  m_fd = fd;
+  m_inode = status.st_ino;
+  m_map = (char *)map;
+  m_map_size = status.st_size;
+  return true;
+}
+
+void Frecency::unmap()
+{
+  if (m_map != nullptr)
+  {
+    munmap(m_map, m_map_size);
+    m_map = nullptr;
+    m_map_size = 0;
+  }
+  if (m_fd != -1)
+  {
+    close(m_fd); // and its flock with it
+    m_fd = -1;
+  }
+}
+
+bool Frecency::rebuild(uint32_t capacity, bool aging)
+{
+  FrecencyHeader *old_head = header();
+  std::vector<FrecencyEntry> kept;
+  uint64_t arena_used = 0;
+  for (uint32_t i = 0; i < old_head->count; i++)
+  {
+    FrecencyEntry entry = entries()[i];
+    if (aging)
+    {
+      entry.rank *= AGING_FACTOR;
+      if (entry.rank < 1)
+      {
+        continue;
+      }
+    }
+    kept.push_back(entry);
+    arena_used += entry.length;
+  }
+
+  FrecencyHeader head;
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, MAGIC, sizeof(MAGIC));
+  head.capacity = capacity;
+  head.arena_capacity = std::max((uint64_t)capacity * ARENA_PER_ENTRY, arena_used * 2);
+  size_t size = _file_size(head.capacity, head.arena_capacity);
+
+  std::string temp = m_path + ".new." + std::to_string(getpid());
+  int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    return false;
+  }
+  void *map = MAP_FAILED;
+  struct stat status;
+  if (flock(fd, LOCK_EX) == -1 || ftruncate(fd, size) == -1 || fstat(fd, &status) == -1 ||
+      (map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    int error = errno;
+    close(fd);
+    unlink(temp.c_str());
+    errno = error;
+    return false;
+  }
+  memcpy(map, &head, sizeof(head));
+
+  // the new file becomes the mapped one, the entries are copied from the old mapping
+  char *old_map = m_map;
+  size_t old_map_size = m_map_size;
+  int old_fd = m_fd;
+  ino_t old_inode = m_inode;
+  const char *old_arena = arena();
+  m_map = (char *)map;
+  m_map_size = size;
+  m_fd = fd;
+  m_inode = status.st_ino;
+  FrecencyHeader *new_head = header();
+  for (const FrecencyEntry &entry : kept)
+  {
+    const char *path = old_arena + entry.offset;
+    FrecencyEntry &copy = entries()[new_head->count];
+    copy = entry;
+    copy.offset = new_head->arena_used;
+    signatures()[new_head->count] = _signature(path, entry.length);
+    memcpy(arena() + new_head->arena_used, path, entry.length);
+    new_head->arena_used += entry.length;
+    new_head->total_rank += entry.rank;
+    *findSlot(path, entry.length) = ++new_head->count;
+  }
+
+  if (rename(temp.c_str(), m_path.c_str()) == -1)
+  {
+    int error = errno;
+    munmap(m_map, m_map_size);
+    close(m_fd);
+    unlink(temp.c_str());
+    m_map = old_map;
+    m_map_size = old_map_size;
+    m_fd = old_fd;
+    m_inode = old_inode;
+    errno = error;
+    return false;
+  }
+  // the smashes that wait for the old file find it replaced once they get it
+  munmap(old_map, old_map_size);
+  close(old_fd);
+  return true;
+}
+
+uint32_t *Frecency::findSlot(const char *path, size_t length) const
+{
+  uint32_t mask = header()->capacity * 2 - 1;
+  uint32_t *table = slots();
+  const FrecencyEntry *table_entries = entries();
+  const char *paths = arena();
+  for (uint32_t index = _hash(path, length) & mask;; index = (index + 1) & mask)
+  {
+    uint32_t slot = table[index];
+    if (slot == 0)
+    {
+      return &table[index];
+    }
+    const FrecencyEntry &entry = table_entries[slot - 1];
+    if (entry.length == length && memcmp(paths + entry.offset, path, length) == 0)
+    {
+      return &table[index];
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef SMASH__FRECENCY_H_
+#define SMASH__FRECENCY_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct FrecencyHeader;
+struct FrecencyEntry;
+
+/**
+ * @brief The directories smash changed to, ranked by frecency (how often and how recently they were visited), for `z`.
+ *    The database is a file mapped with MAP_SHARED, so every smash of the user reads and updates the same one without
+ *    parsing it: a header, a table of fixed size entries, their signatures, an open addressing hash table of the paths
+ *    (a visit finds its entry without a search) and the paths themselves.
+ *    The signature of an entry has a bit for every lowercase character pair of its path: a query runs through the
+ *    signatures alone (8 bytes an entry, next to each other) and compares only the paths of the entries that have
+ *    every pair of the fragments.
+ *
+ *    A visit takes an exclusive flock and a query a shared one. A full database, or one whose ranks add up to more
+ *    than AGING_BASE + AGING_PER_ENTRY * entries, is rewritten to a new file that replaces it with rename: with twice
+ *    the room, or with the ranks aged by AGING_FACTOR and the entries that fall below 1 dropped (like z does).
+ *    The other smashes see the new file at their next visit or query.
+ */
+class Frecency
+{
+public:
+  struct Match
+  {
+    std::string path;
+    double score;
+  };
+
+  Frecency(Frecency const &) = delete;
+  void operator=(Frecency const &) = delete;
+  static Frecency &getInstance()
+  {
+    static Frecency instance;
+    return instance;
+  }
+  ~Frecency();
+
+  // the file of the database, it is opened (and created) at the first visit or query after
+  void setPath(const std::string &path);
+  const std::string &getPath() const { return m_path; }
+  // one more visit of directory now (in seconds), false with errno if the database could not be opened or grown
+  bool visit(const std::string &directory, long long now);
+  // the entries that have every fragment in their path, in order and ignoring case, from the lowest score to the highest
+  std::vector<Match> query(const std::vector<std::string> &fragments, long long now);
+  // the match with the highest score, false when nothing matches
+  bool best(const std::vector<std::string> &fragments, long long now, Match *match);
+  size_t size();
+
+  // the rank weighted by the age of the last visit: x4 within the hour, x2 within the day, /2 within the week, else /4
+  static double score(double rank, long long age_seconds);
+
+  static const uint32_t INITIAL_CAPACITY = 1024;
+  static const double AGING_BASE;
+  static const double AGING_PER_ENTRY;
+  static const double AGING_FACTOR;
+
+private:
+  std::string m_path;
+  int m_fd;
+  ino_t m_inode; // of the file that is mapped, another smash may have replaced it since
+  char *m_map;
+  size_t m_map_size;
+
+  Frecency();
+  FrecencyHeader *header() const;
+  FrecencyEntry *entries() const;
+  uint64_t *signatures() const;
+  uint32_t *slots() const;
+  char *arena() const;
+
+  // opens and maps the file of m_path if it is not mapped (or was replaced) and locks it, false with errno
+  bool lock(int operation);
+  void unlock();
+  bool map(int fd);
+  void unmap();
+  // writes the entries that stay (aged when aging) to a new file with room for capacity entries and replaces the
+  // database with it, the new file is mapped and locked on return
+  bool rebuild(uint32_t capacity, bool aging);
+  // the slot of path in the hash table: its entry, or the empty slot where it goes
+  uint32_t *findSlot(const char *path, size_t length) const;
+};
+
+#endif //SMASH__FRECENCY_H_
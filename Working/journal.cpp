@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'S', 'M', 'A', 'S', 'H', 'J', '1', '\0'};
+static const size_t HEADER_SIZE = 64;
+
+struct JournalHeader
+{
+  char magic[8];
+  uint32_t capacity; // entries
+  int32_t owner_pid;
+  uint64_t owner_start_ticks; // the pid of a smash that died may be reused by another process
+};
+
+struct JournalEntry
+{
+  int32_t job_id; // 0 for a free entry, written last
+  int32_t pgid;
+  uint32_t member_count;
+  uint32_t command_length;
+  int32_t pids[JobJournal::MAX_MEMBERS];
+  uint64_t start_ticks[JobJournal::MAX_MEMBERS];
+  char command[JobJournal::COMMAND_SIZE];
+};
+
+const int JobJournal::MAX_JOURNALS;
+const uint32_t JobJournal::MAX_MEMBERS;
+const uint32_t JobJournal::COMMAND_SIZE;
+const uint32_t JobJournal::INITIAL_CAPACITY;
+
+static_assert(sizeof(JournalHeader) <= HEADER_SIZE, "the header does not fit");
+static_assert(sizeof(JournalEntry) == 512, "an entry is 512 bytes");
+
+// * Helper Functions
+
+static size_t _file_size(uint32_t capacity)
+{
+  return HEADER_SIZE + (size_t)capacity * sizeof(JournalEntry);
+}
+
+// * JobJournal
+
+JobJournal::JobJournal()
+    : m_fd(-1),
+      m_map(nullptr),
+      m_map_size(0),
+      m_owner(-1),
+      m_slots(),
+      m_free()
+{
+}
+
+JobJournal::~JobJournal()
+{
+  release();
+}
+
+bool JobJournal::open(const std::string &base, std::vector<Record> *records)
+{
+  release();
+  unsigned long long own_ticks = 0;
+  startTicks(getpid(), &own_ticks);
+  // first a journal a smash left jobs in, then any one that is free
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (int i = 0; i < MAX_JOURNALS; i++)
+    {
+      int res = claim(base + "." + std::to_string(i), own_ticks, pass == 0, records);
+      if (res != 0)
+      {
+        return res == 1;
+      }
+    }
+  }
+  errno = EBUSY; // every journal belongs to a smash that runs
+  return false;
+}
+
+void JobJournal::record(int job_id, pid_t pgid, const std::vector<pid_t> &members, const std::string &command)
+{
+  if (!isOpen() || !isOwner() || job_id <= 0)
+  {
+    return;
+  }
+  uint32_t slot;
+  std::map<int, uint32_t>::iterator it = m_slots.find(job_id);
+  if (it != m_slots.end())
+  {
+    slot = it->second;
+  }
+  else
+  {
+    if (m_free.empty() && !grow())
+    {
+      return; // the job runs all the same, it is not taken back after a crash
+    }
+    slot = m_free.back();
+    m_free.pop_back();
+    m_slots[job_id] = slot;
+  }
+
+  JournalEntry &entry = entries()[slot];
+  __atomic_store_n(&entry.job_id, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST); // the entry is free before any of it changes
+  entry.pgid = pgid;
+  entry.member_count = 0;
+  for (pid_t pid : members)
+  {
+    // a member that already exited is left out, there is nothing to take back
+    unsigned long long ticks = 0;
+    if (entry.member_count < MAX_MEMBERS && startTicks(pid, &ticks))
+    {
+      entry.pids[entry.member_count] = pid;
+      entry.start_ticks[entry.member_count] = ticks;
+      entry.member_count++;
+    }
+  }
+  entry.command_length = std::min((uint32_t)command.size(), COMMAND_SIZE);
+  memcpy(entry.command, command.data(), entry.command_length);
+  __atomic_store_n(&entry.job_id, job_id, __ATOMIC_RELEASE);
+}
+
+void JobJournal::erase(int job_id)
+{
+  if (!isOpen() || !isOwner())
+  {
+    return;
+  }
+  std::map<int, uint32_t>::iterator it = m_slots.find(job_id);
+  if (it == m_slots.end())
+  {
+    return;
+  }
+  __atomic_store_n(&entries()[it->second].job_id, 0, __ATOMIC_RELEASE);
+  m_free.push_back(it->second);
+  m_slots.erase(it);
+}
+
+bool JobJournal::startTicks(pid_t pid, unsigned long long *ticks)
+{
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    return false;
+  }
+  char buffer[1024];
+  ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+  ::close(fd);
+  if (size <= 0)
+  {
+    return false;
+  }
+  buffer[size] = '\0';
+  // the name (field 2) may hold spaces and parentheses, the fields after it start after the last ')'
+  char *field = strrchr(buffer, ')');
+  if (field == nullptr || field[1] != ' ' || field[2] == 'Z' || field[2] == 'X') // a zombie is gone already
+  {
+    return false;
+  }
+  for (int i = 3; i <= 22 && field != nullptr; i++)
+  {
+    field = strchr(field + 1, ' ');
+  }
+  if (field == nullptr)
+  {
+    return false;
+  }
+  *ticks = strtoull(field + 1, nullptr, 10);
+  return true;
+}
+
+// * JobJournal Private
+
+int JobJournal::claim(const std::string &path, unsigned long long own_ticks, bool with_jobs,
+                      std::vector<Record> *records)
+{
+  int fd = ::open(path.c_str(), O_RDWR | (with_jobs ? 0 : O_CREAT) | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    return (with_jobs && errno == ENOENT) ? 0 : -1;
+  }
+  // the smashes that start together look at the owner one at a time
+  int res;
+  do
+  {
+    res = flock(fd, LOCK_EX);
+  } while (res == -1 && errno == EINTR);
+  struct stat status;
+  if (res == -1 || fstat(fd, &status) == -1)
+  {
+    int error = errno;
+    ::close(fd); // and its flock with it
+    errno = error;
+    return -1;
+  }
+
+  JournalHeader head;
+  bool valid = (size_t)status.st_size >= HEADER_SIZE && pread(fd, &head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+               memcmp(head.magic, MAGIC, sizeof(MAGIC)) == 0 && head.capacity > 0 &&
+               (size_t)status.st_size >= _file_size(head.capacity);
+  unsigned long long ticks = 0;
+  if ((valid && head.owner_pid != getpid() && startTicks(head.owner_pid, &ticks) && ticks == head.owner_start_ticks) ||
+      (!valid && with_jobs))
+  {
+    ::close(fd); // a smash that runs owns it, or there are no jobs in it
+    return 0;
+  }
+  if (!valid)
+  {
+    // a new file, or not a journal: it starts empty
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.capacity = INITIAL_CAPACITY;
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, _file_size(head.capacity)) == -1)
+    {
+      int error = errno;
+      ::close(fd);
+      errno = error;
+      return -1;
+    }
+  }
+  void *map = mmap(nullptr, _file_size(head.capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    int error = errno;
+    ::close(fd);
+    errno = error;
+    return -1;
+  }
+  m_fd = fd;
+  m_map = (char *)map;
+  m_map_size = _file_size(head.capacity);
+  uint32_t jobs = 0;
+  for (uint32_t slot = 0; slot < head.capacity; slot++)
+  {
+    jobs += entries()[slot].job_id > 0;
+  }
+  if (with_jobs && jobs == 0)
+  {
+    release();
+    return 0;
+  }
+  m_owner = getpid();
+  head.owner_pid = getpid();
+  head.owner_start_ticks = own_ticks;
+  *header() = head;
+
+  // the jobs of the last owner, every entry is free again and the jobs that are taken back are written again
+  for (uint32_t slot = head.capacity; slot > 0; slot--)
+  {
+    JournalEntry &entry = entries()[slot - 1];
+    if (entry.job_id > 0 && records != nullptr)
+    {
+      Record record;
+      record.job_id = entry.job_id;
+      record.pgid = entry.pgid;
+      record.command.assign(entry.command, std::min(entry.command_length, COMMAND_SIZE));
+      for (uint32_t j = 0; j < std::min(entry.member_count, MAX_MEMBERS); j++)
+      {
+        Member member = {entry.pids[j], entry.start_ticks[j]};
+        record.members.push_back(member);
+      }
+      records->push_back(record);
+    }
+    entry.job_id = 0;
+    m_free.push_back(slot - 1);
+  }
+  flock(fd, LOCK_UN);
+  if (records != nullptr)
+  {
+    std::sort(records->begin(), records->end(), [](const Record &a, const Record &b) { return a.job_id < b.job_id; });
+  }
+  return 1;
+}
+
+JournalHeader *JobJournal::header() const
+{
+  return (JournalHeader *)m_map;
+}
+
+JournalEntry *JobJournal::entries() const
+{
+  return (JournalEntry *)(m_map + HEADER_SIZE);
+}
+
+bool JobJournal::isOwner() const
+{
+  return getpid() == m_owner;
+}
+
+bool JobJournal::grow()
+{
+  uint32_t capacity = header()->capacity;
+  size_t size = _file_size(capacity * 2);
+  if (ftruncate(m_fd, size) == -1)
+  {
+    return false;
+  }
+  void *map = mremap(m_map, m_map_size, size, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+  {
+    return false;
+  }
+  m_map = (char *)map;
+  m_map_size = size;
+  // after the file grew: a smash that reads it after a crash in between sees the entries it had
+  header()->capacity = capacity * 2;
+  for (uint32_t slot = capacity * 2; slot > capacity; slot--)
+  {
+    m_free.push_back(slot - 1);
+  }
+  return true;
+}
+
+void JobJournal::release()
+{
+  if (m_map != nullptr)
+  {
+    munmap(m_map, m_map_size);
+    m_map = nullptr;
+    m_map_size = 0;
+  }
+  if (m_fd != -1)
+  {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_owner = -1;
+  m_slots.clear();
+  m_free.clear();
+}
@@ -0,0 +1,84 @@
+#ifndef SMASH__JOURNAL_H_
+#define SMASH__JOURNAL_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct JournalHeader;
+struct JournalEntry;
+
+/**
+ * @brief The background jobs of smash in a file mapped with MAP_SHARED, so a smash that starts after one that died
+ *    (or quit without killing its jobs) finds the jobs that still run and takes them back into its jobs list.
+ *    An entry has a fixed size: the job id, the process group, the command line (cut at COMMAND_SIZE) and the pid
+ *    and start time of every member (the first MAX_MEMBERS of a pipeline). A pid alone is not enough, it may belong to
+ *    another process by now: a member is taken back only if the start time in /proc/<pid>/stat is still the same.
+ *
+ *    The job id of an entry is written last and cleared first, so a smash that is killed in the middle of a write
+ *    leaves an entry that is either whole or free. The pages belong to the kernel, nothing has to be synced for that.
+ *    A journal belongs to the smash written in its header while that smash runs (its pid and start time), a second
+ *    smash of the user takes another one: <base>.0 up to <base>.<MAX_JOURNALS - 1>, first one that jobs were left in.
+ *    Only the smash that opened it writes to it, not the sons it forked and that share the mapping.
+ */
+class JobJournal
+{
+public:
+  struct Member
+  {
+    pid_t pid;
+    unsigned long long start_ticks; // field 22 of /proc/<pid>/stat
+  };
+  struct Record
+  {
+    int job_id;
+    pid_t pgid;
+    std::string command;
+    std::vector<Member> members;
+  };
+
+  JobJournal();
+  ~JobJournal();
+  JobJournal(JobJournal const &) = delete;
+  void operator=(JobJournal const &) = delete;
+
+  // takes the first journal of base that no running smash owns, records gets the jobs of the smash that owned it
+  // before. false with errno when none could be opened
+  bool open(const std::string &base, std::vector<Record> *records);
+  bool isOpen() const { return m_map != nullptr; }
+  // adds the job, or writes it again when it is already there (a stopped job that came back)
+  void record(int job_id, pid_t pgid, const std::vector<pid_t> &members, const std::string &command);
+  void erase(int job_id);
+
+  // the start time of a process in clock ticks since the boot, false if it is gone (or a zombie)
+  static bool startTicks(pid_t pid, unsigned long long *ticks);
+
+  static const int MAX_JOURNALS = 8;
+  static const uint32_t MAX_MEMBERS = 8;
+  static const uint32_t COMMAND_SIZE = 400;
+  static const uint32_t INITIAL_CAPACITY = 64;
+
+private:
+  int m_fd;
+  char *m_map;
+  size_t m_map_size;
+  pid_t m_owner;
+  std::map<int, uint32_t> m_slots; // job id -> entry
+  std::vector<uint32_t> m_free;    // the free entries, the last one is used first
+
+  JournalHeader *header() const;
+  JournalEntry *entries() const;
+  // takes the journal at path when no smash that runs owns it (and jobs were left in it, with_jobs): 1 when it was
+  // taken, 0 when it was not and -1 with errno on failure
+  int claim(const std::string &path, unsigned long long own_ticks, bool with_jobs, std::vector<Record> *records);
+  // writes to the journal are made by its owner only
+  bool isOwner() const;
+  // doubles the room for entries, false when the file could not grow
+  bool grow();
+  void release();
+};
+
+#endif //SMASH__JOURNAL_H_
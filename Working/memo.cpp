@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "memo.h"
+
+using namespace std;
+
+static const char MAGIC[] = "SMASHMEMO1";
+static const char STATS_NAME[] = "stats";
+// a temporary entry this old was left by a smash that died while it stored it
+static const time_t TEMPORARY_TTL = 60 * 60;
+
+const unsigned long long MemoCache::DEFAULT_MAX_BYTES;
+
+// * Helper Functions
+
+// the finalizer of splitmix64
+static inline uint64_t _mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static bool _write_all(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+    if (written == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (written <= 0)
+    {
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+// * MemoCache::Hasher
+
+MemoCache::Hasher::Hasher()
+    : m_a(0x9E3779B97F4A7C15ULL),
+      m_b(0xC2B2AE3D27D4EB4FULL),
+      m_tail(),
+      m_tail_length(0),
+      m_length(0)
+{
+}
+
+void MemoCache::Hasher::update(const char *data, size_t length)
+{
+  m_length += length;
+  while (length > 0 && (m_tail_length > 0 || length < 8))
+  {
+    m_tail[m_tail_length++] = *data++;
+    length--;
+    if (m_tail_length == 8)
+    {
+      uint64_t value;
+      memcpy(&value, m_tail, 8);
+      word(value);
+      m_tail_length = 0;
+    }
+  }
+  // whole words straight from the data
+  for (; length >= 8; data += 8, length -= 8)
+  {
+    uint64_t value;
+    memcpy(&value, data, 8);
+    word(value);
+  }
+  if (length > 0)
+  {
+    memcpy(m_tail, data, length);
+    m_tail_length = length;
+  }
+}
+
+std::string MemoCache::Hasher::hex() const
+{
+  uint64_t last = 0;
+  memcpy(&last, m_tail, m_tail_length);
+  uint64_t a = _mix(m_a ^ last);
+  uint64_t b = _mix(m_b + last + m_length);
+  uint64_t high = _mix(a ^ (b >> 1) ^ m_length);
+  uint64_t low = _mix(b ^ high);
+  char text[33];
+  snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)high, (unsigned long long)low);
+  return text;
+}
+
+void MemoCache::Hasher::word(uint64_t value)
+{
+  m_a = _mix(m_a ^ value);
+  m_b = (m_b ^ value) * 0x9E3779B97F4A7C15ULL + m_a;
+}
+
+// * MemoCache
+
+MemoCache::MemoCache(const std::string &directory, unsigned long long max_bytes)
+    : m_directory(directory),
+      m_max_bytes(max_bytes)
+{
+}
+
+bool MemoCache::replay(const std::string &key, int out_fd, int err_fd, int *status, long long *elapsed_ms)
+{
+  int fd = open(path(key).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    return false;
+  }
+  char header[128];
+  ssize_t size = pread(fd, header, sizeof(header) - 1, 0);
+  header[std::max(size, (ssize_t)0)] = '\0';
+  unsigned long long key_length = 0, out_length = 0, err_length = 0;
+  int consumed = 0;
+  std::string stored;
+  bool valid = sscanf(header, "SMASHMEMO1 %d %lld %llu %llu %llu\n%n", status, elapsed_ms, &key_length, &out_length,
+                      &err_length, &consumed) == 5 &&
+               consumed > 0 && key_length == key.size();
+  if (valid)
+  {
+    stored.resize(key_length);
+    valid = pread(fd, &stored[0], key_length, consumed) == (ssize_t)key_length && stored == key;
+  }
+  if (!valid)
+  {
+    close(fd);
+    return false;
+  }
+  off_t offset = consumed + key_length;
+  copy(fd, offset, out_length, out_fd);
+  copy(fd, offset + out_length, err_length, err_fd);
+  futimens(fd, nullptr); // used now, it is evicted last
+  close(fd);
+  return true;
+}
+
+bool MemoCache::store(const std::string &key, int status, long long elapsed_ms, int out_fd, int err_fd)
+{
+  if (mkdir(m_directory.c_str(), 0700) == -1 && errno != EEXIST)
+  {
+    return false;
+  }
+  struct stat out_status, err_status;
+  if (fstat(out_fd, &out_status) == -1 || fstat(err_fd, &err_status) == -1)
+  {
+    return false;
+  }
+  char header[128];
+  int header_length = snprintf(header, sizeof(header), "%s %d %lld %llu %llu %llu\n", MAGIC, status, elapsed_ms,
+                               (unsigned long long)key.size(), (unsigned long long)out_status.st_size,
+                               (unsigned long long)err_status.st_size);
+  if (header_length + key.size() + out_status.st_size + err_status.st_size > m_max_bytes)
+  {
+    return true; // it would push everything else out, it is not kept
+  }
+
+  std::string final_path = path(key);
+  std::string temporary =
+      m_directory + "/." + final_path.substr(m_directory.size() + 1) + "." + std::to_string(getpid());
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    return false;
+  }
+  bool written = _write_all(fd, header, header_length) && _write_all(fd, key.data(), key.size()) &&
+                 copy(out_fd, 0, out_status.st_size, fd) && copy(err_fd, 0, err_status.st_size, fd);
+  int error = errno;
+  close(fd);
+  if (!written || rename(temporary.c_str(), final_path.c_str()) == -1)
+  {
+    error = written ? errno : error;
+    unlink(temporary.c_str());
+    errno = error;
+    return false;
+  }
+  evict();
+  return true;
+}
+
+void MemoCache::count(bool hit, long long saved_ms)
+{
+  if (mkdir(m_directory.c_str(), 0700) == -1 && errno != EEXIST)
+  {
+    return;
+  }
+  int fd = open((m_directory + "/" + STATS_NAME).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    return;
+  }
+  // the smashes that share the directory count one at a time
+  if (flock(fd, LOCK_EX) == 0)
+  {
+    char text[96];
+    ssize_t size = pread(fd, text, sizeof(text) - 1, 0);
+    text[std::max(size, (ssize_t)0)] = '\0';
+    unsigned long long hits = 0, misses = 0, saved = 0;
+    sscanf(text, "%llu %llu %llu", &hits, &misses, &saved);
+    if (hit)
+    {
+      hits++;
+      saved += std::max(saved_ms, 0LL);
+    }
+    else
+    {
+      misses++;
+    }
+    // the numbers only grow, the new text is never shorter than the old one
+    int length = snprintf(text, sizeof(text), "%llu %llu %llu\n", hits, misses, saved);
+    (void)!pwrite(fd, text, length, 0);
+  }
+  close(fd); // and its flock with it
+}
+
+bool MemoCache::stats(Stats *stats) const
+{
+  memset(stats, 0, sizeof(*stats));
+  int fd = open((m_directory + "/" + STATS_NAME).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd != -1)
+  {
+    char text[96];
+    ssize_t size = pread(fd, text, sizeof(text) - 1, 0);
+    text[std::max(size, (ssize_t)0)] = '\0';
+    sscanf(text, "%llu %llu %llu", &stats->hits, &stats->misses, &stats->saved_ms);
+    close(fd);
+  }
+  DIR *directory = opendir(m_directory.c_str());
+  if (directory == nullptr)
+  {
+    return errno == ENOENT; // nothing was stored yet
+  }
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != nullptr)
+  {
+    struct stat status;
+    if (entry->d_name[0] != '.' && strcmp(entry->d_name, STATS_NAME) != 0 &&
+        fstatat(dirfd(directory), entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+      stats->entries++;
+      stats->bytes += status.st_size;
+    }
+  }
+  closedir(directory);
+  return true;
+}
+
+bool MemoCache::copy(int in_fd, off_t offset, unsigned long long length, int out_fd)
+{
+  while (length > 0)
+  {
+    ssize_t sent = sendfile(out_fd, in_fd, &offset, std::min(length, 1ULL << 30));
+    if (sent == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (sent == -1 && (errno == EINVAL || errno == ENOSYS))
+    {
+      break; // out_fd does not take sendfile (opened with O_APPEND), the rest is read and written
+    }
+    if (sent <= 0)
+    {
+      return false;
+    }
+    length -= sent;
+  }
+  char buffer[64 * 1024];
+  while (length > 0)
+  {
+    ssize_t count = pread(in_fd, buffer, std::min(length, (unsigned long long)sizeof(buffer)), offset);
+    if (count == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0 || !_write_all(out_fd, buffer, count))
+    {
+      return false;
+    }
+    offset += count;
+    length -= count;
+  }
+  return true;
+}
+
+// * MemoCache Private
+
+std::string MemoCache::path(const std::string &key) const
+{
+  Hasher hasher;
+  hasher.update(key.data(), key.size());
+  return m_directory + "/" + hasher.hex();
+}
+
+void MemoCache::evict()
+{
+  struct Entry
+  {
+    struct timespec used;
+    off_t size;
+    std::string name;
+  };
+  DIR *directory = opendir(m_directory.c_str());
+  if (directory == nullptr)
+  {
+    return;
+  }
+  std::vector<Entry> entries;
+  unsigned long long total = 0;
+  time_t now = time(nullptr);
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != nullptr)
+  {
+    struct stat status;
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+        strcmp(entry->d_name, STATS_NAME) == 0 ||
+        fstatat(dirfd(directory), entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == -1)
+    {
+      continue;
+    }
+    if (entry->d_name[0] == '.') // a temporary entry
+    {
+      if (now - status.st_mtime > TEMPORARY_TTL)
+      {
+        unlinkat(dirfd(directory), entry->d_name, 0);
+      }
+      continue;
+    }
+    Entry found = {status.st_mtim, status.st_size, entry->d_name};
+    entries.push_back(found);
+    total += status.st_size;
+  }
+  if (total > m_max_bytes)
+  {
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+      return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > m_max_bytes; i++)
+    {
+      if (unlinkat(dirfd(directory), entries[i].name.c_str(), 0) == 0)
+      {
+        total -= entries[i].size;
+      }
+    }
+  }
+  closedir(directory);
+}
@@ -0,0 +1,75 @@
+#ifndef SMASH__MEMO_H_
+#define SMASH__MEMO_H_
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief The cache of `memo`: what a command printed (stdout and stderr) and its exit status, in a file of a directory
+ *    named by a 128 bit hash of its key. The key is everything the output depends on (the command line, variables,
+ *    the cwd, the state of the input files). The file holds the key too and a hit compares it, so two keys with the
+ *    same hash never share an output.
+ *
+ *    An entry is written under a temporary name and renamed, a reader sees a whole entry or none (another smash may
+ *    store the same key meanwhile). The mtime of an entry is the time it was used last: after a store the least
+ *    recently used ones are removed until the directory is under its bound again.
+ *    The hits, the misses and the time the hits saved are counted in the `stats` file of the directory under a flock.
+ */
+class MemoCache
+{
+public:
+  struct Stats
+  {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long saved_ms; // the time of the runs the hits replayed, less the time of the replays
+    size_t entries;
+    unsigned long long bytes;
+  };
+
+  // a 128 bit hash, fed in pieces (a key, or the content of a file read in chunks). not cryptographic
+  class Hasher
+  {
+  public:
+    Hasher();
+    void update(const char *data, size_t length);
+    // 32 hex digits
+    std::string hex() const;
+
+  private:
+    uint64_t m_a;
+    uint64_t m_b;
+    unsigned char m_tail[8]; // the bytes of an unfinished word
+    size_t m_tail_length;
+    unsigned long long m_length;
+
+    void word(uint64_t word);
+  };
+
+  MemoCache(const std::string &directory, unsigned long long max_bytes);
+
+  // writes the output stored for key to out_fd and err_fd and marks it used. false when there is none
+  bool replay(const std::string &key, int out_fd, int err_fd, int *status, long long *elapsed_ms);
+  // stores the output written to out_fd and err_fd (from their start) for key, then evicts. false with errno
+  bool store(const std::string &key, int status, long long elapsed_ms, int out_fd, int err_fd);
+  // one more hit that saved saved_ms, or one more miss
+  void count(bool hit, long long saved_ms);
+  bool stats(Stats *stats) const;
+
+  // copies length bytes of in_fd from offset to out_fd, with sendfile when it can. false with errno
+  static bool copy(int in_fd, off_t offset, unsigned long long length, int out_fd);
+
+  static const unsigned long long DEFAULT_MAX_BYTES = 256ULL << 20;
+
+private:
+  std::string m_directory;
+  unsigned long long m_max_bytes;
+
+  std::string path(const std::string &key) const;
+  // removes the least recently used entries (and the temporary files of a smash that died) past the bound
+  void evict();
+};
+
+#endif //SMASH__MEMO_H_
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+#include "scan.h"
+
+using namespace std;
+
+const size_t LineScan::npos;
+
+// the innermost scope of the thread, the scopes of a thread nest like the calls that hold them
+static thread_local const LineScan::Scope *t_scope = nullptr;
+// LineScan::of a line without a scope
+static thread_local LineScan t_spare;
+
+// * Helper Functions
+
+// " \n\r\t\f\v": a space, or 9 (\t) to 13 (\r)
+static inline bool _is_space(char c)
+{
+  return c == ' ' || (unsigned char)(c - 9) <= 4;
+}
+
+static inline int _lowest_bit(uint64_t mask)
+{
+  return __builtin_ctzll(mask);
+}
+
+static inline int _highest_bit(uint64_t mask)
+{
+  return 63 - __builtin_clzll(mask);
+}
+
+#ifdef __SSE2__
+// a bit for every one of the 16 characters at text that is not whitespace
+static inline uint32_t _text_mask_sse2(__m128i chars)
+{
+  __m128i spaces = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+  // unsigned c - 9 <= 4, SSE2 has no unsigned compare but a saturating subtraction
+  __m128i controls = _mm_subs_epu8(_mm_sub_epi8(chars, _mm_set1_epi8(9)), _mm_set1_epi8(4));
+  spaces = _mm_or_si128(spaces, _mm_cmpeq_epi8(controls, _mm_setzero_si128()));
+  return ~(uint32_t)_mm_movemask_epi8(spaces) & 0xffff;
+}
+#endif
+
+static LineScan::Engine _detect_engine()
+{
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return LineScan::AVX2;
+  }
+#endif
+#ifdef __SSE2__
+  return LineScan::SSE2;
+#else
+  return LineScan::SCALAR;
+#endif
+}
+
+// * LineScan
+
+LineScan::LineScan()
+    : m_line(""),
+      m_length(0),
+      m_begin(0),
+      m_end(0),
+      m_positions()
+{
+  for (int special = 0; special < SPECIAL_COUNT; special++)
+  {
+    m_first[special] = npos;
+    m_last[special] = npos;
+  }
+}
+
+LineScan::LineScan(const char *line, size_t length, Engine engine)
+    : m_line(line),
+      m_length(length),
+      m_begin(0),
+      m_end(0),
+      m_positions()
+{
+  scan(engine);
+}
+
+LineScan::LineScan(const std::string &line, Engine engine)
+    : LineScan(line.c_str(), line.size(), engine)
+{
+}
+
+size_t LineScan::nextSpecial(size_t from) const
+{
+  size_t word = from / 64;
+  if (word >= m_positions.size())
+  {
+    return npos;
+  }
+  uint64_t mask = m_positions[word] & (~0ULL << (from % 64));
+  while (mask == 0)
+  {
+    if (++word == m_positions.size())
+    {
+      return npos;
+    }
+    mask = m_positions[word];
+  }
+  return word * 64 + _lowest_bit(mask);
+}
+
+LineScan::Engine LineScan::best()
+{
+  static const Engine engine = _detect_engine();
+  return engine;
+}
+
+const char *LineScan::engineName(Engine engine)
+{
+  switch (engine)
+  {
+  case AVX2:
+    return "avx2";
+  case SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
+
+void LineScan::trim(const char *text, size_t length, size_t *begin, size_t *end)
+{
+  size_t first = 0;
+  bool found = false;
+#ifdef __SSE2__
+  for (; first + 16 <= length; first += 16)
+  {
+    uint32_t mask = _text_mask_sse2(_mm_loadu_si128((const __m128i *)(text + first)));
+    if (mask != 0)
+    {
+      first += _lowest_bit(mask);
+      found = true;
+      break;
+    }
+  }
+#endif
+  while (!found && first < length)
+  {
+    found = !_is_space(text[first]);
+    first += found ? 0 : 1;
+  }
+  if (!found)
+  {
+    *begin = 0;
+    *end = 0;
+    return;
+  }
+
+  // there is text at first, so the search from the back stops at it
+  size_t last = length;
+  found = false;
+#ifdef __SSE2__
+  for (; last >= first + 16; last -= 16)
+  {
+    uint32_t mask = _text_mask_sse2(_mm_loadu_si128((const __m128i *)(text + last - 16)));
+    if (mask != 0)
+    {
+      last = last - 16 + _highest_bit(mask) + 1;
+      found = true;
+      break;
+    }
+  }
+#endif
+  while (!found && _is_space(text[last - 1]))
+  {
+    last--;
+  }
+  *begin = first;
+  *end = last;
+}
+
+const LineScan &LineScan::of(const char *line)
+{
+  for (const Scope *scope = t_scope; scope != nullptr; scope = scope->m_outer)
+  {
+    if (scope->m_scan.m_line == line)
+    {
+      return scope->m_scan;
+    }
+  }
+  t_spare = LineScan(line, strlen(line));
+  return t_spare;
+}
+
+void LineScan::scan(Engine engine)
+{
+  for (int special = 0; special < SPECIAL_COUNT; special++)
+  {
+    m_first[special] = npos;
+    m_last[special] = npos;
+  }
+  m_begin = npos;
+  m_end = 0;
+  m_positions.clear();
+  m_positions.reserve((m_length + 63) / 64);
+
+  // an engine this build or this CPU does not have falls back to the next one
+#ifdef SCAN_X86
+  if (engine == AVX2 && best() == AVX2)
+  {
+    scanAvx2();
+  }
+  else
+#endif
+#ifdef __SSE2__
+  if (engine != SCALAR)
+  {
+    scanSse2();
+  }
+  else
+#endif
+  {
+    scanScalar();
+  }
+
+  if (m_begin == npos) // blank
+  {
+    m_begin = 0;
+    m_end = 0;
+  }
+}
+
+void LineScan::addBlock(size_t offset, uint64_t text, const uint64_t specials[SPECIAL_COUNT])
+{
+  if (text != 0)
+  {
+    if (m_begin == npos)
+    {
+      m_begin = offset + _lowest_bit(text);
+    }
+    m_end = offset + _highest_bit(text) + 1;
+  }
+  uint64_t all = 0;
+  for (int special = 0; special < SPECIAL_COUNT; special++)
+  {
+    uint64_t mask = specials[special];
+    if (mask == 0)
+    {
+      continue;
+    }
+    if (m_first[special] == npos)
+    {
+      m_first[special] = offset + _lowest_bit(mask);
+    }
+    m_last[special] = offset + _highest_bit(mask);
+    all |= mask;
+  }
+  m_positions.push_back(all);
+}
+
+void LineScan::scanScalar()
+{
+  for (size_t offset = 0; offset < m_length; offset += 64)
+  {
+    uint64_t text = 0;
+    uint64_t specials[SPECIAL_COUNT] = {0};
+    size_t count = std::min((size_t)64, m_length - offset);
+    for (size_t i = 0; i < count; i++)
+    {
+      char c = m_line[offset + i];
+      uint64_t bit = 1ULL << i;
+      text |= _is_space(c) ? 0 : bit;
+      specials[REDIRECT] |= (c == '>') ? bit : 0;
+      specials[PIPE] |= (c == '|') ? bit : 0;
+      specials[AMPERSAND] |= (c == '&') ? bit : 0;
+      specials[GLOB] |= (c == '*' || c == '?') ? bit : 0;
+      specials[SEMICOLON] |= (c == ';') ? bit : 0;
+    }
+    addBlock(offset, text, specials);
+  }
+}
+
+#ifdef __SSE2__
+void LineScan::scanSse2()
+{
+  const __m128i greater = _mm_set1_epi8('>');
+  const __m128i bar = _mm_set1_epi8('|');
+  const __m128i ampersand = _mm_set1_epi8('&');
+  const __m128i star = _mm_set1_epi8('*');
+  const __m128i question = _mm_set1_epi8('?');
+  const __m128i semicolon = _mm_set1_epi8(';');
+  char tail[64];
+  for (size_t offset = 0; offset < m_length; offset += 64)
+  {
+    // the last block is copied so nothing past the end of the line is read, the padding is masked out below
+    const char *block = m_line + offset;
+    size_t count = m_length - offset;
+    if (count < 64)
+    {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, block, count);
+      block = tail;
+    }
+    uint64_t text = 0;
+    uint64_t specials[SPECIAL_COUNT] = {0};
+    for (int part = 0; part < 4; part++)
+    {
+      __m128i chars = _mm_loadu_si128((const __m128i *)(block + part * 16));
+      int shift = part * 16;
+      text |= (uint64_t)_text_mask_sse2(chars) << shift;
+      specials[REDIRECT] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, greater)) << shift;
+      specials[PIPE] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, bar)) << shift;
+      specials[AMPERSAND] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, ampersand)) << shift;
+      __m128i glob = _mm_or_si128(_mm_cmpeq_epi8(chars, star), _mm_cmpeq_epi8(chars, question));
+      specials[GLOB] |= (uint64_t)(uint32_t)_mm_movemask_epi8(glob) << shift;
+      specials[SEMICOLON] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, semicolon)) << shift;
+    }
+    if (count < 64)
+    {
+      uint64_t valid = (1ULL << count) - 1;
+      text &= valid;
+      for (int special = 0; special < SPECIAL_COUNT; special++)
+      {
+        specials[special] &= valid;
+      }
+    }
+    addBlock(offset, text, specials);
+  }
+}
+#else
+void LineScan::scanSse2()
+{
+  scanScalar();
+}
+#endif
+
+#ifdef SCAN_X86
+__attribute__((target("avx2"))) void LineScan::scanAvx2()
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i nine = _mm256_set1_epi8(9);
+  const __m256i four = _mm256_set1_epi8(4);
+  const __m256i greater = _mm256_set1_epi8('>');
+  const __m256i bar = _mm256_set1_epi8('|');
+  const __m256i ampersand = _mm256_set1_epi8('&');
+  const __m256i star = _mm256_set1_epi8('*');
+  const __m256i question = _mm256_set1_epi8('?');
+  const __m256i semicolon = _mm256_set1_epi8(';');
+  char tail[64];
+  for (size_t offset = 0; offset < m_length; offset += 64)
+  {
+    const char *block = m_line + offset;
+    size_t count = m_length - offset;
+    if (count < 64)
+    {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, block, count);
+      block = tail;
+    }
+    uint64_t text = 0;
+    uint64_t specials[SPECIAL_COUNT] = {0};
+    for (int part = 0; part < 2; part++)
+    {
+      __m256i chars = _mm256_loadu_si256((const __m256i *)(block + part * 32));
+      int shift = part * 32;
+      // unsigned c - 9 <= 4 is min(c - 9, 4) == c - 9
+      __m256i controls = _mm256_sub_epi8(chars, nine);
+      __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(chars, space),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(controls, four), controls));
+      text |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(spaces) << shift;
+      specials[REDIRECT] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, greater)) << shift;
+      specials[PIPE] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, bar)) << shift;
+      specials[AMPERSAND] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, ampersand)) << shift;
+      __m256i glob = _mm256_or_si256(_mm256_cmpeq_epi8(chars, star), _mm256_cmpeq_epi8(chars, question));
+      specials[GLOB] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(glob) << shift;
+      specials[SEMICOLON] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, semicolon)) << shift;
+    }
+    if (count < 64)
+    {
+      uint64_t valid = (1ULL << count) - 1;
+      text &= valid;
+      for (int special = 0; special < SPECIAL_COUNT; special++)
+      {
+        specials[special] &= valid;
+      }
+    }
+    addBlock(offset, text, specials);
+  }
+}
+#else
+void LineScan::scanAvx2()
+{
+  scanSse2();
+}
+#endif
+
+// * LineScan::Scope
+
+LineScan::Scope::Scope(const char *line)
+    : m_scan(line, strlen(line)),
+      m_outer(t_scope)
+{
+  t_scope = this;
+}
+
+LineScan::Scope::~Scope()
+{
+  t_scope = m_outer;
+}
+
+void LineScan::Scope::rescan(const char *line)
+{
+  m_scan = LineScan(line, strlen(line));
+}
@@ -0,0 +1,112 @@
+#ifndef SMASH__SCAN_H_
+#define SMASH__SCAN_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief One pass over a command line that finds its whitespace bounds and where its special characters are,
+ *    the classifiers of the parser (`_trim`, `_isBackgroundCommand`, `_is_redirection_command`, `_is_pipe_command`,
+ *    the complexity of an external command, the connectors of a list) read the result instead of searching again.
+ *
+ *    The line is classified 64 characters at a time: four 16 byte SSE2 compares (the baseline of x86-64), or two
+ *    32 byte AVX2 compares when the CPU has AVX2 (picked once at runtime), or a scalar loop anywhere else.
+ *    Every engine builds the same result, bench/line_scan.sh checks them against each other and against the
+ *    std::string searches they replace.
+ */
+class LineScan
+{
+public:
+  enum Special
+  {
+    REDIRECT,  // >
+    PIPE,      // |
+    AMPERSAND, // &
+    GLOB,      // * and ?
+    SEMICOLON, // ;
+    SPECIAL_COUNT
+  };
+  enum Engine
+  {
+    SCALAR,
+    SSE2,
+    AVX2
+  };
+  static const size_t npos = std::string::npos;
+
+  LineScan();
+  LineScan(const char *line, size_t length, Engine engine = best());
+  explicit LineScan(const std::string &line, Engine engine = best());
+
+  const char *line() const { return m_line; }
+  size_t length() const { return m_length; }
+  // the first character that is not whitespace and one past the last one, both 0 for a blank line
+  size_t begin() const { return m_begin; }
+  size_t end() const { return m_end; }
+  bool isBlank() const { return m_begin == m_end; }
+  // the last character that is not whitespace, '\0' for a blank line
+  char last() const { return isBlank() ? '\0' : m_line[m_end - 1]; }
+
+  bool has(Special special) const { return m_first[special] != npos; }
+  // where the first and the last of a special character is, npos when the line has none
+  size_t first(Special special) const { return m_first[special]; }
+  size_t last(Special special) const { return m_last[special]; }
+  // every special character of the line, bit i % 64 of word i / 64
+  const std::vector<uint64_t> &positions() const { return m_positions; }
+  // the next special character at from or after it, npos when there is none
+  size_t nextSpecial(size_t from) const;
+
+  // the fastest engine of this CPU, chosen at the first call
+  static Engine best();
+  static const char *engineName(Engine engine);
+  // the whitespace bounds only, it reads the leading and the trailing whitespace and nothing in between
+  static void trim(const char *text, size_t length, size_t *begin, size_t *end);
+
+  /**
+   * the scan of line: the one of the innermost Scope that scanned this very pointer, or a new one in a buffer of
+   * the thread that the next miss overwrites
+   */
+  static const LineScan &of(const char *line);
+
+  class Scope;
+
+private:
+  const char *m_line;
+  size_t m_length;
+  size_t m_begin;
+  size_t m_end;
+  size_t m_first[SPECIAL_COUNT];
+  size_t m_last[SPECIAL_COUNT];
+  std::vector<uint64_t> m_positions;
+
+  void scan(Engine engine);
+  // the 64 characters from offset: a bit for every one that is not whitespace and a mask for every special
+  void addBlock(size_t offset, uint64_t text, const uint64_t specials[SPECIAL_COUNT]);
+  void scanScalar();
+  void scanSse2();
+  void scanAvx2();
+};
+
+/**
+ * @brief Scans a line for as long as it lives, LineScan::of finds it by the pointer.
+ *    The factory holds one while the command classes try the line, so it is scanned once and not once per class
+ */
+class LineScan::Scope
+{
+public:
+  explicit Scope(const char *line);
+  ~Scope();
+  Scope(Scope const &) = delete;
+  void operator=(Scope const &) = delete;
+  // the line was replaced (expanded), the scope is of the new one
+  void rescan(const char *line);
+
+private:
+  LineScan m_scan;
+  const Scope *m_outer;
+  friend class LineScan;
+};
+
+#endif //SMASH__SCAN_H_
@@ -9,14 +9,32 @@ void ctrlCHandler(int sig_num)
 {
   std::cout << "smash: got ctrl-C\n";
   SmallShell &smash = SmallShell::getInstance();
-  if (smash.getCurrForegroundPID() != -1)
+  smash.setInterrupted(true);
+  pid_t pgid = smash.getForegroundPgid();
+  if (pgid != -1)
   {
-    if (kill(smash.getCurrForegroundPID(), SIGKILL) == -1)
+    // every process of the job gets it (all the stages of a pipeline) and may clean up before it exits
+    if (killpg(pgid, SIGINT) == -1)
     {
       perror("smash error: kill failed");
       return;
     }
-    cout << "smash: process " << smash.getCurrForegroundPID() << " was killed\n";
-    smash.setCurrForegroundPID(-1);
+    cout << "smash: process group " << pgid << " was sent SIGINT\n";
+  }
+}
+
+void ctrlZHandler(int sig_num)
+{
+  std::cout << "smash: got ctrl-Z\n";
+  pid_t pgid = SmallShell::getInstance().getForegroundPgid();
+  // smash itself never stops, the foreground job does and goes to the jobs list as stopped
+  if (pgid != -1)
+  {
+    if (killpg(pgid, SIGTSTP) == -1)
+    {
+      perror("smash error: kill failed");
+      return;
+    }
+    cout << "smash: process group " << pgid << " was sent SIGTSTP\n";
   }
 }
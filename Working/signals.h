@@ -2,4 +2,6 @@
 #define SMASH__SIGNALS_H_
 
 void ctrlCHandler(int sig_num);
+// forwards ctrl-Z (SIGTSTP) to the foreground job, when smash has no terminal to do it
+void ctrlZHandler(int sig_num);
 #endif //SMASH__SIGNALS_H_
@@ -2,8 +2,71 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
 #include "Commands.h"
 #include "signals.h"
+#include "daemon.h"
+#include "zygote.h"
+#include "trace.h"
+
+/**
+ * Reads the next line of the input, the scheduled commands that come due meanwhile are started.
+ * returns false at the end of the input
+ */
+static bool _read_line(SmallShell &smash, std::string &input, std::string &line)
+{
+    Tracer::Span span("read line", "input");
+    while (true)
+    {
+        size_t end = input.find('\n');
+        if (end != std::string::npos)
+        {
+            line = input.substr(0, end);
+            input.erase(0, end + 1);
+            return true;
+        }
+        // a negative fd is ignored by poll: no timerfd, or no queued jobs to start, no logs to read and no coprocesses
+        // to restart
+        JobsList &jobs = smash.getJobsList();
+        bool job_events = jobs.queuedCount() || jobs.hasOpenLogs() || smash.getCoprocs().size();
+        struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0},
+                                {smash.getScheduler().getTimerFd(), POLLIN, 0},
+                                {job_events ? jobs.getExitEventsFd() : -1, POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1)
+        {
+            continue; // ctrl-C at the prompt
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            smash.runDueSchedules();
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            jobs.removeFinishedJobs();
+            smash.reviveCoprocs();
+        }
+        if (fds[0].revents)
+        {
+            char buffer[4096];
+            ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                // a last line without a new line is still a line
+                line = input;
+                input.clear();
+                return !line.empty();
+            }
+            input.append(buffer, count);
+        }
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -15,6 +78,11 @@ int main(int argc, char *argv[])
     {
         perror("smash error: failed to set ctrl-C handler");
     }
+    // ctrl-Z stops the foreground job and never smash
+    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR)
+    {
+        perror("smash error: failed to set ctrl-Z handler");
+    }
 
     // TODO: setup sig alarm handler (bonus)
     /**
@@ -24,18 +92,86 @@ int main(int argc, char *argv[])
      */
     
 
+    /**
+     * the jobs list holds a pidfd for every process of a job, so allow as many open files as we can.
+     * the commands get back the limit smash started with
+     */
+    struct rlimit files_limit;
+    if (getrlimit(RLIMIT_NOFILE, &files_limit) == 0 && files_limit.rlim_cur < files_limit.rlim_max)
+    {
+        rlim_t started_with = files_limit.rlim_cur;
+        files_limit.rlim_cur = files_limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &files_limit) == 0)
+        {
+            ExternalCommand::setFilesLimit(started_with);
+        }
+    }
+
+    /**
+     * `smash --daemon <socket>` serves sessions to many clients over a unix socket,
+     * `smash --client <socket>` runs its input in a session of such a daemon.
+     * neither gets a zygote: a session is a process the daemon forked, the sons of the zygote would not be its sons
+     */
+    if (argc == 3 && std::string(argv[1]) == "--daemon")
+    {
+        return runDaemon(argv[2]);
+    }
+    if (argc == 3 && std::string(argv[1]) == "--client")
+    {
+        return runClient(argv[2]);
+    }
+
+    /**
+     * fork the zygote while smash is still small, it spawns the external commands from then on.
+     * SMASH_ZYGOTE=0 turns it off and smash forks every command by itself
+     */
+    const char *use_zygote = getenv("SMASH_ZYGOTE");
+    if (use_zygote == nullptr || std::string(use_zygote) != "0")
+    {
+        Zygote::getInstance().start();
+    }
+
+    /**
+     * SMASH_TRACE=<file> traces from here on like `trace on <file>`, for a script that is slow from its first line
+     */
+    const char *trace_path = getenv("SMASH_TRACE");
+    if (trace_path != nullptr && !Tracer::getInstance().start(trace_path))
+    {
+        perror("smash error: open failed");
+    }
+
     // get the smash singleton instance locally
     SmallShell &smash = SmallShell::getInstance();
+    /**
+     * in a terminal smash gives it to every foreground job (tcsetpgrp), so ctrl-C and ctrl-Z reach the whole job
+     * without passing through smash. not for a daemon, its sessions have no terminal of their own
+     */
+    smash.enableJobControl(STDIN_FILENO);
+    /**
+     * the jobs are journaled, a smash that died left its jobs in its journal and they are taken back
+     */
+    smash.openJournal();
     std::string cmd_line;
+    std::string input; // read but not run yet
     // run an infinite loop for reading the next command for execution
     while (true)
     {
+        // what came due while the last line ran (or while the lines of a script were read) starts now
+        smash.runDueSchedules();
         // get the current prompt for the smash
         std::cout << smash.getPrompt() << "> ";
-        // take in the command from the terminal
-        std::getline(std::cin, cmd_line);
+        std::cout.flush();
+        // take in the command from the terminal, at the end of the input exit like bash with the last status
+        if (!_read_line(smash, input, cmd_line))
+        {
+            return smash.getLastStatus();
+        }
         // execute the command
         smash.executeCommand(cmd_line.c_str());
+        if (smash.hasQuit())
+        {
+            break;
+        }
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+using namespace std;
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+struct TraceEvent
+{
+  const char *name;
+  const char *category;
+  long long start_ns;
+  long long end_ns;
+  char detail[Tracer::DETAIL_SIZE];
+};
+
+/**
+ * The spans a thread recorded and did not write yet. thread_local, so only its own thread touches it
+ */
+struct ThreadBuffer
+{
+  TraceEvent *events; // allocated at the first span of the thread, most threads never record one
+  size_t count;
+  pid_t pid; // 0 until the first span, and again in a son after the fork
+  pid_t tid;
+
+  ThreadBuffer()
+      : events(nullptr),
+        count(0),
+        pid(0),
+        tid(0)
+  {
+  }
+
+  ~ThreadBuffer()
+  {
+    flush();
+    delete[] events;
+  }
+
+  void flush();
+};
+
+static thread_local ThreadBuffer t_buffer;
+
+// * Helper Functions
+
+// the spans the parent recorded before the fork are the parent's to write, the son starts with an empty buffer
+static void _after_fork_in_son()
+{
+  t_buffer.count = 0;
+  t_buffer.pid = 0;
+}
+
+static void _append_escaped(std::string &out, const char *text)
+{
+  for (const char *c = text; *c != '\0'; c++)
+  {
+    if (*c == '"' || *c == '\\')
+    {
+      out += '\\';
+      out += *c;
+    }
+    else if ((unsigned char)*c < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+      out += escaped;
+    }
+    else
+    {
+      out += *c;
+    }
+  }
+}
+
+// the trace-event format counts in us, the fraction keeps the ns
+static void _append_us(std::string &out, long long ns)
+{
+  char number[32];
+  snprintf(number, sizeof(number), "%lld.%03lld", ns / 1000, ns % 1000);
+  out += number;
+}
+
+// * ThreadBuffer
+
+void ThreadBuffer::flush()
+{
+  if (count == 0)
+  {
+    return;
+  }
+  if (!Tracer::enabled()) // turned off since, the file is closed
+  {
+    count = 0;
+    return;
+  }
+  std::string data;
+  data.reserve(count * 160);
+  std::string ids = ",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(tid);
+  for (size_t i = 0; i < count; i++)
+  {
+    const TraceEvent &event = events[i];
+    data += "{\"name\":\"";
+    data += event.name;
+    data += "\",\"cat\":\"";
+    data += event.category;
+    data += "\",\"ph\":\"X\",\"ts\":";
+    _append_us(data, event.start_ns);
+    data += ",\"dur\":";
+    _append_us(data, event.end_ns - event.start_ns);
+    data += ids;
+    if (event.detail[0] != '\0')
+    {
+      data += ",\"args\":{\"detail\":\"";
+      _append_escaped(data, event.detail);
+      data += "\"}";
+    }
+    data += "},\n";
+  }
+  count = 0;
+  Tracer::getInstance().write(data);
+}
+
+// * Tracer
+
+Tracer::Tracer()
+    : m_fd(-1),
+      m_pid(-1),
+      m_path(),
+      m_fork_handler_set(false)
+{
+}
+
+Tracer::~Tracer()
+{
+  // the sons that exit() must leave the file of smash open
+  if (m_fd != -1 && getpid() == m_pid)
+  {
+    stop();
+  }
+}
+
+bool Tracer::start(const std::string &path)
+{
+  if (m_fd != -1)
+  {
+    stop();
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    return false;
+  }
+  if (!m_fork_handler_set)
+  {
+    pthread_atfork(nullptr, nullptr, _after_fork_in_son);
+    m_fork_handler_set = true;
+  }
+  m_fd = fd;
+  m_pid = getpid();
+  m_path = path;
+  t_buffer.count = 0;
+  std::string pid = std::to_string(m_pid);
+  write("[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + pid +
+        ",\"args\":{\"name\":\"smash\"}},\n");
+  s_enabled.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void Tracer::stop()
+{
+  if (m_fd == -1)
+  {
+    return;
+  }
+  if (getpid() == m_pid)
+  {
+    flushThread();
+    std::string pid = std::to_string(m_pid);
+    std::string end = "{\"name\":\"trace off\",\"cat\":\"smash\",\"ph\":\"i\",\"s\":\"g\",\"ts\":";
+    _append_us(end, now());
+    write(end + ",\"pid\":" + pid + ",\"tid\":" + pid + "}\n]\n");
+  }
+  s_enabled.store(false, std::memory_order_relaxed);
+  close(m_fd);
+  m_fd = -1;
+  m_path.clear();
+}
+
+long long Tracer::now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void Tracer::record(const char *name, const char *category, long long start_ns, long long end_ns,
+                    const char *detail)
+{
+  if (!enabled())
+  {
+    return;
+  }
+  ThreadBuffer &buffer = t_buffer;
+  if (buffer.events == nullptr)
+  {
+    buffer.events = new TraceEvent[BUFFER_EVENTS];
+  }
+  if (buffer.pid == 0)
+  {
+    buffer.pid = getpid();
+    buffer.tid = syscall(SYS_gettid);
+  }
+  TraceEvent &event = buffer.events[buffer.count++];
+  event.name = name;
+  event.category = category;
+  event.start_ns = start_ns;
+  event.end_ns = end_ns;
+  event.detail[0] = '\0';
+  if (detail != nullptr)
+  {
+    strncat(event.detail, detail, DETAIL_SIZE - 1);
+  }
+  if (buffer.count == BUFFER_EVENTS)
+  {
+    buffer.flush();
+  }
+}
+
+void Tracer::flushThread()
+{
+  t_buffer.flush();
+}
+
+void Tracer::write(const std::string &data) const
+{
+  // one write for the whole buffer: with O_APPEND the writes of the threads and the sons never interleave
+  size_t written = 0;
+  while (written < data.size())
+  {
+    ssize_t res = ::write(m_fd, data.data() + written, data.size() - written);
+    if (res == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return; // a full disk costs the trace, not the command
+    }
+    written += res;
+  }
+}
+
+// * Tracer::Span
+
+Tracer::Span::Span(const char *name, const char *category, const char *detail)
+    : m_name(name),
+      m_category(category),
+      m_detail(detail),
+      m_start_ns(enabled() ? now() : 0)
+{
+}
+
+Tracer::Span::Span(const char *name, const char *category, const std::string &detail)
+    : Span(name, category, detail.c_str())
+{
+}
+
+Tracer::Span::~Span()
+{
+  end();
+}
+
+void Tracer::Span::end()
+{
+  if (m_start_ns != 0)
+  {
+    record(m_name, m_category, m_start_ns, now(), m_detail);
+    m_start_ns = 0;
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef SMASH__TRACE_H_
+#define SMASH__TRACE_H_
+
+#include <atomic>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * @brief `trace on <file>` records where the time of smash goes, as spans in the trace-event JSON that
+ *    chrome://tracing and ui.perfetto.dev open: reading a line, creating its command, every fork (or zygote
+ *    spawn), exec and waitpid of the external commands and pipelines, the redirections and the reaping of jobs.
+ *
+ *    Every thread records into a buffer of its own, so a span costs two clock reads and a few stores, without a
+ *    lock or a system call. A full buffer is formatted and written with one write() to the file, which is opened
+ *    with O_APPEND so the threads and the sons of smash can share it without a lock. What is left is written when
+ *    the trace is turned off, when a thread exits and before a son execs or exits.
+ *    The file is a JSON array, closed by `trace off` (or when smash exits): a son that outlives it writes its
+ *    last spans after the end of the array.
+ */
+class Tracer
+{
+public:
+  Tracer(Tracer const &) = delete;
+  void operator=(Tracer const &) = delete;
+  static Tracer &getInstance()
+  {
+    static Tracer instance;
+    return instance;
+  }
+  ~Tracer();
+
+  // truncates the file and starts recording, false (with errno) if it could not be opened
+  bool start(const std::string &path);
+  // writes what the buffers of smash hold and closes the array and the file
+  void stop();
+  const std::string &getPath() const { return m_path; }
+
+  // the check every span starts with, nothing else is done while tracing is off
+  static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+  // CLOCK_MONOTONIC in ns, the clock of the spans
+  static long long now();
+  /**
+   * records a span of the calling thread. name and category must be string literals (only the pointer is kept),
+   * detail is copied (truncated to DETAIL_SIZE - 1 characters) and shows up in the args of the span
+   */
+  static void record(const char *name, const char *category, long long start_ns, long long end_ns,
+                     const char *detail = nullptr);
+  // writes the buffer of the calling thread, a son calls it before it execs or _exits
+  static void flushThread();
+
+  /**
+   * @brief A span from its construction to its destruction (or to end()), nothing is recorded while tracing is off.
+   *    the detail is read when the span is recorded, so it has to live as long as the span
+   */
+  class Span
+  {
+  public:
+    Span(const char *name, const char *category, const char *detail = nullptr);
+    Span(const char *name, const char *category, const std::string &detail);
+    ~Span();
+    Span(Span const &) = delete;
+    void operator=(Span const &) = delete;
+    // records the span now instead of at the destruction
+    void end();
+
+  private:
+    const char *m_name;
+    const char *m_category;
+    const char *m_detail;
+    long long m_start_ns; // 0 when tracing was off at the start, or after end()
+  };
+
+  static const size_t DETAIL_SIZE = 64;
+  static const size_t BUFFER_EVENTS = 1024;
+
+private:
+  static std::atomic<bool> s_enabled;
+  int m_fd;        // the trace file, -1 while tracing is off
+  pid_t m_pid;     // the smash that started the trace, its sons never close it
+  std::string m_path;
+  bool m_fork_handler_set;
+
+  Tracer();
+  void write(const std::string &data) const;
+  friend struct ThreadBuffer;
+};
+
+#endif //SMASH__TRACE_H_
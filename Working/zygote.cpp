@@ -0,0 +1,345 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "zygote.h"
+
+extern char **environ;
+
+using namespace std;
+
+// a request that does not fit (a huge environment) is not sent, smash forks by itself
+static const size_t MAX_REQUEST = 128 * 1024;
+// stdin, stdout, stderr and the working directory
+static const int REQUEST_FDS = 4;
+
+struct RequestHeader
+{
+  pid_t pgid;
+  uint32_t argc;
+  uint32_t envc;
+  struct rlimit limits[RLIM_NLIMITS];
+};
+
+struct Reply
+{
+  pid_t pid;
+  int error; // errno of the clone when pid is -1
+};
+
+// * Helper Functions
+
+/**
+ * Runs in the new process, a raw clone of the zygote: only async signal safe calls until the exec
+ */
+[[noreturn]] static void _exec_request(const RequestHeader &header, const int fds[REQUEST_FDS],
+                                       char **argv, char **envp, const struct rlimit own_limits[RLIM_NLIMITS])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (dup2(fds[i], i) == -1)
+    {
+      _exit(1);
+    }
+  }
+  if (setpgid(0, header.pgid) == -1)
+  {
+    perror("smash error: setpgid failed");
+    _exit(1);
+  }
+  if (fchdir(fds[3]) == -1)
+  {
+    perror("smash error: chdir failed");
+    _exit(1);
+  }
+  for (int resource = 0; resource < RLIM_NLIMITS; resource++)
+  {
+    const struct rlimit &limit = header.limits[resource];
+    if (limit.rlim_cur != own_limits[resource].rlim_cur || limit.rlim_max != own_limits[resource].rlim_max)
+    {
+      setrlimit((__rlimit_resource_t)resource, &limit);
+    }
+  }
+  // the zygote ignores ctrl-C and ctrl-Z, the command must not
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+
+  environ = envp;
+  execvp(argv[0], argv);
+  perror("smash error: execvp failed");
+  _exit(127);
+}
+
+// splits count NUL terminated strings starting at offset, false if the request ends before them
+static bool _split_strings(char *request, size_t size, size_t *offset, uint32_t count, std::vector<char *> &strings)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    char *end = (char *)memchr(request + *offset, '\0', size - *offset);
+    if (end == nullptr)
+    {
+      return false;
+    }
+    strings.push_back(request + *offset);
+    *offset = end - request + 1;
+  }
+  strings.push_back(nullptr);
+  return true;
+}
+
+// * Zygote
+
+Zygote::Zygote()
+    : m_fd(-1),
+      m_pid(-1)
+{
+}
+
+Zygote::~Zygote()
+{
+  // the zygote exits when it reads the end of the socket
+  if (m_fd != -1)
+  {
+    close(m_fd);
+  }
+}
+
+bool Zygote::start()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1)
+  {
+    return false;
+  }
+  pid_t smash_pid = getpid();
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == -1)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0) // * zygote
+  {
+    close(fds[0]);
+    // never outlive smash, even if it is killed before closing the socket
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != smash_pid)
+    {
+      _exit(0);
+    }
+    // ctrl-C in the terminal is for smash and its foreground command
+    setpgid(0, 0);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    // the zygote prints nothing and must not keep the terminal or a client socket of the daemon open
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd != -1)
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        dup2(null_fd, i);
+      }
+      if (null_fd > 2)
+      {
+        close(null_fd);
+      }
+    }
+    serve(fds[1]);
+  }
+
+  close(fds[1]);
+  m_fd = fds[0];
+  m_pid = pid;
+  return true;
+}
+
+pid_t Zygote::spawn(const std::vector<std::string> &argv, char *const envp[], const int fds[3], pid_t pgid,
+                    rlim_t files_limit)
+{
+  if (m_fd == -1 || argv.empty())
+  {
+    return -1;
+  }
+
+  RequestHeader header;
+  memset(&header, 0, sizeof(header));
+  header.pgid = pgid;
+  header.argc = argv.size();
+  for (int resource = 0; resource < RLIM_NLIMITS; resource++)
+  {
+    getrlimit((__rlimit_resource_t)resource, &header.limits[resource]);
+  }
+  if (files_limit != RLIM_INFINITY)
+  {
+    header.limits[RLIMIT_NOFILE].rlim_cur = files_limit;
+  }
+  std::string request;
+  for (const std::string &arg : argv)
+  {
+    request.append(arg.c_str(), arg.size() + 1);
+  }
+  for (char *const *var = envp; *var != nullptr; var++)
+  {
+    request.append(*var, strlen(*var) + 1);
+    header.envc++;
+  }
+  request.insert(0, (const char *)&header, sizeof(header));
+  if (request.size() > MAX_REQUEST)
+  {
+    return -1;
+  }
+
+  int cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (cwd_fd == -1)
+  {
+    return -1;
+  }
+  int request_fds[REQUEST_FDS] = {fds[0], fds[1], fds[2], cwd_fd};
+
+  struct iovec iov;
+  iov.iov_base = (void *)request.data();
+  iov.iov_len = request.size();
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(request_fds))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(request_fds));
+  memcpy(CMSG_DATA(cmsg), request_fds, sizeof(request_fds));
+
+  ssize_t sent = -1;
+  do
+  {
+    sent = sendmsg(m_fd, &message, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  close(cwd_fd);
+  if (sent == -1 && errno == EMSGSIZE) // larger than the socket buffer, the zygote is fine
+  {
+    return -1;
+  }
+
+  Reply reply;
+  ssize_t received = -1;
+  if (sent != -1)
+  {
+    do
+    {
+      received = recv(m_fd, &reply, sizeof(reply), 0);
+    } while (received == -1 && errno == EINTR);
+  }
+  if (received != sizeof(reply))
+  {
+    // the zygote is gone, smash forks by itself from now on
+    close(m_fd);
+    m_fd = -1;
+    waitpid(m_pid, nullptr, WNOHANG);
+    return -1;
+  }
+  if (reply.pid == -1)
+  {
+    errno = reply.error;
+    return -1;
+  }
+  // like after a fork, done by both sides so the group exists when the next stage of a pipeline joins it
+  setpgid(reply.pid, pgid ? pgid : reply.pid);
+  return reply.pid;
+}
+
+void Zygote::serve(int fd)
+{
+  static char request[MAX_REQUEST];
+  struct rlimit own_limits[RLIM_NLIMITS];
+  for (int resource = 0; resource < RLIM_NLIMITS; resource++)
+  {
+    getrlimit((__rlimit_resource_t)resource, &own_limits[resource]);
+  }
+
+  while (true)
+  {
+    struct iovec iov;
+    iov.iov_base = request;
+    iov.iov_len = sizeof(request);
+    union
+    {
+      char buffer[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+      struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t size = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    if (size == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (size <= 0) // smash closed the socket
+    {
+      _exit(0);
+    }
+
+    int fds[REQUEST_FDS] = {-1, -1, -1, -1};
+    int fds_count = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+      fds_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * std::min(fds_count, REQUEST_FDS));
+    }
+
+    Reply reply = {-1, EINVAL};
+    RequestHeader header;
+    std::vector<char *> argv;
+    std::vector<char *> envp;
+    size_t offset = sizeof(header);
+    if (fds_count == REQUEST_FDS && !(message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && (size_t)size >= sizeof(header))
+    {
+      memcpy(&header, request, sizeof(header));
+      if (header.argc > 0 && _split_strings(request, size, &offset, header.argc, argv) &&
+          _split_strings(request, size, &offset, header.envc, envp))
+      {
+        // CLONE_PARENT: the new process is a son of smash and not of the zygote.
+        // a raw clone skips the fork handlers of libc, the son only makes system calls until it execs
+        pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+        if (pid == 0)
+        {
+          _exec_request(header, fds, argv.data(), envp.data(), own_limits);
+        }
+        reply.pid = pid;
+        reply.error = errno;
+      }
+    }
+    for (int i = 0; i < std::min(fds_count, REQUEST_FDS); i++)
+    {
+      close(fds[i]);
+    }
+    send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef SMASH__ZYGOTE_H_
+#define SMASH__ZYGOTE_H_
+
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+ * @brief The zygote is a small process forked when smash starts, before the job table, the variables and the
+ *    caches grow. Forking copies the page tables of the process, so smash asks the zygote to spawn its external
+ *    commands and the cost of a spawn stays the same however big smash gets.
+ *
+ *    A request (argv, envp, the stdin/stdout/stderr and the working directory as fds passed with SCM_RIGHTS,
+ *    the process group and the resource limits) is one message on a SOCK_SEQPACKET socketpair.
+ *    The zygote clones with CLONE_PARENT, so the new process is a son of smash: waitpid, pidfds and the
+ *    jobs list work on it as if smash forked it itself. The reply is its pid.
+ */
+class Zygote
+{
+public:
+  Zygote(Zygote const &) = delete;
+  void operator=(Zygote const &) = delete;
+  static Zygote &getInstance()
+  {
+    static Zygote instance;
+    return instance;
+  }
+  ~Zygote();
+
+  // forks the zygote, returns false if it could not be started and smash forks by itself
+  bool start();
+  bool isRunning() const { return m_fd != -1; }
+  /**
+   * fds: the stdin, stdout and stderr of the new process. pgid: 0 for a group of its own, or the group to join.
+   * files_limit: its soft limit of open files, RLIM_INFINITY for the one of smash (it gets all the other limits of
+   * smash). returns the pid, or -1 when the zygote could not spawn it (the caller forks instead).
+   * a failing exec is reported by the new process itself, like a forked son does, and it exits with 127.
+   */
+  pid_t spawn(const std::vector<std::string> &argv, char *const envp[], const int fds[3], pid_t pgid,
+              rlim_t files_limit = RLIM_INFINITY);
+
+private:
+  int m_fd; // the smash side of the socketpair
+  pid_t m_pid;
+
+  Zygote();
+  [[noreturn]] static void serve(int fd);
+};
+
+#endif //SMASH__ZYGOTE_H_